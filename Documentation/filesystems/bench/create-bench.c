@@ -0,0 +1,171 @@
+/*
+ * create-bench.c - inode create/unlink scalability benchmark
+ *
+ * Has 1, 2, 4, ... processes, each bound to its own CPU and working in
+ * its own directory <dir>/create-bench/p<N>, create and unlink a file in
+ * a loop.  Every iteration allocates, hashes, puts on the superblock list
+ * and finally frees an inode, so the aggregate rate is limited by the
+ * inode cache locking rather than by i_mutex on a shared directory.
+ * Prints the aggregate create+unlink pairs per second for every process
+ * count together with the speedup over a single process.
+ *
+ * Usage: create-bench [-p maxprocs] [-s seconds] [dir]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_PROCS	256
+
+struct shared {
+	volatile int go;
+	volatile int stop;
+	unsigned long ops[MAX_PROCS];
+};
+
+static struct shared *shm;
+static char base[PATH_MAX - 32];
+
+static void die(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void bind_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+}
+
+static void worker(int id, int cpu)
+{
+	char path[PATH_MAX];
+	unsigned long ops = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/p%d", base, id);
+	if (mkdir(path, 0755) && errno != EEXIST)
+		die(path);
+	strncat(path, "/file", sizeof(path) - strlen(path) - 1);
+
+	bind_cpu(cpu);
+	while (!shm->go)
+		sched_yield();
+	while (!shm->stop) {
+		fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0)
+			die("open");
+		close(fd);
+		if (unlink(path))
+			die("unlink");
+		ops++;
+	}
+	shm->ops[id] = ops;
+	_exit(0);
+}
+
+static double run(int nprocs, int ncpus, int seconds)
+{
+	unsigned long total = 0;
+	struct timeval t0, t1;
+	double secs;
+	int i;
+
+	memset(shm, 0, sizeof(*shm));
+	fflush(stdout);
+	for (i = 0; i < nprocs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			worker(i, i % ncpus);
+	}
+
+	gettimeofday(&t0, NULL);
+	shm->go = 1;
+	sleep(seconds);
+	shm->stop = 1;
+	gettimeofday(&t1, NULL);
+
+	for (i = 0; i < nprocs; i++)
+		wait(NULL);
+	for (i = 0; i < nprocs; i++)
+		total += shm->ops[i];
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	return total / secs;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "/tmp";
+	int seconds = 5, maxprocs;
+	double rate1 = 0;
+	int ncpus, n, opt;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	maxprocs = ncpus;
+
+	while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			maxprocs = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p maxprocs] [-s seconds] "
+				"[dir]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dir = argv[optind];
+	if (maxprocs < 1 || maxprocs > MAX_PROCS)
+		maxprocs = MAX_PROCS;
+
+	snprintf(base, sizeof(base), "%s/create-bench", dir);
+	if (mkdir(base, 0755) && errno != EEXIST)
+		die(base);
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		die("mmap");
+
+	printf("dir %s, %d cpus\n", base, ncpus);
+	printf("%6s %14s %14s %8s\n", "procs", "creates/s", "per-proc", "speedup");
+	for (n = 1; n <= maxprocs; n = n < maxprocs && n * 2 > maxprocs ?
+					maxprocs : n * 2) {
+		double rate = run(n, ncpus, seconds);
+
+		if (n == 1)
+			rate1 = rate;
+		printf("%6d %14.0f %14.0f %8.2f\n", n, rate, rate / n,
+		       rate1 ? rate / rate1 : 0.0);
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * lookup-bench.c - path lookup scalability benchmark
+ *
+ * Builds a directory chain <dir>/d0/d1/.../dN/file and then has 1, 2, 4,
+ * ... processes, each bound to its own CPU, stat() the full path in a
+ * loop.  Prints the aggregate lookups per second for every process count
+ * together with the speedup over a single process, which is what the
+ * RCU path walk (see Documentation/filesystems/dentry-locking.txt) is
+ * supposed to improve.
+ *
+ * Usage: lookup-bench [-d depth] [-p maxprocs] [-s seconds] [dir]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_PROCS	256
+
+struct shared {
+	volatile int go;
+	volatile int stop;
+	unsigned long ops[MAX_PROCS];
+};
+
+static struct shared *shm;
+static char path[PATH_MAX];
+
+static void die(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void bind_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+}
+
+static void worker(int id, int cpu)
+{
+	unsigned long ops = 0;
+	struct stat st;
+
+	bind_cpu(cpu);
+	while (!shm->go)
+		sched_yield();
+	while (!shm->stop) {
+		if (stat(path, &st))
+			die("stat");
+		ops++;
+	}
+	shm->ops[id] = ops;
+	_exit(0);
+}
+
+static double run(int nprocs, int ncpus, int seconds)
+{
+	unsigned long total = 0;
+	struct timeval t0, t1;
+	double secs;
+	int i;
+
+	memset(shm, 0, sizeof(*shm));
+	fflush(stdout);
+	for (i = 0; i < nprocs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			worker(i, i % ncpus);
+	}
+
+	gettimeofday(&t0, NULL);
+	shm->go = 1;
+	sleep(seconds);
+	shm->stop = 1;
+	gettimeofday(&t1, NULL);
+
+	for (i = 0; i < nprocs; i++)
+		wait(NULL);
+	for (i = 0; i < nprocs; i++)
+		total += shm->ops[i];
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	return total / secs;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "/tmp";
+	int depth = 8, seconds = 5, maxprocs;
+	double base = 0;
+	int ncpus, n, i, fd, opt;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	maxprocs = ncpus;
+
+	while ((opt = getopt(argc, argv, "d:p:s:")) != -1) {
+		switch (opt) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'p':
+			maxprocs = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d depth] [-p maxprocs] "
+				"[-s seconds] [dir]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dir = argv[optind];
+	if (maxprocs < 1 || maxprocs > MAX_PROCS)
+		maxprocs = MAX_PROCS;
+
+	snprintf(path, sizeof(path), "%s/lookup-bench", dir);
+	for (i = 0; i < depth; i++) {
+		if (mkdir(path, 0755) && errno != EEXIST)
+			die(path);
+		n = strlen(path);
+		snprintf(path + n, sizeof(path) - n, "/d%d", i);
+	}
+	if (mkdir(path, 0755) && errno != EEXIST)
+		die(path);
+	strncat(path, "/file", sizeof(path) - strlen(path) - 1);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		die(path);
+	close(fd);
+
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shm == MAP_FAILED)
+		die("mmap");
+
+	printf("path %s, %d cpus\n", path, ncpus);
+	printf("%6s %14s %14s %8s\n", "procs", "lookups/s", "per-proc", "speedup");
+	for (n = 1; n <= maxprocs; n = n < maxprocs && n * 2 > maxprocs ?
+					maxprocs : n * 2) {
+		double rate = run(n, ncpus, seconds);
+
+		if (n == 1)
+			base = rate;
+		printf("%6d %14.0f %14.0f %8.2f\n", n, rate, rate / n,
+		       base ? rate / base : 0.0);
+	}
+	return 0;
+}
@@ -17,6 +17,7 @@
 #include <linux/init.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/dma-contiguous.h>
 
 #include <asm/memory.h>
 #include <asm/highmem.h>
@@ -105,6 +106,7 @@ struct arm_vm_region {
 	unsigned long		vm_end;
 	struct page		*vm_pages;
 	int			vm_active;
+	int			vm_contig;	/* vm_pages from dma_alloc_from_contiguous() */
 };
 
 static struct arm_vm_region consistent_head = {
@@ -176,11 +178,12 @@ static void *
 __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 	    pgprot_t prot)
 {
-	struct page *page;
+	struct page *page = NULL;
 	struct arm_vm_region *c;
-	unsigned long order;
+	unsigned long order, count;
 	u64 mask = get_coherent_dma_mask(dev);
 	u64 limit;
+	int contig = 0;
 
 	if (!consistent_pte[0]) {
 		printk(KERN_ERR "%s: not initialised\n", __func__);
@@ -204,11 +207,26 @@ __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 	}
 
 	order = get_order(size);
+	count = size >> PAGE_SHIFT;
 
 	if (mask != 0xffffffff)
 		gfp |= GFP_DMA;
 
-	page = alloc_pages(gfp, order);
+	/*
+	 * Large buffers are hard to find in a fragmented buddy allocator;
+	 * take them from the contiguous area when the caller may sleep.
+	 * Those pages are already split and refcounted.
+	 */
+	if (order > PAGE_ALLOC_COSTLY_ORDER && (gfp & __GFP_WAIT)) {
+		page = dma_alloc_from_contiguous(dev, count, order);
+		if (page && page_to_dma(dev, page) + size - 1 > mask) {
+			dma_release_from_contiguous(dev, page, count);
+			page = NULL;
+		}
+		contig = page != NULL;
+	}
+	if (!page)
+		page = alloc_pages(gfp, order);
 	if (!page)
 		goto no_page;
 
@@ -230,14 +248,16 @@ __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 			    gfp & ~(__GFP_DMA | __GFP_HIGHMEM));
 	if (c) {
 		pte_t *pte;
-		struct page *end = page + (1 << order);
+		struct page *end = page + (contig ? count : 1 << order);
 		int idx = CONSISTENT_PTE_INDEX(c->vm_start);
 		u32 off = CONSISTENT_OFFSET(c->vm_start) & (PTRS_PER_PTE-1);
 
 		pte = consistent_pte[idx] + off;
 		c->vm_pages = page;
+		c->vm_contig = contig;
 
-		split_page(page, order);
+		if (!contig)
+			split_page(page, order);
 
 		/*
 		 * Set the "dma handle"
@@ -272,7 +292,9 @@ __dma_alloc(struct device *dev, size_t size, dma_addr_t *handle, gfp_t gfp,
 		return (void *)c->vm_start;
 	}
 
-	if (page)
+	if (contig)
+		dma_release_from_contiguous(dev, page, count);
+	else
 		__free_pages(page, order);
  no_page:
 	*handle = ~0;
@@ -459,7 +481,8 @@ void dma_free_coherent(struct device *dev, size_t size, void *cpu_addr, dma_addr
 				 */
 				ClearPageReserved(page);
 
-				__free_page(page);
+				if (!c->vm_contig)
+					__free_page(page);
 				continue;
 			}
 		}
@@ -470,6 +493,10 @@ void dma_free_coherent(struct device *dev, size_t size, void *cpu_addr, dma_addr
 
 	flush_tlb_kernel_range(c->vm_start, c->vm_end);
 
+	if (c->vm_contig)
+		dma_release_from_contiguous(dev, c->vm_pages,
+				(c->vm_end - c->vm_start) >> PAGE_SHIFT);
+
 	spin_lock_irqsave(&consistent_lock, flags);
 	list_del(&c->vm_list);
 	spin_unlock_irqrestore(&consistent_lock, flags);
@@ -17,6 +17,7 @@
 #include <linux/initrd.h>
 #include <linux/sort.h>
 #include <linux/highmem.h>
+#include <linux/dma-contiguous.h>
 
 #include <asm/mach-types.h>
 #include <asm/sections.h>
@@ -442,6 +443,12 @@ void __init bootmem_init(void)
 	for_each_node(node)
 		bootmem_free_node(node, mi);
 
+	/*
+	 * Reserve the contiguous DMA area while bootmem is still in
+	 * charge; it is released as MIGRATE_CMA pageblocks later on.
+	 */
+	dma_contiguous_reserve();
+
 	high_memory = __va((max_low << PAGE_SHIFT) - 1) + 1;
 
 	/*
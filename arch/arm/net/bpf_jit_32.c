@@ -0,0 +1,746 @@
+/*
+ * Just-In-Time compiler for BPF filters on 32bit ARM
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * The filter is translated once, when it is attached to a socket, into
+ * a function with the same prototype as sk_run_filter() minus the length
+ * argument.  Filters using something the translator does not know about
+ * keep running in the interpreter.
+ *
+ * Register usage of the generated code:
+ *
+ *	r0 - r3, ip	scratch, arguments and return value of the helpers
+ *	r4		A, the accumulator
+ *	r5		X, the index register
+ *	r6		pointer to the skb
+ *	r7		skb->data
+ *	r8		length of the linear part of the skb
+ *	sp		the 16 words of scratch memory, when the filter uses them
+ */
+
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+#include <linux/filter.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+#include <asm/unaligned.h>
+
+#include "bpf_jit_32.h"
+
+#define r_scratch	ARM_R0
+#define r_off		ARM_R1
+#define r_A		ARM_R4
+#define r_X		ARM_R5
+#define r_skb		ARM_R6
+#define r_skb_data	ARM_R7
+#define r_skb_hl	ARM_R8
+
+/* A u64 is returned in r0/r1, most significant word first on big endian */
+#ifdef __ARMEB__
+#define r_res_val	ARM_R1
+#define r_res_err	ARM_R0
+#else
+#define r_res_val	ARM_R0
+#define r_res_err	ARM_R1
+#endif
+
+#define SAVED_REGS	(1 << r_A | 1 << r_X | 1 << r_skb | 1 << r_skb_data | \
+			 1 << r_skb_hl)
+
+#define SEEN_MEM	(1 << 0)	/* scratch memory store */
+#define SEEN_DATA	(1 << 1)	/* direct access to the linear data */
+
+#define SCRATCH_SIZE	(BPF_MEMWORDS * 4)
+
+int bpf_jit_enable __read_mostly;
+EXPORT_SYMBOL_GPL(bpf_jit_enable);
+
+struct jit_ctx {
+	const struct sk_filter *skf;
+	unsigned idx;		/* next instruction to emit */
+	u32 seen;
+	u32 *offsets;		/* first instruction of each filter insn */
+	u32 *target;		/* NULL while sizing the code */
+};
+
+/*
+ * Helpers called from the generated code when the bytes to load are not
+ * in the linear part of the skb, are relative to a header or refer to
+ * ancillary data.  They return the value in the low word of the result
+ * and a non-zero high word if the filter has to return 0.
+ */
+static u64 jit_get_skb_b(struct sk_buff *skb, int offset, u32 A, u32 X)
+{
+	u8 tmp, *ptr;
+	u32 res;
+
+	ptr = bpf_load_pointer(skb, offset, 1, &tmp);
+	if (ptr)
+		return *ptr;
+	if (bpf_load_ancillary(skb, offset, A, X, &res))
+		return (u64)1 << 32;
+	return res;
+}
+
+static u64 jit_get_skb_h(struct sk_buff *skb, int offset, u32 A, u32 X)
+{
+	u16 tmp;
+	void *ptr;
+	u32 res;
+
+	ptr = bpf_load_pointer(skb, offset, 2, &tmp);
+	if (ptr)
+		return get_unaligned_be16(ptr);
+	if (bpf_load_ancillary(skb, offset, A, X, &res))
+		return (u64)1 << 32;
+	return res;
+}
+
+static u64 jit_get_skb_w(struct sk_buff *skb, int offset, u32 A, u32 X)
+{
+	u32 tmp;
+	void *ptr;
+	u32 res;
+
+	ptr = bpf_load_pointer(skb, offset, 4, &tmp);
+	if (ptr)
+		return get_unaligned_be32(ptr);
+	if (bpf_load_ancillary(skb, offset, A, X, &res))
+		return (u64)1 << 32;
+	return res;
+}
+
+/* BPF_LDX|BPF_B|BPF_MSH does not look at ancillary data */
+static u64 jit_get_skb_msh(struct sk_buff *skb, int offset)
+{
+	u8 tmp, *ptr;
+
+	ptr = bpf_load_pointer(skb, offset, 1, &tmp);
+	if (ptr)
+		return *ptr;
+	return (u64)1 << 32;
+}
+
+/* Older cores have no divide instruction, use the one from libgcc */
+static u32 jit_udiv(u32 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline void _emit(int cond, u32 inst, struct jit_ctx *ctx)
+{
+	if (ctx->target != NULL)
+		ctx->target[ctx->idx] = inst | (cond << 28);
+
+	ctx->idx++;
+}
+
+static inline void emit(u32 inst, struct jit_ctx *ctx)
+{
+	_emit(ARM_COND_AL, inst, ctx);
+}
+
+/*
+ * Encode a constant as an ARM data processing immediate: an 8 bit value
+ * rotated right by an even amount.  Returns -1 if that is not possible.
+ */
+static int imm8m(u32 x)
+{
+	u32 rot;
+
+	if (x <= 0xff)
+		return x;
+
+	for (rot = 1; rot < 16; rot++)
+		if ((x & ~ror32(0xff, 2 * rot)) == 0)
+			return rol32(x, 2 * rot) | (rot << 8);
+
+	return -1;
+}
+
+/* Offset of a branch from the current instruction to filter insn @tgt */
+static inline int b_imm(unsigned tgt, struct jit_ctx *ctx)
+{
+	if (ctx->target == NULL)
+		return 0;
+
+	/* the pc reads two instructions ahead of the branch */
+	return ctx->offsets[tgt] - (ctx->idx + 2);
+}
+
+/* Point the branch emitted at @at to the current instruction */
+static inline void emit_patch_b(int cond, unsigned at, struct jit_ctx *ctx)
+{
+	if (ctx->target != NULL)
+		ctx->target[at] = ARM_B(ctx->idx - (at + 2)) | (cond << 28);
+}
+
+static void emit_mov_i_no8m(int rd, u32 val, struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 7
+	int shift;
+
+	/* build the constant a byte at a time */
+	emit(ARM_MOV_I(rd, val & 0xff), ctx);
+	for (shift = 8; shift < 32; shift += 8)
+		if (val & (0xffU << shift))
+			emit(ARM_ORR_I(rd, rd, imm8m(val & (0xffU << shift))),
+			     ctx);
+#else
+	emit(ARM_MOVW(rd, val & 0xffff), ctx);
+	if (val > 0xffff)
+		emit(ARM_MOVT(rd, val >> 16), ctx);
+#endif
+}
+
+static void emit_mov_i(int rd, u32 val, struct jit_ctx *ctx)
+{
+	int imm12 = imm8m(val);
+
+	if (imm12 >= 0)
+		emit(ARM_MOV_I(rd, imm12), ctx);
+	else if ((imm12 = imm8m(~val)) >= 0)
+		emit(ARM_MVN_I(rd, imm12), ctx);
+	else
+		emit_mov_i_no8m(rd, val, ctx);
+}
+
+static void emit_call(void *func, struct jit_ctx *ctx)
+{
+	emit_mov_i(ARM_IP, (u32)func, ctx);
+#if __LINUX_ARM_ARCH__ < 5
+	emit(ARM_MOV_R(ARM_LR, ARM_PC), ctx);
+	emit(ARM_MOV_R(ARM_PC, ARM_IP), ctx);
+#else
+	emit(ARM_BLX_R(ARM_IP), ctx);
+#endif
+}
+
+/* Leave the filter returning 0 if the flags are set for @cond */
+static void emit_err_ret(int cond, struct jit_ctx *ctx)
+{
+	_emit(cond, ARM_MOV_I(ARM_R0, 0), ctx);
+	_emit(cond, ARM_B(b_imm(ctx->skf->len, ctx)), ctx);
+}
+
+/* Load @size bytes at offset r_off of the linear data, in host order */
+static void emit_load_data(unsigned size, int rd, struct jit_ctx *ctx)
+{
+	switch (size) {
+	case 1:
+		emit(ARM_LDRB_R(rd, r_skb_data, r_off), ctx);
+		break;
+#if __LINUX_ARM_ARCH__ < 6
+	/* no unaligned access, assemble the value from single bytes */
+	case 2:
+		emit(ARM_ADD_R(ARM_R3, r_skb_data, r_off), ctx);
+		emit(ARM_LDRB_I(ARM_R0, ARM_R3, 0), ctx);
+		emit(ARM_LDRB_I(ARM_R1, ARM_R3, 1), ctx);
+		emit(ARM_ORR_S(rd, ARM_R1, ARM_R0, SRTYPE_LSL, 8), ctx);
+		break;
+	case 4:
+		emit(ARM_ADD_R(ARM_R3, r_skb_data, r_off), ctx);
+		emit(ARM_LDRB_I(ARM_R0, ARM_R3, 0), ctx);
+		emit(ARM_LDRB_I(ARM_R1, ARM_R3, 1), ctx);
+		emit(ARM_ORR_S(ARM_R0, ARM_R1, ARM_R0, SRTYPE_LSL, 8), ctx);
+		emit(ARM_LDRB_I(ARM_R1, ARM_R3, 2), ctx);
+		emit(ARM_ORR_S(ARM_R0, ARM_R1, ARM_R0, SRTYPE_LSL, 8), ctx);
+		emit(ARM_LDRB_I(ARM_R1, ARM_R3, 3), ctx);
+		emit(ARM_ORR_S(rd, ARM_R1, ARM_R0, SRTYPE_LSL, 8), ctx);
+		break;
+#else
+	case 2:
+#ifdef __ARMEB__
+		emit(ARM_LDRH_R(rd, r_skb_data, r_off), ctx);
+#else
+		emit(ARM_LDRH_R(ARM_R0, r_skb_data, r_off), ctx);
+		emit(ARM_REV16(rd, ARM_R0), ctx);
+#endif
+		break;
+	case 4:
+#ifdef __ARMEB__
+		emit(ARM_LDR_R(rd, r_skb_data, r_off), ctx);
+#else
+		emit(ARM_LDR_R(ARM_R0, r_skb_data, r_off), ctx);
+		emit(ARM_REV(rd, ARM_R0), ctx);
+#endif
+		break;
+#endif
+	}
+}
+
+/*
+ * Packet loads.  The offset is computed in r_off; if it is in the linear
+ * part of the skb the bytes are loaded directly, everything else (negative
+ * offsets, paged data, ancillary data) goes through a helper.
+ */
+static void emit_load(unsigned size, bool ind, bool msh, u32 k,
+		      struct jit_ctx *ctx)
+{
+	int dst = msh ? r_res_val : r_A;
+	unsigned neg_b = 0, len_b = 0, done_b = 0;
+	bool fast = ind || (int)k >= 0;
+	void *func;
+	int imm12;
+
+	if (ind) {
+		imm12 = imm8m(k);
+		if (imm12 >= 0) {
+			emit(ARM_ADD_I(r_off, r_X, imm12), ctx);
+		} else {
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_ADD_R(r_off, r_X, r_scratch), ctx);
+		}
+	} else {
+		emit_mov_i(r_off, k, ctx);
+	}
+
+	if (fast) {
+		ctx->seen |= SEEN_DATA;
+
+		if (ind) {
+			emit(ARM_CMP_I(r_off, 0), ctx);
+			neg_b = ctx->idx;
+			_emit(ARM_COND_LT, ARM_B(0), ctx);
+		}
+		emit(ARM_ADD_I(ARM_R2, r_off, size), ctx);
+		emit(ARM_CMP_R(ARM_R2, r_skb_hl), ctx);
+		len_b = ctx->idx;
+		_emit(ARM_COND_HI, ARM_B(0), ctx);
+
+		emit_load_data(size, dst, ctx);
+
+		done_b = ctx->idx;
+		emit(ARM_B(0), ctx);
+
+		/* slow path */
+		if (ind)
+			emit_patch_b(ARM_COND_LT, neg_b, ctx);
+		emit_patch_b(ARM_COND_HI, len_b, ctx);
+	}
+
+	emit(ARM_MOV_R(ARM_R0, r_skb), ctx);
+	if (msh) {
+		func = jit_get_skb_msh;
+	} else {
+		emit(ARM_MOV_R(ARM_R2, r_A), ctx);
+		emit(ARM_MOV_R(ARM_R3, r_X), ctx);
+		func = size == 1 ? (void *)jit_get_skb_b :
+		       size == 2 ? (void *)jit_get_skb_h :
+				   (void *)jit_get_skb_w;
+	}
+	emit_call(func, ctx);
+
+	emit(ARM_CMP_I(r_res_err, 0), ctx);
+	emit_err_ret(ARM_COND_NE, ctx);
+	if (dst != r_res_val)
+		emit(ARM_MOV_R(dst, r_res_val), ctx);
+
+	if (fast)
+		emit_patch_b(ARM_COND_AL, done_b, ctx);
+
+	if (msh) {
+		emit(ARM_AND_I(ARM_R0, r_res_val, 0x0f), ctx);
+		emit(ARM_LSL_I(r_X, ARM_R0, 2), ctx);
+	}
+}
+
+static void emit_udiv(struct jit_ctx *ctx)
+{
+	emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+	emit_call(jit_udiv, ctx);
+	emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+}
+
+static void build_prologue(struct jit_ctx *ctx)
+{
+	emit(ARM_PUSH(SAVED_REGS | 1 << ARM_LR), ctx);
+	if (ctx->seen & SEEN_MEM)
+		emit(ARM_SUB_I(ARM_SP, ARM_SP, imm8m(SCRATCH_SIZE)), ctx);
+
+	emit(ARM_MOV_R(r_skb, ARM_R0), ctx);
+	emit(ARM_MOV_I(r_A, 0), ctx);
+	emit(ARM_MOV_I(r_X, 0), ctx);
+
+	if (ctx->seen & SEEN_DATA) {
+		emit(ARM_LDR_I(r_skb_data, r_skb,
+			       offsetof(struct sk_buff, data)), ctx);
+		/* headlen = len - data_len */
+		emit(ARM_LDR_I(r_skb_hl, r_skb,
+			       offsetof(struct sk_buff, len)), ctx);
+		emit(ARM_LDR_I(r_scratch, r_skb,
+			       offsetof(struct sk_buff, data_len)), ctx);
+		emit(ARM_SUB_R(r_skb_hl, r_skb_hl, r_scratch), ctx);
+	}
+}
+
+static void build_epilogue(struct jit_ctx *ctx)
+{
+	if (ctx->seen & SEEN_MEM)
+		emit(ARM_ADD_I(ARM_SP, ARM_SP, imm8m(SCRATCH_SIZE)), ctx);
+	emit(ARM_POP(SAVED_REGS | 1 << ARM_PC), ctx);
+}
+
+/* Emit A op= k, using a scratch register if k is not an immediate */
+static void emit_alu_k(u32 inst_i, u32 inst_r, u32 k, struct jit_ctx *ctx)
+{
+	int imm12 = imm8m(k);
+
+	if (imm12 >= 0) {
+		emit(inst_i | r_A << 12 | r_A << 16 | imm12, ctx);
+	} else {
+		emit_mov_i(r_scratch, k, ctx);
+		emit(inst_r | r_A << 12 | r_A << 16 | r_scratch, ctx);
+	}
+}
+
+static int build_body(struct jit_ctx *ctx)
+{
+	const struct sk_filter *prog = ctx->skf;
+	const struct sock_filter *inst;
+	int cond_t, cond_f;
+	unsigned i;
+	int imm12;
+	u32 k;
+
+	for (i = 0; i < prog->len; i++) {
+		inst = &prog->insns[i];
+		k = inst->k;
+
+		ctx->offsets[i] = ctx->idx;
+
+		switch (inst->code) {
+		case BPF_ALU|BPF_ADD|BPF_K:
+			if (imm8m(k) < 0 && imm8m(-k) >= 0)
+				emit(ARM_SUB_I(r_A, r_A, imm8m(-k)), ctx);
+			else
+				emit_alu_k(ARM_INST_ADD_I, ARM_INST_ADD_R, k,
+					   ctx);
+			break;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			emit(ARM_ADD_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_K:
+			if (imm8m(k) < 0 && imm8m(-k) >= 0)
+				emit(ARM_ADD_I(r_A, r_A, imm8m(-k)), ctx);
+			else
+				emit_alu_k(ARM_INST_SUB_I, ARM_INST_SUB_R, k,
+					   ctx);
+			break;
+		case BPF_ALU|BPF_SUB|BPF_X:
+			emit(ARM_SUB_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_MUL(r_A, r_A, r_scratch), ctx);
+			break;
+		case BPF_ALU|BPF_MUL|BPF_X:
+			emit(ARM_MUL(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_K:
+			/* sk_chk_filter() rejects k == 0 */
+			if (k == 1)
+				break;
+			if (is_power_of_2(k)) {
+				emit(ARM_LSR_I(r_A, r_A, ilog2(k)), ctx);
+				break;
+			}
+			emit_mov_i(ARM_R1, k, ctx);
+			emit_udiv(ctx);
+			break;
+		case BPF_ALU|BPF_DIV|BPF_X:
+			emit(ARM_CMP_I(r_X, 0), ctx);
+			emit_err_ret(ARM_COND_EQ, ctx);
+			emit(ARM_MOV_R(ARM_R1, r_X), ctx);
+			emit_udiv(ctx);
+			break;
+		case BPF_ALU|BPF_AND|BPF_K:
+			imm12 = imm8m(~k);
+			if (imm8m(k) < 0 && imm12 >= 0)
+				emit(ARM_BIC_I(r_A, r_A, imm12), ctx);
+			else
+				emit_alu_k(ARM_INST_AND_I, ARM_INST_AND_R, k,
+					   ctx);
+			break;
+		case BPF_ALU|BPF_AND|BPF_X:
+			emit(ARM_AND_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			emit_alu_k(ARM_INST_ORR_I, ARM_INST_ORR_R, k, ctx);
+			break;
+		case BPF_ALU|BPF_OR|BPF_X:
+			emit(ARM_ORR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+			/*
+			 * Shifts by 32 or more go through a register, which
+			 * is what the interpreter does on this architecture.
+			 */
+			if (k == 0)
+				break;
+			if (k < 32) {
+				emit(ARM_LSL_I(r_A, r_A, k), ctx);
+			} else {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSL_R(r_A, r_A, r_scratch), ctx);
+			}
+			break;
+		case BPF_ALU|BPF_LSH|BPF_X:
+			emit(ARM_LSL_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_RSH|BPF_K:
+			if (k == 0)
+				break;
+			if (k < 32) {
+				emit(ARM_LSR_I(r_A, r_A, k), ctx);
+			} else {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSR_R(r_A, r_A, r_scratch), ctx);
+			}
+			break;
+		case BPF_ALU|BPF_RSH|BPF_X:
+			emit(ARM_LSR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_ALU|BPF_NEG:
+			emit(ARM_RSB_I(r_A, r_A, 0), ctx);
+			break;
+		case BPF_JMP|BPF_JA:
+			if (k != 0)
+				emit(ARM_B(b_imm(i + k + 1, ctx)), ctx);
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:
+			cond_t = ARM_COND_HI;
+			cond_f = ARM_COND_LS;
+			goto cmp_k;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			cond_t = ARM_COND_HS;
+			cond_f = ARM_COND_LO;
+			goto cmp_k;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			cond_t = ARM_COND_EQ;
+			cond_f = ARM_COND_NE;
+cmp_k:
+			if (inst->jt == inst->jf)
+				goto jmp_always;
+			imm12 = imm8m(k);
+			if (imm12 >= 0) {
+				emit(ARM_CMP_I(r_A, imm12), ctx);
+			} else {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_CMP_R(r_A, r_scratch), ctx);
+			}
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_K:
+			cond_t = ARM_COND_NE;
+			cond_f = ARM_COND_EQ;
+			if (inst->jt == inst->jf)
+				goto jmp_always;
+			imm12 = imm8m(k);
+			if (imm12 >= 0) {
+				emit(ARM_TST_I(r_A, imm12), ctx);
+			} else {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_TST_R(r_A, r_scratch), ctx);
+			}
+			goto cond_jump;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			cond_t = ARM_COND_HI;
+			cond_f = ARM_COND_LS;
+			goto cmp_x;
+		case BPF_JMP|BPF_JGE|BPF_X:
+			cond_t = ARM_COND_HS;
+			cond_f = ARM_COND_LO;
+			goto cmp_x;
+		case BPF_JMP|BPF_JEQ|BPF_X:
+			cond_t = ARM_COND_EQ;
+			cond_f = ARM_COND_NE;
+cmp_x:
+			if (inst->jt == inst->jf)
+				goto jmp_always;
+			emit(ARM_CMP_R(r_A, r_X), ctx);
+			goto cond_jump;
+		case BPF_JMP|BPF_JSET|BPF_X:
+			cond_t = ARM_COND_NE;
+			cond_f = ARM_COND_EQ;
+			if (inst->jt == inst->jf)
+				goto jmp_always;
+			emit(ARM_TST_R(r_A, r_X), ctx);
+cond_jump:
+			if (inst->jt)
+				_emit(cond_t, ARM_B(b_imm(i + inst->jt + 1,
+							  ctx)), ctx);
+			if (inst->jf)
+				_emit(cond_f, ARM_B(b_imm(i + inst->jf + 1,
+							  ctx)), ctx);
+			break;
+jmp_always:
+			if (inst->jt)
+				emit(ARM_B(b_imm(i + inst->jt + 1, ctx)), ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+			emit_load(4, false, false, k, ctx);
+			break;
+		case BPF_LD|BPF_H|BPF_ABS:
+			emit_load(2, false, false, k, ctx);
+			break;
+		case BPF_LD|BPF_B|BPF_ABS:
+			emit_load(1, false, false, k, ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_IND:
+			emit_load(4, true, false, k, ctx);
+			break;
+		case BPF_LD|BPF_H|BPF_IND:
+			emit_load(2, true, false, k, ctx);
+			break;
+		case BPF_LD|BPF_B|BPF_IND:
+			emit_load(1, true, false, k, ctx);
+			break;
+		case BPF_LDX|BPF_B|BPF_MSH:
+			emit_load(1, false, true, k, ctx);
+			break;
+		case BPF_LD|BPF_W|BPF_LEN:
+			emit(ARM_LDR_I(r_A, r_skb, offsetof(struct sk_buff, len)),
+			     ctx);
+			break;
+		case BPF_LDX|BPF_W|BPF_LEN:
+			emit(ARM_LDR_I(r_X, r_skb, offsetof(struct sk_buff, len)),
+			     ctx);
+			break;
+		case BPF_LD|BPF_IMM:
+			emit_mov_i(r_A, k, ctx);
+			break;
+		case BPF_LDX|BPF_IMM:
+			emit_mov_i(r_X, k, ctx);
+			break;
+		case BPF_LD|BPF_MEM:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_LDR_I(r_A, ARM_SP, k * 4), ctx);
+			break;
+		case BPF_LDX|BPF_MEM:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_LDR_I(r_X, ARM_SP, k * 4), ctx);
+			break;
+		case BPF_ST:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_STR_I(r_A, ARM_SP, k * 4), ctx);
+			break;
+		case BPF_STX:
+			ctx->seen |= SEEN_MEM;
+			emit(ARM_STR_I(r_X, ARM_SP, k * 4), ctx);
+			break;
+		case BPF_MISC|BPF_TAX:
+			emit(ARM_MOV_R(r_X, r_A), ctx);
+			break;
+		case BPF_MISC|BPF_TXA:
+			emit(ARM_MOV_R(r_A, r_X), ctx);
+			break;
+		case BPF_RET|BPF_K:
+			emit_mov_i(ARM_R0, k, ctx);
+			goto ret;
+		case BPF_RET|BPF_A:
+			emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+ret:
+			/* the last insn falls through into the epilogue */
+			if (i != prog->len - 1)
+				emit(ARM_B(b_imm(prog->len, ctx)), ctx);
+			break;
+		default:
+			/* let the interpreter deal with it */
+			return -1;
+		}
+	}
+
+	ctx->offsets[prog->len] = ctx->idx;
+
+	return 0;
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	struct jit_ctx ctx;
+	unsigned alloc_size;
+
+	BUILD_BUG_ON(offsetof(struct sk_buff, data) > 0xfff ||
+		     offsetof(struct sk_buff, len) > 0xfff ||
+		     offsetof(struct sk_buff, data_len) > 0xfff);
+
+	if (!bpf_jit_enable)
+		return;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.skf = fp;
+	ctx.offsets = kzalloc((fp->len + 1) * sizeof(*ctx.offsets),
+			      GFP_KERNEL);
+	if (ctx.offsets == NULL)
+		return;
+
+	/* first pass: find out what the prologue has to set up */
+	if (build_body(&ctx))
+		goto out;
+
+	/* second pass: size the code and record the branch targets */
+	ctx.idx = 0;
+	build_prologue(&ctx);
+	build_body(&ctx);
+	build_epilogue(&ctx);
+
+	alloc_size = 4 * ctx.idx;
+	ctx.target = module_alloc(max(sizeof(struct work_struct),
+				      (size_t)alloc_size));
+	if (ctx.target == NULL)
+		goto out;
+
+	/* last pass: emit the code */
+	ctx.idx = 0;
+	build_prologue(&ctx);
+	build_body(&ctx);
+	build_epilogue(&ctx);
+
+	flush_icache_range((u32)ctx.target, (u32)(ctx.target + ctx.idx));
+
+	if (bpf_jit_enable > 1) {
+		pr_info("flen=%d proglen=%u image=%p\n",
+			fp->len, alloc_size, ctx.target);
+		print_hex_dump(KERN_INFO, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 4, ctx.target, alloc_size, false);
+	}
+
+	fp->bpf_func = (void *)ctx.target;
+out:
+	kfree(ctx.offsets);
+}
+EXPORT_SYMBOL_GPL(bpf_jit_compile);
+
+static void bpf_jit_free_worker(struct work_struct *work)
+{
+	module_free(NULL, work);
+}
+
+/*
+ * Filters are released from RCU callbacks, and the image can not be
+ * vfree()d in that context.  Reuse its memory for a work item.
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	struct work_struct *work;
+
+	if (fp->bpf_func != NULL) {
+		work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, bpf_jit_free_worker);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL_GPL(bpf_jit_free);
@@ -182,4 +182,28 @@ static inline unsigned long __cmpxchg_local(volatile void *ptr,
 	cmpxchg_local((ptr), (o), (n));					\
 })
 
+/*
+ * Compare and exchange two adjacent, 16 byte aligned words at once.
+ * Atomic with respect to the current cpu only, there is no lock prefix.
+ * Returns 1 if both words matched and were replaced.
+ */
+#define cmpxchg_double_local(p1, p2, o1, o2, n1, n2)			\
+({									\
+	char __ret;							\
+	unsigned long __old1 = (unsigned long)(o1);			\
+	unsigned long __old2 = (unsigned long)(o2);			\
+	BUILD_BUG_ON(sizeof(*(p1)) != 8 || sizeof(*(p2)) != 8);		\
+	VM_BUG_ON((unsigned long)(p1) % 16);				\
+	VM_BUG_ON((unsigned long)((p1) + 1) != (unsigned long)(p2));	\
+	asm volatile("cmpxchg16b %1\n\tsetz %0"			\
+		     : "=q" (__ret), "+m" (*(p1)), "+m" (*(p2)),	\
+		       "+a" (__old1), "+d" (__old2)			\
+		     : "b" ((unsigned long)(n1)),			\
+		       "c" ((unsigned long)(n2))			\
+		     : "memory");					\
+	__ret;								\
+})
+
+#define system_has_cmpxchg_double() boot_cpu_has(X86_FEATURE_CX16)
+
 #endif /* _ASM_X86_CMPXCHG_64_H */
@@ -0,0 +1,558 @@
+/*
+ * Common Block IO controller cgroup interface
+ *
+ * Tasks are grouped through the "blkio" cgroup subsystem. Each cgroup has
+ * a weight which the IO controlling policy uses to share out disk time,
+ * and per device statistics that the policy updates as groups do IO.
+ * With CONFIG_BLK_DEV_THROTTLING each cgroup can also carry per device
+ * bandwidth and IOPS caps for the throttling policy.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/kdev_t.h>
+#include <linux/genhd.h>
+#include <linux/seq_file.h>
+#include <linux/iocontext.h>
+#include "blk-cgroup.h"
+
+static DEFINE_SPINLOCK(blkio_list_lock);
+static LIST_HEAD(blkio_list);
+
+struct blkio_cgroup blkio_root_cgroup = { .weight = 2*BLKIO_WEIGHT_DEFAULT };
+EXPORT_SYMBOL_GPL(blkio_root_cgroup);
+
+struct blkio_cgroup *cgroup_to_blkio_cgroup(struct cgroup *cgroup)
+{
+	return container_of(cgroup_subsys_state(cgroup, blkio_subsys_id),
+			    struct blkio_cgroup, css);
+}
+EXPORT_SYMBOL_GPL(cgroup_to_blkio_cgroup);
+
+void blkiocg_update_timeslice_used(struct blkio_group *blkg,
+				   unsigned long time)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkg->stats_lock, flags);
+	blkg->stats.time += jiffies_to_msecs(time);
+	spin_unlock_irqrestore(&blkg->stats_lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_timeslice_used);
+
+void blkiocg_update_dispatch_stats(struct blkio_group *blkg,
+				   unsigned int sectors)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkg->stats_lock, flags);
+	blkg->stats.sectors += sectors;
+	spin_unlock_irqrestore(&blkg->stats_lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_dispatch_stats);
+
+void blkiocg_update_completion_stats(struct blkio_group *blkg,
+				     unsigned long long start_time,
+				     unsigned long long io_start_time)
+{
+	unsigned long long now = sched_clock();
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkg->stats_lock, flags);
+	/* sched_clock() is not monotonic across cpus, ignore skewed stamps */
+	if (time_after64(now, io_start_time))
+		blkg->stats.io_service_time += now - io_start_time;
+	if (time_after64(io_start_time, start_time))
+		blkg->stats.io_wait_time += io_start_time - start_time;
+	spin_unlock_irqrestore(&blkg->stats_lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_update_completion_stats);
+
+/*
+ * Link @blkg to @blkcg. Called by the policy with its queue lock held the
+ * first time a task of the cgroup does IO to the device.
+ */
+void blkiocg_add_blkio_group(struct blkio_cgroup *blkcg,
+			     struct blkio_group *blkg, void *key, dev_t dev,
+			     enum blkio_policy_id plid)
+{
+	unsigned long flags;
+
+	spin_lock_init(&blkg->stats_lock);
+	spin_lock_irqsave(&blkcg->lock, flags);
+	blkg->key = key;
+	blkg->blkcg = blkcg;
+	blkg->dev = dev;
+	blkg->plid = plid;
+	hlist_add_head(&blkg->blkcg_node, &blkcg->blkg_list);
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+}
+EXPORT_SYMBOL_GPL(blkiocg_add_blkio_group);
+
+/*
+ * Unlink @blkg from its cgroup. Returns 0 on success, or 1 if the cgroup
+ * is being removed and has already unlinked the group, in which case the
+ * policy's unlink callback will run for it once the caller drops its
+ * queue lock.
+ *
+ * The caller must hold the policy's queue lock: the cgroup cannot finish
+ * going away while one of its groups waits for that lock in the unlink
+ * callback, which keeps blkg->blkcg valid here.
+ */
+int blkiocg_del_blkio_group(struct blkio_group *blkg)
+{
+	struct blkio_cgroup *blkcg = blkg->blkcg;
+	unsigned long flags;
+	int ret = 1;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	if (!hlist_unhashed(&blkg->blkcg_node)) {
+		hlist_del_init(&blkg->blkcg_node);
+		blkg->key = NULL;
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(blkiocg_del_blkio_group);
+
+/* called under rcu_read_lock(), which keeps @blkcg around */
+struct blkio_group *blkiocg_lookup_group(struct blkio_cgroup *blkcg, void *key)
+{
+	struct blkio_group *blkg, *found = NULL;
+	struct hlist_node *n;
+	unsigned long flags;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (blkg->key == key) {
+			found = blkg;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+	return found;
+}
+EXPORT_SYMBOL_GPL(blkiocg_lookup_group);
+
+static struct blkio_policy_node *
+blkio_policy_find(struct blkio_cgroup *blkcg, dev_t dev,
+		  enum blkio_throtl_fileid fileid)
+{
+	struct blkio_policy_node *pn;
+
+	list_for_each_entry(pn, &blkcg->policy_list, node) {
+		if (pn->dev == dev && pn->fileid == fileid)
+			return pn;
+	}
+	return NULL;
+}
+
+/*
+ * Return the throttling rule of @blkcg for the whole disk @dev, or 0 if
+ * the cgroup has no limit there.
+ */
+u64 blkiocg_get_rule(struct blkio_cgroup *blkcg, dev_t dev,
+		     enum blkio_throtl_fileid fileid)
+{
+	struct blkio_policy_node *pn;
+	unsigned long flags;
+	u64 val = 0;
+
+	if (!dev)
+		return 0;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	pn = blkio_policy_find(blkcg, dev, fileid);
+	if (pn)
+		val = pn->val;
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+	return val;
+}
+EXPORT_SYMBOL_GPL(blkiocg_get_rule);
+
+static u64 blkiocg_weight_read(struct cgroup *cgroup, struct cftype *cftype)
+{
+	return cgroup_to_blkio_cgroup(cgroup)->weight;
+}
+
+static int
+blkiocg_weight_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
+{
+	struct blkio_cgroup *blkcg;
+	struct blkio_group *blkg;
+	struct blkio_policy_type *blkiop;
+	struct hlist_node *n;
+
+	if (val < BLKIO_WEIGHT_MIN || val > BLKIO_WEIGHT_MAX)
+		return -EINVAL;
+
+	blkcg = cgroup_to_blkio_cgroup(cgroup);
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+	blkcg->weight = (unsigned int)val;
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid == blkg->plid &&
+			    blkiop->ops.blkio_update_group_weight_fn)
+				blkiop->ops.blkio_update_group_weight_fn(blkg,
+								blkcg->weight);
+		}
+	}
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+	return 0;
+}
+
+/*
+ * Print one "major:minor value" line per device the cgroup has done IO
+ * to. Groups of devices not yet registered with a dev_t are skipped.
+ */
+#define SHOW_FUNCTION_PER_GROUP(__VAR)					\
+static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
+			struct cftype *cftype, struct cgroup_map_cb *cb)\
+{									\
+	struct blkio_cgroup *blkcg;					\
+	struct blkio_group *blkg;					\
+	struct hlist_node *n;						\
+	char str[16];							\
+	u64 val;							\
+									\
+	if (!cgroup_lock_live_group(cgroup))				\
+		return -ENODEV;						\
+									\
+	blkcg = cgroup_to_blkio_cgroup(cgroup);				\
+	spin_lock_irq(&blkcg->lock);					\
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {	\
+		if (!blkg->dev || blkg->plid != BLKIO_POLICY_PROP)	\
+			continue;					\
+		spin_lock(&blkg->stats_lock);				\
+		val = blkg->stats.__VAR;				\
+		spin_unlock(&blkg->stats_lock);				\
+		snprintf(str, sizeof(str), "%u:%u",			\
+			 MAJOR(blkg->dev), MINOR(blkg->dev));		\
+		cb->fill(cb, str, val);					\
+	}								\
+	spin_unlock_irq(&blkcg->lock);					\
+	cgroup_unlock();						\
+	return 0;							\
+}
+
+SHOW_FUNCTION_PER_GROUP(time);
+SHOW_FUNCTION_PER_GROUP(sectors);
+SHOW_FUNCTION_PER_GROUP(io_service_time);
+SHOW_FUNCTION_PER_GROUP(io_wait_time);
+#undef SHOW_FUNCTION_PER_GROUP
+
+#ifdef CONFIG_BLK_DEV_THROTTLING
+/* Rules can only be set on whole disks, that is what gets throttled */
+static int blkio_check_dev(dev_t dev)
+{
+	struct gendisk *disk;
+	int part;
+
+	disk = get_gendisk(dev, &part);
+	if (!disk)
+		return -ENODEV;
+	put_disk(disk);
+
+	if (part)
+		return -ENODEV;
+	return 0;
+}
+
+/* Tell the throttling policy about a rule change on @dev */
+static void blkio_update_limits(struct blkio_cgroup *blkcg, dev_t dev)
+{
+	struct blkio_policy_type *blkiop;
+	struct blkio_group *blkg;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (blkg->plid != BLKIO_POLICY_THROTL || blkg->dev != dev)
+			continue;
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid == blkg->plid &&
+			    blkiop->ops.blkio_update_group_limits_fn)
+				blkiop->ops.blkio_update_group_limits_fn(
+							blkg->key, blkg);
+		}
+	}
+}
+
+static int blkiocg_rule_read(struct cgroup *cgroup, struct cftype *cftype,
+			     struct seq_file *m)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct blkio_policy_node *pn;
+
+	spin_lock_irq(&blkcg->lock);
+	list_for_each_entry(pn, &blkcg->policy_list, node) {
+		if (pn->fileid != cftype->private)
+			continue;
+		seq_printf(m, "%u:%u %llu\n", MAJOR(pn->dev), MINOR(pn->dev),
+			   (unsigned long long)pn->val);
+	}
+	spin_unlock_irq(&blkcg->lock);
+	return 0;
+}
+
+/*
+ * Rules are written as "major:minor value". A value of 0 removes the
+ * rule for that device.
+ */
+static int blkiocg_rule_write(struct cgroup *cgroup, struct cftype *cftype,
+			      const char *buf)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	enum blkio_throtl_fileid fileid = cftype->private;
+	struct blkio_policy_node *pn, *newpn;
+	unsigned int major, minor;
+	unsigned long long val;
+	dev_t dev;
+	int ret;
+
+	if (sscanf(buf, "%u:%u %llu", &major, &minor, &val) != 3)
+		return -EINVAL;
+
+	if ((fileid == BLKIO_THROTL_READ_IOPS ||
+	     fileid == BLKIO_THROTL_WRITE_IOPS) && val > UINT_MAX)
+		return -EINVAL;
+
+	dev = MKDEV(major, minor);
+	ret = blkio_check_dev(dev);
+	if (ret)
+		return ret;
+
+	newpn = kzalloc(sizeof(*newpn), GFP_KERNEL);
+	if (!newpn)
+		return -ENOMEM;
+	newpn->dev = dev;
+	newpn->fileid = fileid;
+	newpn->val = val;
+
+	if (!cgroup_lock_live_group(cgroup)) {
+		kfree(newpn);
+		return -ENODEV;
+	}
+
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+	pn = blkio_policy_find(blkcg, dev, fileid);
+	if (pn) {
+		if (val) {
+			pn->val = val;
+			pn = NULL;
+		} else
+			list_del(&pn->node);
+	} else if (val) {
+		list_add_tail(&newpn->node, &blkcg->policy_list);
+		newpn = NULL;
+	}
+	blkio_update_limits(blkcg, dev);
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+	cgroup_unlock();
+
+	/* the old rule if it was removed, and the new one if it was unused */
+	kfree(pn);
+	kfree(newpn);
+	return 0;
+}
+#endif /* CONFIG_BLK_DEV_THROTTLING */
+
+static struct cftype blkio_files[] = {
+	{
+		.name = "weight",
+		.read_u64 = blkiocg_weight_read,
+		.write_u64 = blkiocg_weight_write,
+	},
+	{
+		.name = "time",
+		.read_map = blkiocg_time_read,
+	},
+	{
+		.name = "sectors",
+		.read_map = blkiocg_sectors_read,
+	},
+	{
+		.name = "io_service_time",
+		.read_map = blkiocg_io_service_time_read,
+	},
+	{
+		.name = "io_wait_time",
+		.read_map = blkiocg_io_wait_time_read,
+	},
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	{
+		.name = "throttle.read_bps_device",
+		.private = BLKIO_THROTL_READ_BPS,
+		.read_seq_string = blkiocg_rule_read,
+		.write_string = blkiocg_rule_write,
+	},
+	{
+		.name = "throttle.write_bps_device",
+		.private = BLKIO_THROTL_WRITE_BPS,
+		.read_seq_string = blkiocg_rule_read,
+		.write_string = blkiocg_rule_write,
+	},
+	{
+		.name = "throttle.read_iops_device",
+		.private = BLKIO_THROTL_READ_IOPS,
+		.read_seq_string = blkiocg_rule_read,
+		.write_string = blkiocg_rule_write,
+	},
+	{
+		.name = "throttle.write_iops_device",
+		.private = BLKIO_THROTL_WRITE_IOPS,
+		.read_seq_string = blkiocg_rule_read,
+		.write_string = blkiocg_rule_write,
+	},
+#endif
+};
+
+static int blkiocg_populate(struct cgroup_subsys *subsys, struct cgroup *cgroup)
+{
+	return cgroup_add_files(cgroup, subsys, blkio_files,
+				ARRAY_SIZE(blkio_files));
+}
+
+static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct blkio_policy_node *pn, *pntmp;
+	struct blkio_policy_type *blkiop;
+	struct blkio_group *blkg;
+	enum blkio_policy_id plid;
+	unsigned long flags;
+	void *key;
+
+	/*
+	 * The policies' queue locks nest inside blkio_list_lock but outside
+	 * blkcg->lock, so unlink one group at a time and drop blkcg->lock
+	 * before calling back into the policies. rcu_read_lock() keeps the
+	 * policy data behind blkg->key alive; policies synchronize_rcu()
+	 * before freeing it.
+	 */
+	rcu_read_lock();
+	do {
+		spin_lock_irqsave(&blkcg->lock, flags);
+		if (hlist_empty(&blkcg->blkg_list)) {
+			spin_unlock_irqrestore(&blkcg->lock, flags);
+			break;
+		}
+		blkg = hlist_entry(blkcg->blkg_list.first, struct blkio_group,
+				   blkcg_node);
+		key = blkg->key;
+		plid = blkg->plid;
+		hlist_del_init(&blkg->blkcg_node);
+		blkg->key = NULL;
+		spin_unlock_irqrestore(&blkcg->lock, flags);
+
+		spin_lock(&blkio_list_lock);
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid == plid)
+				blkiop->ops.blkio_unlink_group_fn(key, blkg);
+		}
+		spin_unlock(&blkio_list_lock);
+	} while (1);
+	rcu_read_unlock();
+
+	list_for_each_entry_safe(pn, pntmp, &blkcg->policy_list, node) {
+		list_del(&pn->node);
+		kfree(pn);
+	}
+
+	if (blkcg != &blkio_root_cgroup)
+		kfree(blkcg);
+}
+
+static struct cgroup_subsys_state *
+blkiocg_create(struct cgroup_subsys *subsys, struct cgroup *cgroup)
+{
+	struct blkio_cgroup *blkcg;
+
+	if (!cgroup->parent) {
+		blkcg = &blkio_root_cgroup;
+		goto done;
+	}
+
+	/* Currently we do not support hierarchy deeper than two level (0,1) */
+	if (cgroup->parent->parent)
+		return ERR_PTR(-EINVAL);
+
+	blkcg = kzalloc(sizeof(*blkcg), GFP_KERNEL);
+	if (!blkcg)
+		return ERR_PTR(-ENOMEM);
+
+	blkcg->weight = BLKIO_WEIGHT_DEFAULT;
+done:
+	spin_lock_init(&blkcg->lock);
+	INIT_HLIST_HEAD(&blkcg->blkg_list);
+	INIT_LIST_HEAD(&blkcg->policy_list);
+
+	return &blkcg->css;
+}
+
+/*
+ * Moving a task only takes effect for its future IO: flag its io_context
+ * so the policy drops the task's queue and sets up a new one in the new
+ * group on the next request. Tasks sharing an io_context can only be moved
+ * together, which we cannot guarantee, so refuse to move them.
+ */
+static int blkiocg_can_attach(struct cgroup_subsys *subsys,
+			      struct cgroup *cgroup, struct task_struct *tsk,
+			      bool threadgroup)
+{
+	struct io_context *ioc;
+	int ret = 0;
+
+	task_lock(tsk);
+	ioc = tsk->io_context;
+	if (ioc && atomic_read(&ioc->nr_tasks) > 1)
+		ret = -EINVAL;
+	task_unlock(tsk);
+
+	return ret;
+}
+
+static void blkiocg_attach(struct cgroup_subsys *subsys, struct cgroup *cgroup,
+			   struct cgroup *prev, struct task_struct *tsk,
+			   bool threadgroup)
+{
+	struct io_context *ioc;
+
+	task_lock(tsk);
+	ioc = tsk->io_context;
+	if (ioc)
+		ioc->cgroup_changed = 1;
+	task_unlock(tsk);
+}
+
+struct cgroup_subsys blkio_subsys = {
+	.name = "blkio",
+	.create = blkiocg_create,
+	.can_attach = blkiocg_can_attach,
+	.attach = blkiocg_attach,
+	.destroy = blkiocg_destroy,
+	.populate = blkiocg_populate,
+	.subsys_id = blkio_subsys_id,
+};
+
+void blkio_policy_register(struct blkio_policy_type *blkiop)
+{
+	spin_lock(&blkio_list_lock);
+	list_add_tail(&blkiop->list, &blkio_list);
+	spin_unlock(&blkio_list_lock);
+}
+EXPORT_SYMBOL_GPL(blkio_policy_register);
+
+void blkio_policy_unregister(struct blkio_policy_type *blkiop)
+{
+	spin_lock(&blkio_list_lock);
+	list_del_init(&blkiop->list);
+	spin_unlock(&blkio_list_lock);
+}
+EXPORT_SYMBOL_GPL(blkio_policy_unregister);
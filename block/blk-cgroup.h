@@ -0,0 +1,149 @@
+#ifndef _BLK_CGROUP_H
+#define _BLK_CGROUP_H
+/*
+ * Common Block IO controller cgroup interface
+ *
+ * A blkio cgroup carries a weight and one blkio_group per device and
+ * policy its tasks have done IO to. The IO controlling policy (eg. CFQ)
+ * embeds the blkio_group in its own per group state and registers a
+ * blkio_policy_type to hear about weight changes and cgroup removal.
+ *
+ * The throttling policy additionally uses the per device rules set through
+ * the blkio.throttle.* files.
+ */
+
+#include <linux/cgroup.h>
+
+#define BLKIO_WEIGHT_MIN	100
+#define BLKIO_WEIGHT_MAX	1000
+#define BLKIO_WEIGHT_DEFAULT	500
+
+enum blkio_policy_id {
+	BLKIO_POLICY_PROP = 0,		/* Proportional Bandwidth division */
+	BLKIO_POLICY_THROTL,		/* Throttling */
+};
+
+/* blkio.throttle.* rule files, READ and WRITE variants next to each other */
+enum blkio_throtl_fileid {
+	BLKIO_THROTL_READ_BPS = 0,
+	BLKIO_THROTL_WRITE_BPS,
+	BLKIO_THROTL_READ_IOPS,
+	BLKIO_THROTL_WRITE_IOPS,
+};
+
+#ifdef CONFIG_BLK_CGROUP
+
+struct blkio_cgroup {
+	struct cgroup_subsys_state css;
+	unsigned int weight;
+	spinlock_t lock;
+	struct hlist_head blkg_list;
+	/* per device throttling rules, protected by lock */
+	struct list_head policy_list;
+};
+
+struct blkio_policy_node {
+	struct list_head node;
+	dev_t dev;
+	enum blkio_throtl_fileid fileid;
+	u64 val;
+};
+
+struct blkio_group_stats {
+	/* disk time used by the group, in msecs */
+	u64 time;
+	/* number of sectors dispatched to the device */
+	u64 sectors;
+	/* time between dispatch and completion of requests, in nsecs */
+	u64 io_service_time;
+	/* time requests spent queued in the scheduler, in nsecs */
+	u64 io_wait_time;
+};
+
+/*
+ * Per device state of a cgroup, embedded in the group structure of the
+ * policy that controls the device. All fields except the stats are
+ * protected by blkcg->lock.
+ */
+struct blkio_group {
+	/* policy private data this group belongs to, eg. cfq_data */
+	void *key;
+	struct blkio_cgroup *blkcg;
+	struct hlist_node blkcg_node;
+	/* device the group does IO on, 0 until the disk is registered */
+	dev_t dev;
+	/* policy which owns this group */
+	enum blkio_policy_id plid;
+
+	spinlock_t stats_lock;
+	struct blkio_group_stats stats;
+};
+
+typedef void (blkio_unlink_group_fn) (void *key, struct blkio_group *blkg);
+typedef void (blkio_update_group_weight_fn) (struct blkio_group *blkg,
+						unsigned int weight);
+typedef void (blkio_update_group_limits_fn) (void *key,
+						struct blkio_group *blkg);
+
+struct blkio_policy_ops {
+	/*
+	 * Called with the cgroup going away, after @blkg has been taken off
+	 * the cgroup's list. The policy must drop its reference on @blkg.
+	 */
+	blkio_unlink_group_fn *blkio_unlink_group_fn;
+	blkio_update_group_weight_fn *blkio_update_group_weight_fn;
+	/*
+	 * Called with blkcg->lock held when a throttling rule of the group's
+	 * device changes. Must not take the queue lock.
+	 */
+	blkio_update_group_limits_fn *blkio_update_group_limits_fn;
+};
+
+struct blkio_policy_type {
+	struct list_head list;
+	struct blkio_policy_ops ops;
+	enum blkio_policy_id plid;
+};
+
+extern struct blkio_cgroup blkio_root_cgroup;
+
+extern void blkio_policy_register(struct blkio_policy_type *);
+extern void blkio_policy_unregister(struct blkio_policy_type *);
+
+extern struct blkio_cgroup *cgroup_to_blkio_cgroup(struct cgroup *cgroup);
+extern void blkiocg_add_blkio_group(struct blkio_cgroup *blkcg,
+			struct blkio_group *blkg, void *key, dev_t dev,
+			enum blkio_policy_id plid);
+extern int blkiocg_del_blkio_group(struct blkio_group *blkg);
+extern struct blkio_group *blkiocg_lookup_group(struct blkio_cgroup *blkcg,
+						void *key);
+extern u64 blkiocg_get_rule(struct blkio_cgroup *blkcg, dev_t dev,
+			    enum blkio_throtl_fileid fileid);
+
+extern void blkiocg_update_timeslice_used(struct blkio_group *blkg,
+					unsigned long time);
+extern void blkiocg_update_dispatch_stats(struct blkio_group *blkg,
+					unsigned int sectors);
+extern void blkiocg_update_completion_stats(struct blkio_group *blkg,
+			unsigned long long start_time,
+			unsigned long long io_start_time);
+
+#else
+
+struct blkio_cgroup {
+};
+
+struct blkio_group {
+};
+
+static inline void blkiocg_update_timeslice_used(struct blkio_group *blkg,
+						unsigned long time) { }
+static inline void blkiocg_update_dispatch_stats(struct blkio_group *blkg,
+						unsigned int sectors) { }
+static inline void blkiocg_update_completion_stats(struct blkio_group *blkg,
+			unsigned long long start_time,
+			unsigned long long io_start_time) { }
+
+#endif /* CONFIG_BLK_CGROUP */
+
+#endif /* _BLK_CGROUP_H */
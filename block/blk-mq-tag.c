@@ -0,0 +1,122 @@
+/*
+ * Tag allocation for blk-mq hardware queues
+ *
+ * A tag is a bit in a per hardware queue bitmap. Each cpu starts its
+ * search where it last found a free tag, so cpus sharing a hardware
+ * queue mostly touch different words of the bitmap.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/blkdev.h>
+
+#include "blk-mq-tag.h"
+
+static int __blk_mq_get_tag(struct blk_mq_tags *tags)
+{
+	unsigned int *hint, start, tag;
+
+	hint = per_cpu_ptr(tags->alloc_hint, get_cpu());
+	start = *hint;
+	if (start >= tags->nr_tags)
+		start = 0;
+
+	tag = start;
+	do {
+		tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			if (!start)
+				break;
+			/* wrap around once */
+			start = tag = 0;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, tags->bitmap)) {
+			*hint = tag + 1;
+			put_cpu();
+			return tag;
+		}
+	} while (1);
+
+	put_cpu();
+	return -1;
+}
+
+/**
+ * blk_mq_get_tag - allocate a tag
+ * @tags:	tag space of the hardware queue
+ * @gfp:	waits for a tag to be freed if __GFP_WAIT is set
+ *
+ * Returns the tag, or -1 if none was free and @gfp does not allow waiting.
+ */
+int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp)
+{
+	DEFINE_WAIT(wait);
+	int tag;
+
+	tag = __blk_mq_get_tag(tags);
+	if (tag >= 0 || !(gfp & __GFP_WAIT))
+		return tag;
+
+	do {
+		prepare_to_wait(&tags->wait, &wait, TASK_UNINTERRUPTIBLE);
+		tag = __blk_mq_get_tag(tags);
+		if (tag >= 0)
+			break;
+		io_schedule();
+	} while (1);
+	finish_wait(&tags->wait, &wait);
+
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit_unlock(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return bitmap_weight(tags->bitmap, tags->nr_tags);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+
+	tags->bitmap = kzalloc_node(BITS_TO_LONGS(nr_tags) * sizeof(long),
+				    GFP_KERNEL, node);
+	tags->alloc_hint = alloc_percpu(unsigned int);
+	tags->rqs = kzalloc_node(nr_tags * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!tags->bitmap || !tags->alloc_hint || !tags->rqs) {
+		blk_mq_free_tags(tags);
+		return NULL;
+	}
+
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	kfree(tags->rqs);
+	if (tags->alloc_hint)
+		free_percpu(tags->alloc_hint);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
@@ -0,0 +1,24 @@
+#ifndef INT_BLK_MQ_TAG_H
+#define INT_BLK_MQ_TAG_H
+
+/*
+ * Tag space of one hardware queue. Tags index the preallocated requests
+ * in ->rqs.
+ */
+struct blk_mq_tags {
+	unsigned int nr_tags;
+	unsigned long *bitmap;
+	unsigned int *alloc_hint;	/* per-cpu search start */
+	wait_queue_head_t wait;
+
+	struct request **rqs;
+};
+
+extern struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+extern void blk_mq_free_tags(struct blk_mq_tags *tags);
+
+extern int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp);
+extern void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+extern unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags);
+
+#endif
@@ -0,0 +1,878 @@
+/*
+ * Multiqueue block layer
+ *
+ * Bios are turned into requests on per-cpu software queues and handed to
+ * the driver through one or more hardware queues. Requests and their tags
+ * are preallocated per hardware queue, and nothing on the submission or
+ * completion path takes q->queue_lock.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+/* Software queues searched for a merge candidate, newest first */
+#define BLK_MQ_MERGE_LOOKUP	8
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Disables preemption until the matching blk_mq_put_ctx().
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware queue mapping
+ * @q:		the queue
+ * @cpu:	the submitting cpu
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static int blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx ||
+		!list_empty_careful(&hctx->dispatch);
+}
+
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+/*
+ * Every allocated request holds a reference on q->mq_usage_counter, so
+ * a frozen queue can wait for everything in flight to finish.
+ */
+static int blk_mq_queue_enter(struct request_queue *q, gfp_t gfp)
+{
+	while (1) {
+		percpu_counter_inc(&q->mq_usage_counter);
+		smp_mb();
+		if (likely(!q->mq_freeze_depth))
+			return 0;
+
+		percpu_counter_dec(&q->mq_usage_counter);
+		wake_up_all(&q->mq_freeze_wq);
+		if (!(gfp & __GFP_WAIT))
+			return -EBUSY;
+
+		wait_event(q->mq_freeze_wq, !q->mq_freeze_depth);
+	}
+}
+
+static void blk_mq_queue_exit(struct request_queue *q)
+{
+	percpu_counter_dec(&q->mq_usage_counter);
+	smp_mb();
+	if (unlikely(q->mq_freeze_depth))
+		wake_up_all(&q->mq_freeze_wq);
+}
+
+/*
+ * Hold off new requests and wait for all allocated ones to be freed.
+ */
+static void blk_mq_freeze_queue(struct request_queue *q)
+{
+	spin_lock_irq(q->queue_lock);
+	q->mq_freeze_depth++;
+	spin_unlock_irq(q->queue_lock);
+	smp_mb();
+
+	blk_mq_run_queues(q, false);
+	wait_event(q->mq_freeze_wq,
+		   percpu_counter_sum(&q->mq_usage_counter) == 0);
+}
+
+static void blk_mq_unfreeze_queue(struct request_queue *q)
+{
+	int wake;
+
+	spin_lock_irq(q->queue_lock);
+	wake = !--q->mq_freeze_depth;
+	spin_unlock_irq(q->queue_lock);
+	if (wake)
+		wake_up_all(&q->mq_freeze_wq);
+}
+
+static struct request *__blk_mq_alloc_request(struct request_queue *q,
+					      int rw, gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int tag;
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	blk_mq_put_ctx(ctx);
+
+	/*
+	 * The request stays tied to this software queue even if we sleep
+	 * for a tag and wake up on another cpu.
+	 */
+	tag = blk_mq_get_tag(hctx->tags, gfp);
+	if (tag < 0)
+		return NULL;
+
+	rq = hctx->tags->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request on a blk-mq queue
+ * @q:		the queue
+ * @rw:		READ, WRITE or request flags
+ * @gfp:	if __GFP_WAIT is set, wait for a free tag
+ *
+ * Description:
+ *    blk_get_request() ends up here for blk-mq queues.  The request is
+ *    returned with blk_mq_free_request() or blk_put_request().
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct request *rq;
+
+	if (blk_mq_queue_enter(q, gfp))
+		return NULL;
+
+	rq = __blk_mq_alloc_request(q, rw, gfp);
+	if (!rq)
+		blk_mq_queue_exit(q);
+
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/*
+ * Allocation for the barrier sequence, which runs with the queue frozen.
+ */
+static struct request *blk_mq_alloc_frozen_request(struct request_queue *q,
+						   int rw)
+{
+	percpu_counter_inc(&q->mq_usage_counter);
+	return __blk_mq_alloc_request(q, rw, GFP_NOIO);
+}
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	rq->cmd_flags = 0;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+	blk_mq_queue_exit(q);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/**
+ * blk_mq_end_io - complete a whole request
+ * @rq:		the request being completed
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *    Ends all bios of @rq, then calls its ->end_io or frees it.  May be
+ *    called from interrupt context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		__blk_put_request(rq->q, rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_start_request(struct request *rq)
+{
+	trace_block_rq_issue(rq->q, rq);
+	rq->cmd_flags |= REQ_STARTED;
+}
+
+/*
+ * Pull everything off the software queues mapped to @hctx and feed it to
+ * the driver, oldest first. Whatever the driver is too busy for is kept
+ * on hctx->dispatch and goes out first on the next run.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(blk_mq_hctx_stopped(hctx)))
+		return;
+
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for_each_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		if (!test_and_clear_bit(bit, hctx->ctx_map))
+			continue;
+		ctx = hctx->ctxs[bit];
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_mq_start_request(rq);
+		ret = q->mq_ops->queue_rq(hctx, rq, list_empty(&rq_list));
+		if (likely(ret == BLK_MQ_RQ_QUEUE_OK))
+			continue;
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			rq->cmd_flags &= ~REQ_STARTED;
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON_ONCE(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+
+		/*
+		 * A completion may have restarted the queue before the
+		 * requests were back on ->dispatch.
+		 */
+		smp_mb();
+		if (!blk_mq_hctx_stopped(hctx))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	run from kblockd instead of the calling context
+ *
+ * Description:
+ *    A synchronous run calls ->queue_rq() directly and must be done from
+ *    process context.  Use @async from interrupt context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(blk_mq_hctx_stopped(hctx)))
+		return;
+
+	if (!async)
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx))
+			continue;
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *    Used by a driver that is out of resources, typically right before
+ *    returning BLK_MQ_RQ_QUEUE_BUSY.  Restart with
+ *    blk_mq_start_stopped_hw_queues().
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		smp_mb__after_clear_bit();
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_poll_account(struct blk_mq_hw_ctx *hctx,
+				unsigned long long start)
+{
+	unsigned long long now = sched_clock();
+	unsigned long usecs = 0;
+	int bkt = 0;
+
+	/* sched_clock() is not monotonic across cpus */
+	if (time_after64(now, start))
+		usecs = div_u64(now - start, NSEC_PER_USEC);
+	if (usecs)
+		bkt = min_t(int, ilog2(usecs) + 1, BLK_MQ_POLL_LAT_BKTS - 1);
+	hctx->poll_lat[bkt]++;
+}
+
+/**
+ * blk_poll - busy-poll a queue for the calling task's IO
+ * @q:		the queue the task has IO outstanding on
+ *
+ * Description:
+ *    Called in place of io_schedule() by a task that has set itself to
+ *    sleep until its IO completes.  If polling is enabled on @q, spin on
+ *    the hardware queue of the current cpu through ->poll() until the
+ *    completion has woken the task, saving the interrupt and wakeup
+ *    latency.  Returns false if the task did not get woken this way and
+ *    has to sleep as usual, eg. because something else wants the cpu.
+ */
+bool blk_poll(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long long start;
+	long state;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_queue_poll(q))
+		return false;
+
+	hctx = q->mq_ops->map_queue(q, raw_smp_processor_id());
+	hctx->poll_invoked++;
+
+	start = sched_clock();
+	state = current->state;
+	while (!need_resched()) {
+		q->mq_ops->poll(hctx);
+
+		/* the completion sets us TASK_RUNNING */
+		if (current->state == TASK_RUNNING) {
+			hctx->poll_success++;
+			blk_mq_poll_account(hctx, start);
+			return true;
+		}
+		if (signal_pending_state(state, current)) {
+			__set_current_state(TASK_RUNNING);
+			return true;
+		}
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	spin_lock(&ctx->lock);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+	spin_unlock(&ctx->lock);
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request
+ * @rq:		request allocated with blk_mq_alloc_request()
+ * @at_head:	insert at the head of the software queue
+ * @run_queue:	run the hardware queue afterwards
+ * @async:	run it from kblockd
+ *
+ * Description:
+ *    Must be called from process context.
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	__blk_mq_insert_request(hctx, rq, at_head);
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+static void blk_mq_bio_merged(struct request *rq, struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) != ff)
+		blk_rq_set_mixed_merge(rq);
+
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+	drive_stat_acct(rq, 0);
+}
+
+/*
+ * Try to merge @bio into a request still sitting on the software queue.
+ * Requests there have not been seen by the driver yet, and ctx->lock
+ * keeps them from being dispatched under us.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = BLK_MQ_MERGE_LOOKUP;
+	bool merged = false;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+
+		switch (elv_try_merge(rq, bio)) {
+		case ELEVATOR_BACK_MERGE:
+			if (!ll_back_merge_fn(q, rq, bio))
+				break;
+			trace_block_bio_backmerge(q, bio);
+			rq->biotail->bi_next = bio;
+			rq->biotail = bio;
+			blk_mq_bio_merged(rq, bio);
+			merged = true;
+			break;
+		case ELEVATOR_FRONT_MERGE:
+			if (!ll_front_merge_fn(q, rq, bio))
+				break;
+			trace_block_bio_frontmerge(q, bio);
+			bio->bi_next = rq->bio;
+			rq->bio = bio;
+			rq->buffer = bio_data(bio);
+			rq->__sector = bio->bi_sector;
+			blk_mq_bio_merged(rq, bio);
+			merged = true;
+			break;
+		default:
+			continue;
+		}
+		break;
+	}
+	spin_unlock(&ctx->lock);
+
+	return merged;
+}
+
+static void blk_mq_end_sync_rq(struct request *rq, int error)
+{
+	struct completion *waiting = rq->end_io_data;
+
+	rq->errors = error;
+	complete(waiting);
+}
+
+/*
+ * Issue a request of the barrier sequence and wait for it.
+ */
+static int blk_mq_execute_frozen(struct request *rq, struct gendisk *disk)
+{
+	DECLARE_COMPLETION_ONSTACK(wait);
+	int err;
+
+	rq->rq_disk = disk;
+	rq->end_io = blk_mq_end_sync_rq;
+	rq->end_io_data = &wait;
+	blk_mq_insert_request(rq, true, true, false);
+	wait_for_completion(&wait);
+
+	err = rq->errors;
+	blk_mq_free_request(rq);
+	return err ? -EIO : 0;
+}
+
+static int blk_mq_flush(struct request_queue *q, struct gendisk *disk)
+{
+	struct request *rq;
+
+	rq = blk_mq_alloc_frozen_request(q, WRITE);
+	rq->cmd_flags |= REQ_HARDBARRIER;
+	q->prepare_flush_fn(q, rq);
+
+	return blk_mq_execute_frozen(rq, disk);
+}
+
+static int blk_mq_barrier_data(struct request_queue *q, struct bio *bio,
+			       unsigned ordered)
+{
+	struct request *rq;
+	struct bio *clone;
+	int err;
+
+	/*
+	 * The clone is what the driver completes; @bio is only ended once
+	 * the whole sequence, including the post-flush, is done.
+	 */
+	clone = bio_clone(bio, GFP_NOIO);
+	if (!clone)
+		return -ENOMEM;
+
+	rq = blk_mq_alloc_frozen_request(q, bio_data_dir(bio));
+	if (ordered & QUEUE_ORDERED_DO_FUA)
+		rq->cmd_flags |= REQ_FUA;
+	init_request_from_bio(rq, clone);
+	drive_stat_acct(rq, 1);
+
+	err = blk_mq_execute_frozen(rq, bio->bi_bdev->bd_disk);
+	if (!err && !test_bit(BIO_UPTODATE, &clone->bi_flags))
+		err = -EIO;
+
+	bio_put(clone);
+	return err;
+}
+
+/*
+ * There is no dispatch queue to reorder around a barrier, so drain the
+ * whole queue, then issue the pre-flush, the barrier write and the
+ * post-flush one after the other.  Runs in the submitter's context.
+ */
+static void blk_mq_bio_barrier(struct request_queue *q, struct bio *bio)
+{
+	unsigned ordered = q->next_ordered;
+	struct gendisk *disk = bio->bi_bdev->bd_disk;
+	int err = 0;
+
+	if (ordered == QUEUE_ORDERED_NONE) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return;
+	}
+
+	/* An empty barrier has no write and so needs no post-flush */
+	if (!bio_has_data(bio))
+		ordered &= ~(QUEUE_ORDERED_DO_BAR | QUEUE_ORDERED_DO_POSTFLUSH);
+
+	blk_mq_freeze_queue(q);
+
+	if (ordered & QUEUE_ORDERED_DO_PREFLUSH)
+		err = blk_mq_flush(q, disk);
+	if (!err && (ordered & QUEUE_ORDERED_DO_BAR))
+		err = blk_mq_barrier_data(q, bio, ordered);
+	if (!err && (ordered & QUEUE_ORDERED_DO_POSTFLUSH))
+		err = blk_mq_flush(q, disk);
+
+	blk_mq_unfreeze_queue(q);
+
+	bio_endio(bio, err);
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	if (unlikely(bio_rw_flagged(bio, BIO_RW_BARRIER))) {
+		blk_mq_bio_barrier(q, bio);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	blk_mq_queue_enter(q, GFP_NOIO);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) && !blk_queue_nomerges(q) &&
+	    blk_mq_attempt_merge(q, ctx, bio)) {
+		blk_mq_put_ctx(ctx);
+		blk_mq_queue_exit(q);
+		return 0;
+	}
+	blk_mq_put_ctx(ctx);
+
+	rw_flags = bio_data_dir(bio);
+	if (bio_rw_flagged(bio, BIO_RW_SYNCIO))
+		rw_flags |= REQ_RW_SYNC;
+
+	rq = __blk_mq_alloc_request(q, rw_flags, GFP_NOIO);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	__blk_mq_insert_request(hctx, rq, false);
+	blk_mq_run_hw_queue(hctx, false);
+	return 0;
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (!hctx->tags)
+		return;
+
+	for (i = 0; i < hctx->tags->nr_tags; i++)
+		kfree(hctx->tags->rqs[i]);
+	blk_mq_free_tags(hctx->tags);
+	hctx->tags = NULL;
+}
+
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      struct blk_mq_reg *reg, void *driver_data,
+			      int node)
+{
+	size_t rq_size = sizeof(struct request) + reg->cmd_size;
+	unsigned int i;
+
+	hctx->tags = blk_mq_init_tags(reg->queue_depth, node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	for (i = 0; i < reg->queue_depth; i++) {
+		struct request *rq;
+
+		rq = kzalloc_node(rq_size, GFP_KERNEL, node);
+		if (!rq)
+			goto fail;
+		hctx->tags->rqs[i] = rq;
+
+		if (reg->ops->init_request &&
+		    reg->ops->init_request(driver_data, rq, hctx->queue_num, i))
+			goto fail;
+	}
+
+	hctx->queue_depth = reg->queue_depth;
+	return 0;
+
+fail:
+	blk_mq_free_rq_map(hctx);
+	return -ENOMEM;
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		int node = reg->numa_node;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+
+		hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(long), GFP_KERNEL, node);
+		if (!hctx->ctxs || !hctx->ctx_map)
+			return -ENOMEM;
+
+		if (blk_mq_init_rq_map(hctx, reg, driver_data, node))
+			return -ENOMEM;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Spread the possible cpus evenly over the hardware queues, keeping
+ * neighbouring cpu numbers on the same queue.
+ */
+static void blk_mq_map_swqueues(struct request_queue *q)
+{
+	unsigned int cpu, nr = 0, nr_cpus = num_possible_cpus();
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+
+	for_each_possible_cpu(cpu)
+		q->mq_map[cpu] = nr++ * q->nr_hw_queues / nr_cpus;
+
+	for_each_possible_cpu(cpu) {
+		ctx = __blk_mq_get_ctx(q, cpu);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, cpu);
+		cpumask_set_cpu(cpu, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - set up a multiqueue request queue
+ * @reg:	hardware queue count, depth and driver operations
+ * @driver_data: passed to ->init_hctx() and ->init_request()
+ *
+ * Description:
+ *    The blk-mq counterpart of blk_init_queue().  Queue limits are set
+ *    by the driver afterwards as usual, and the queue is released with
+ *    blk_cleanup_queue().  Returns %NULL on failure.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	unsigned int i;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->mq_ops = reg->ops;
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	init_waitqueue_head(&q->mq_freeze_wq);
+	if (percpu_counter_init(&q->mq_usage_counter, 0))
+		goto err_put;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx)
+		goto err_put;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL,
+				    reg->numa_node);
+		if (!hctx)
+			goto err_put;
+		q->queue_hw_ctx[i] = hctx;
+		if (!zalloc_cpumask_var(&hctx->cpumask, GFP_KERNEL))
+			goto err_put;
+	}
+
+	q->queue_flags = QUEUE_FLAG_DEFAULT;
+	q->sg_reserved_size = INT_MAX;
+	blk_queue_make_request(q, blk_mq_make_request);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_put;
+
+	blk_mq_map_swqueues(q);
+	return q;
+
+err_put:
+	/* blk_release_queue() frees whatever was set up */
+	blk_put_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_release_queue() once the last reference is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < q->nr_hw_queues; i++) {
+			hctx = q->queue_hw_ctx[i];
+			if (!hctx)
+				continue;
+			cancel_work_sync(&hctx->run_work);
+			if (hctx->tags && q->mq_ops->exit_hctx)
+				q->mq_ops->exit_hctx(hctx, i);
+			blk_mq_free_rq_map(hctx);
+			kfree(hctx->ctxs);
+			kfree(hctx->ctx_map);
+			free_cpumask_var(hctx->cpumask);
+			kfree(hctx);
+		}
+		kfree(q->queue_hw_ctx);
+	}
+
+	kfree(q->mq_map);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+	percpu_counter_destroy(&q->mq_usage_counter);
+}
@@ -0,0 +1,21 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software staging queue. Requests are inserted here by the
+ * submitting cpu and pulled off by whoever runs the hardware queue the
+ * cpu is mapped to.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+#endif
@@ -5,6 +5,7 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/blktrace_api.h>
 
 #include "blk.h"
@@ -239,6 +240,61 @@ static ssize_t queue_iostats_store(struct request_queue *q, const char *page,
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_poll(q), page);
+}
+
+static ssize_t queue_poll_store(struct request_queue *q, const char *page,
+				size_t count)
+{
+	unsigned long poll_on;
+	ssize_t ret;
+
+	/* only drivers with a ->poll() hook can be polled */
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	ret = queue_var_store(&poll_on, page, count);
+	spin_lock_irq(q->queue_lock);
+	if (poll_on)
+		queue_flag_set(QUEUE_FLAG_POLL, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_POLL, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+/*
+ * How often waiters polled the queue, how often they found their IO
+ * done that way, and a histogram of how long they spun until then.
+ */
+static ssize_t queue_poll_stats_show(struct request_queue *q, char *page)
+{
+	unsigned long lat[BLK_MQ_POLL_LAT_BKTS] = { 0 };
+	unsigned long invoked = 0, success = 0;
+	struct blk_mq_hw_ctx *hctx;
+	ssize_t len;
+	int i, j;
+
+	if (q->mq_ops) {
+		queue_for_each_hw_ctx(q, hctx, i) {
+			invoked += hctx->poll_invoked;
+			success += hctx->poll_success;
+			for (j = 0; j < BLK_MQ_POLL_LAT_BKTS; j++)
+				lat[j] += hctx->poll_lat[j];
+		}
+	}
+
+	len = sprintf(page, "invoked=%lu success=%lu\n", invoked, success);
+	for (j = 0; j < BLK_MQ_POLL_LAT_BKTS - 1; j++)
+		len += sprintf(page + len, "<%lu us: %lu\n", 1UL << j, lat[j]);
+	len += sprintf(page + len, ">=%lu us: %lu\n", 1UL << (j - 1), lat[j]);
+
+	return len;
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -317,6 +373,17 @@ static struct queue_sysfs_entry queue_iostats_entry = {
 	.store = queue_iostats_store,
 };
 
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+static struct queue_sysfs_entry queue_poll_stats_entry = {
+	.attr = {.name = "io_poll_stats", .mode = S_IRUGO },
+	.show = queue_poll_stats_show,
+};
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -332,6 +399,8 @@ static struct attribute *default_attrs[] = {
 	&queue_nomerges_entry.attr,
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
+	&queue_poll_entry.attr,
+	&queue_poll_stats_entry.attr,
 	NULL,
 };
 
@@ -402,12 +471,18 @@ static void blk_release_queue(struct kobject *kobj)
 
 	blk_sync_queue(q);
 
+	/* queues freed without going through blk_cleanup_queue() */
+	blk_throtl_exit(q);
+
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
 	if (q->queue_tags)
 		__blk_queue_free_tags(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	blk_trace_shutdown(q);
 
 	bdi_destroy(&q->backing_dev_info);
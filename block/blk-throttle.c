@@ -0,0 +1,763 @@
+/*
+ * Interface for controlling IO bandwidth on a request queue
+ *
+ * Bios are checked against the bps and iops limits of their submitter's
+ * blkio cgroup in generic_make_request(), before they reach the elevator,
+ * so throttling works the same for every IO scheduler and for stacking
+ * drivers. Each group keeps a token bucket per direction for bytes and
+ * for IOs, which fills at the configured rate and holds at most
+ * throtl_slice worth of tokens. A bio may go while the group is not in
+ * debt; otherwise it is queued on its group and the group is put on a
+ * service tree sorted by the time it can dispatch again. A delayed work
+ * item submits queued bios once that time has come.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/kdev_t.h>
+#include <linux/math64.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Max dispatch from a group in one round */
+static int throtl_grp_quantum = 8;
+
+/* Total max dispatch from all groups in one round */
+static int throtl_quantum = 32;
+
+/* Bursts of up to throtl_slice worth of IO are allowed */
+static unsigned long throtl_slice = HZ/10;	/* 100 ms */
+
+/*
+ * Byte tokens are kept in units of 1/HZ bytes, so that a bucket fills by
+ * bps units every jiffy. Larger rates are as good as no limit at all and
+ * are capped so that the bucket arithmetic cannot overflow.
+ */
+#define THROTL_BPS_MAX		((u64)LLONG_MAX / HZ)
+
+struct throtl_rb_root {
+	struct rb_root rb;
+	struct rb_node *left;
+	unsigned int count;
+};
+
+#define THROTL_RB_ROOT	(struct throtl_rb_root) { .rb = RB_ROOT, .left = NULL, \
+			.count = 0 }
+
+#define rb_entry_tg(node)	rb_entry((node), struct throtl_grp, rb_node)
+
+struct throtl_grp {
+	/* List of throtl groups on the request queue */
+	struct hlist_node tg_node;
+
+	/* active throtl group service tree member */
+	struct rb_node rb_node;
+	bool on_st;
+
+	/* time at which the group's first queued bio may be dispatched */
+	unsigned long disptime;
+
+	struct blkio_group blkg;
+	atomic_t ref;
+
+	/* Two lists for READ and WRITE */
+	struct bio_list bio_lists[2];
+
+	/* Number of queued bios on READ and WRITE lists */
+	unsigned int nr_queued[2];
+
+	/* bytes per second rate limits, 0 means no limit */
+	u64 bps[2];
+
+	/* IOPS limits, 0 means no limit */
+	unsigned int iops[2];
+
+	/* token buckets, see THROTL_BPS_MAX and tg_refill() */
+	s64 bytes_tokens[2];
+	s64 io_tokens[2];
+	unsigned long last_refill[2];
+};
+
+struct throtl_data {
+	/* service tree for active throtl groups */
+	struct throtl_rb_root tg_service_tree;
+
+	struct throtl_grp root_tg;
+	struct hlist_head tg_list;
+	struct request_queue *queue;
+
+	/* Total Number of queued bios on READ and WRITE lists */
+	unsigned int nr_queued[2];
+
+	/* Work for dispatching throttled bios */
+	struct delayed_work throtl_work;
+
+	/* set by the cgroup side when a rule changed */
+	atomic_t limits_changed;
+};
+
+static inline struct throtl_grp *tg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct throtl_grp, blkg);
+	return NULL;
+}
+
+static inline unsigned int total_nr_queued(struct throtl_data *td)
+{
+	return td->nr_queued[READ] + td->nr_queued[WRITE];
+}
+
+static inline struct throtl_grp *throtl_ref_get_tg(struct throtl_grp *tg)
+{
+	atomic_inc(&tg->ref);
+	return tg;
+}
+
+static void throtl_put_tg(struct throtl_grp *tg)
+{
+	BUG_ON(atomic_read(&tg->ref) <= 0);
+	if (!atomic_dec_and_test(&tg->ref))
+		return;
+
+	BUG_ON(tg->on_st || tg->nr_queued[READ] || tg->nr_queued[WRITE]);
+	kfree(tg);
+}
+
+/* Same as cfq: the disk's dev_t is not known until it is registered */
+static dev_t throtl_disk_dev(struct throtl_data *td)
+{
+	struct backing_dev_info *bdi = &td->queue->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!bdi->dev ||
+	    sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor) != 2)
+		return 0;
+
+	return MKDEV(major, minor);
+}
+
+/* Add the tokens accumulated since the last refill, up to a full bucket */
+static void tg_refill(struct throtl_grp *tg, int rw)
+{
+	unsigned long elapsed = jiffies - tg->last_refill[rw];
+
+	tg->last_refill[rw] = jiffies;
+	if (elapsed > throtl_slice)
+		elapsed = throtl_slice;
+
+	if (tg->bps[rw])
+		tg->bytes_tokens[rw] = min_t(s64,
+			tg->bytes_tokens[rw] + tg->bps[rw] * elapsed,
+			tg->bps[rw] * throtl_slice);
+	if (tg->iops[rw])
+		tg->io_tokens[rw] = min_t(s64,
+			tg->io_tokens[rw] + (s64)tg->iops[rw] * elapsed,
+			(s64)tg->iops[rw] * throtl_slice);
+}
+
+static inline bool tg_may_dispatch(struct throtl_grp *tg, int rw)
+{
+	return (!tg->bps[rw] || tg->bytes_tokens[rw] >= 0) &&
+	       (!tg->iops[rw] || tg->io_tokens[rw] >= 0);
+}
+
+/*
+ * A bio may overdraw the buckets, so that a bio bigger than a full bucket
+ * still gets through. The group then waits until it is out of debt.
+ */
+static void tg_charge_bio(struct throtl_grp *tg, struct bio *bio)
+{
+	int rw = bio_data_dir(bio);
+
+	if (tg->bps[rw])
+		tg->bytes_tokens[rw] -= (s64)bio->bi_size * HZ;
+	if (tg->iops[rw])
+		tg->io_tokens[rw] -= HZ;
+}
+
+/* Jiffies until a refilled group may dispatch in direction @rw again */
+static unsigned long tg_wait_dispatch(struct throtl_grp *tg, int rw)
+{
+	unsigned long wait = 0, iops_wait;
+
+	if (tg->bps[rw] && tg->bytes_tokens[rw] < 0)
+		wait = div64_u64(-tg->bytes_tokens[rw] + tg->bps[rw] - 1,
+				 tg->bps[rw]);
+
+	if (tg->iops[rw] && tg->io_tokens[rw] < 0) {
+		iops_wait = DIV_ROUND_UP((unsigned long)-tg->io_tokens[rw],
+					 tg->iops[rw]);
+		wait = max(wait, iops_wait);
+	}
+
+	return wait;
+}
+
+/* Load the group's limits from its cgroup's rules for this device */
+static void tg_load_limits(struct throtl_grp *tg)
+{
+	struct blkio_cgroup *blkcg = tg->blkg.blkcg;
+	dev_t dev = tg->blkg.dev;
+	unsigned int iops;
+	u64 bps;
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		/* settle the tokens earned at the old rates */
+		tg_refill(tg, rw);
+
+		bps = blkiocg_get_rule(blkcg, dev, BLKIO_THROTL_READ_BPS + rw);
+		bps = min_t(u64, bps, THROTL_BPS_MAX);
+		iops = blkiocg_get_rule(blkcg, dev,
+					BLKIO_THROTL_READ_IOPS + rw);
+
+		/* a new limit starts with a full bucket */
+		if (bps && !tg->bps[rw])
+			tg->bytes_tokens[rw] = bps * throtl_slice;
+		else
+			tg->bytes_tokens[rw] = min_t(s64, tg->bytes_tokens[rw],
+						     bps * throtl_slice);
+
+		if (iops && !tg->iops[rw])
+			tg->io_tokens[rw] = (s64)iops * throtl_slice;
+		else
+			tg->io_tokens[rw] = min_t(s64, tg->io_tokens[rw],
+						  (s64)iops * throtl_slice);
+
+		tg->bps[rw] = bps;
+		tg->iops[rw] = iops;
+	}
+}
+
+static void throtl_init_group(struct throtl_grp *tg)
+{
+	INIT_HLIST_NODE(&tg->tg_node);
+	RB_CLEAR_NODE(&tg->rb_node);
+	bio_list_init(&tg->bio_lists[READ]);
+	bio_list_init(&tg->bio_lists[WRITE]);
+	tg->last_refill[READ] = tg->last_refill[WRITE] = jiffies;
+
+	/*
+	 * Take the initial reference that will be released on destroy.
+	 * It is held jointly by the cgroup and the queue, and dropped by
+	 * whichever of cgroup removal or queue exit comes first.
+	 */
+	atomic_set(&tg->ref, 1);
+}
+
+static struct throtl_grp *
+throtl_find_alloc_tg(struct throtl_data *td, struct cgroup *cgroup)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct blkio_group *blkg;
+	struct throtl_grp *tg;
+
+	blkg = blkiocg_lookup_group(blkcg, td);
+	if (blkg) {
+		tg = tg_of_blkg(blkg);
+		if (!blkg->dev) {
+			blkg->dev = throtl_disk_dev(td);
+			tg_load_limits(tg);
+		}
+		return tg;
+	}
+
+	tg = kzalloc_node(sizeof(*tg), GFP_ATOMIC, td->queue->node);
+	if (!tg)
+		return NULL;
+
+	throtl_init_group(tg);
+	blkiocg_add_blkio_group(blkcg, &tg->blkg, td, throtl_disk_dev(td),
+				BLKIO_POLICY_THROTL);
+	hlist_add_head(&tg->tg_node, &td->tg_list);
+
+	/* after linking, so that no rule update can be missed */
+	tg_load_limits(tg);
+
+	return tg;
+}
+
+/*
+ * Find or create the group of the current task's cgroup on this queue.
+ * Falls back to the root group if we are out of memory. Called under
+ * rcu_read_lock() with the queue lock held.
+ */
+static struct throtl_grp *throtl_get_tg(struct throtl_data *td)
+{
+	struct cgroup *cgroup = task_cgroup(current, blkio_subsys_id);
+	struct throtl_grp *tg;
+
+	tg = throtl_find_alloc_tg(td, cgroup);
+	if (!tg)
+		tg = &td->root_tg;
+	return tg;
+}
+
+static struct throtl_grp *throtl_rb_first(struct throtl_rb_root *root)
+{
+	/* Service tree is empty */
+	if (!root->count)
+		return NULL;
+
+	if (!root->left)
+		root->left = rb_first(&root->rb);
+
+	if (root->left)
+		return rb_entry_tg(root->left);
+
+	return NULL;
+}
+
+static void rb_erase_init(struct rb_node *n, struct rb_root *root)
+{
+	rb_erase(n, root);
+	RB_CLEAR_NODE(n);
+}
+
+static void throtl_rb_erase(struct rb_node *n, struct throtl_rb_root *root)
+{
+	if (root->left == n)
+		root->left = NULL;
+	rb_erase_init(n, &root->rb);
+	--root->count;
+}
+
+static void tg_service_tree_add(struct throtl_rb_root *st,
+				struct throtl_grp *tg)
+{
+	struct rb_node **node = &st->rb.rb_node;
+	struct rb_node *parent = NULL;
+	struct throtl_grp *__tg;
+	int left = 1;
+
+	while (*node != NULL) {
+		parent = *node;
+		__tg = rb_entry_tg(parent);
+
+		if (time_before(tg->disptime, __tg->disptime))
+			node = &parent->rb_left;
+		else {
+			node = &parent->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		st->left = &tg->rb_node;
+
+	rb_link_node(&tg->rb_node, parent, node);
+	rb_insert_color(&tg->rb_node, &st->rb);
+	st->count++;
+}
+
+static void throtl_enqueue_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	BUG_ON(tg->on_st);
+	tg_service_tree_add(&td->tg_service_tree, tg);
+	tg->on_st = true;
+}
+
+static void throtl_dequeue_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	BUG_ON(!tg->on_st);
+	throtl_rb_erase(&tg->rb_node, &td->tg_service_tree);
+	tg->on_st = false;
+}
+
+/* (Re)queue a group with queued bios at the time its first bio may go */
+static void tg_update_disptime(struct throtl_data *td, struct throtl_grp *tg)
+{
+	unsigned long wait = ULONG_MAX;
+	int rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		if (!tg->nr_queued[rw])
+			continue;
+		tg_refill(tg, rw);
+		wait = min(wait, tg_wait_dispatch(tg, rw));
+	}
+	BUG_ON(wait == ULONG_MAX);
+
+	if (tg->on_st)
+		throtl_dequeue_tg(td, tg);
+	tg->disptime = jiffies + wait;
+	throtl_enqueue_tg(td, tg);
+}
+
+static void throtl_schedule_delayed_work(struct throtl_data *td,
+					 unsigned long delay)
+{
+	struct delayed_work *dwork = &td->throtl_work;
+
+	/*
+	 * Pull in an already armed timer. If the work is queued or running
+	 * already this fails and the work reschedules itself when done.
+	 */
+	__cancel_delayed_work(dwork);
+	kblockd_schedule_delayed_work(td->queue, dwork, delay);
+}
+
+static void throtl_schedule_next_dispatch(struct throtl_data *td)
+{
+	struct throtl_grp *tg;
+	unsigned long delay = 0;
+
+	if (!total_nr_queued(td))
+		return;
+
+	tg = throtl_rb_first(&td->tg_service_tree);
+	BUG_ON(!tg);
+
+	if (time_after(tg->disptime, jiffies))
+		delay = tg->disptime - jiffies;
+	throtl_schedule_delayed_work(td, delay);
+}
+
+static void throtl_add_bio_tg(struct throtl_data *td, struct throtl_grp *tg,
+			      struct bio *bio)
+{
+	int rw = bio_data_dir(bio);
+
+	bio_list_add(&tg->bio_lists[rw], bio);
+	/* Take a bio reference on tg */
+	throtl_ref_get_tg(tg);
+	tg->nr_queued[rw]++;
+	td->nr_queued[rw]++;
+}
+
+static void tg_dispatch_one_bio(struct throtl_data *td, struct throtl_grp *tg,
+				int rw, struct bio_list *bl)
+{
+	struct bio *bio;
+
+	bio = bio_list_pop(&tg->bio_lists[rw]);
+	tg->nr_queued[rw]--;
+	td->nr_queued[rw]--;
+
+	tg_charge_bio(tg, bio);
+	bio->bi_flags |= (1 << BIO_THROTTLED);
+	bio_list_add(bl, bio);
+
+	/* the caller holds its own reference on tg */
+	throtl_put_tg(tg);
+}
+
+static int throtl_dispatch_tg(struct throtl_data *td, struct throtl_grp *tg,
+			      struct bio_list *bl)
+{
+	unsigned int nr_reads = 0, nr_writes = 0;
+	unsigned int max_nr_reads = throtl_grp_quantum*3/4;
+	unsigned int max_nr_writes = throtl_grp_quantum - max_nr_reads;
+
+	/* Try to dispatch 75% READS and 25% WRITES */
+	tg_refill(tg, READ);
+	while (tg->nr_queued[READ] && tg_may_dispatch(tg, READ)) {
+		tg_dispatch_one_bio(td, tg, READ, bl);
+		if (++nr_reads >= max_nr_reads)
+			break;
+	}
+
+	tg_refill(tg, WRITE);
+	while (tg->nr_queued[WRITE] && tg_may_dispatch(tg, WRITE)) {
+		tg_dispatch_one_bio(td, tg, WRITE, bl);
+		if (++nr_writes >= max_nr_writes)
+			break;
+	}
+
+	return nr_reads + nr_writes;
+}
+
+static int throtl_select_dispatch(struct throtl_data *td, struct bio_list *bl)
+{
+	unsigned int nr_disp = 0;
+	struct throtl_grp *tg;
+
+	while (1) {
+		tg = throtl_rb_first(&td->tg_service_tree);
+		if (!tg || time_before(jiffies, tg->disptime))
+			break;
+
+		/* its bios' references may be the last ones */
+		throtl_ref_get_tg(tg);
+		throtl_dequeue_tg(td, tg);
+
+		nr_disp += throtl_dispatch_tg(td, tg, bl);
+
+		if (tg->nr_queued[READ] || tg->nr_queued[WRITE])
+			tg_update_disptime(td, tg);
+		throtl_put_tg(tg);
+
+		if (nr_disp >= throtl_quantum)
+			break;
+	}
+
+	return nr_disp;
+}
+
+static void throtl_process_limits(struct throtl_data *td)
+{
+	struct hlist_node *pos;
+	struct throtl_grp *tg;
+
+	if (!atomic_xchg(&td->limits_changed, 0))
+		return;
+
+	tg_load_limits(&td->root_tg);
+	if (td->root_tg.on_st)
+		tg_update_disptime(td, &td->root_tg);
+
+	hlist_for_each_entry(tg, pos, &td->tg_list, tg_node) {
+		tg_load_limits(tg);
+		if (tg->on_st)
+			tg_update_disptime(td, tg);
+	}
+}
+
+static void throtl_dispatch_work(struct work_struct *work)
+{
+	struct throtl_data *td = container_of(work, struct throtl_data,
+					      throtl_work.work);
+	struct request_queue *q = td->queue;
+	struct bio_list bio_list_on_stack;
+	struct blk_plug plug;
+	struct bio *bio;
+	unsigned int nr_disp;
+
+	bio_list_init(&bio_list_on_stack);
+
+	spin_lock_irq(q->queue_lock);
+	throtl_process_limits(td);
+	nr_disp = throtl_select_dispatch(td, &bio_list_on_stack);
+	throtl_schedule_next_dispatch(td);
+	spin_unlock_irq(q->queue_lock);
+
+	if (!nr_disp)
+		return;
+
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(&bio_list_on_stack)))
+		generic_make_request(bio);
+	blk_finish_plug(&plug);
+}
+
+/*
+ * Returns true if @bio was queued for later dispatch, false if it may go
+ * on to the queue's make_request_fn now.
+ */
+bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
+{
+	struct throtl_data *td;
+	struct blkio_cgroup *blkcg;
+	struct throtl_grp *tg;
+	int rw = bio_data_dir(bio);
+	bool throttled = false;
+
+	/* we get here again when the dispatch work submits the bio */
+	if (bio_flagged(bio, BIO_THROTTLED)) {
+		bio->bi_flags &= ~(1 << BIO_THROTTLED);
+		return false;
+	}
+
+	/* blk_throtl_exit() frees td after a grace period */
+	rcu_read_lock();
+	td = rcu_dereference(q->td);
+	if (!td)
+		goto out;
+
+	/*
+	 * Cgroups without any rule are not limited anywhere. Nothing needs
+	 * to be kept in order behind throttled bios either as long as none
+	 * are queued.
+	 */
+	blkcg = cgroup_to_blkio_cgroup(task_cgroup(current, blkio_subsys_id));
+	if (list_empty(&blkcg->policy_list) && !td->nr_queued[rw])
+		goto out;
+
+	spin_lock_irq(q->queue_lock);
+
+	if (unlikely(test_bit(QUEUE_FLAG_DEAD, &q->queue_flags)))
+		goto out_unlock;
+
+	throtl_process_limits(td);
+	tg = throtl_get_tg(td);
+
+	/* keep the group's bios in order */
+	if (tg->nr_queued[rw]) {
+		throtl_add_bio_tg(td, tg, bio);
+		throttled = true;
+		goto out_unlock;
+	}
+
+	tg_refill(tg, rw);
+	if (tg_may_dispatch(tg, rw)) {
+		tg_charge_bio(tg, bio);
+		goto out_unlock;
+	}
+
+	throtl_add_bio_tg(td, tg, bio);
+	throttled = true;
+	tg_update_disptime(td, tg);
+	throtl_schedule_next_dispatch(td);
+
+out_unlock:
+	spin_unlock_irq(q->queue_lock);
+out:
+	rcu_read_unlock();
+	return throttled;
+}
+
+static void throtl_destroy_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	/* Something wrong if we are trying to remove same group twice */
+	BUG_ON(hlist_unhashed(&tg->tg_node));
+
+	hlist_del_init(&tg->tg_node);
+
+	/*
+	 * Put the reference taken at the time of creation so that the group
+	 * goes away once its queued bios are gone.
+	 */
+	throtl_put_tg(tg);
+}
+
+static void throtl_release_tgs(struct throtl_data *td)
+{
+	struct hlist_node *pos, *n;
+	struct throtl_grp *tg;
+
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		/*
+		 * If the cgroup removal path got to the blkio_group first and
+		 * unlinked it, it will destroy the tg once we drop the queue
+		 * lock.
+		 */
+		if (!blkiocg_del_blkio_group(&tg->blkg))
+			throtl_destroy_tg(td, tg);
+	}
+
+	blkiocg_del_blkio_group(&td->root_tg.blkg);
+}
+
+/* Fail all queued bios, the queue is going away */
+static void throtl_drain(struct throtl_data *td, struct bio_list *bl)
+{
+	struct throtl_grp *tg;
+	struct bio *bio;
+	int rw;
+
+	while ((tg = throtl_rb_first(&td->tg_service_tree))) {
+		throtl_ref_get_tg(tg);
+		throtl_dequeue_tg(td, tg);
+
+		for (rw = READ; rw <= WRITE; rw++) {
+			while ((bio = bio_list_pop(&tg->bio_lists[rw]))) {
+				tg->nr_queued[rw]--;
+				td->nr_queued[rw]--;
+				bio_list_add(bl, bio);
+				throtl_put_tg(tg);
+			}
+		}
+		throtl_put_tg(tg);
+	}
+}
+
+static void throtl_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct throtl_data *td = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(td->queue->queue_lock, flags);
+	throtl_destroy_tg(td, tg_of_blkg(blkg));
+	spin_unlock_irqrestore(td->queue->queue_lock, flags);
+}
+
+/*
+ * Called with blkcg->lock held, which nests inside the queue lock. Leave
+ * the reload to the dispatch work, or to the next throttled bio.
+ */
+static void throtl_update_blkio_group_limits(void *key,
+					     struct blkio_group *blkg)
+{
+	struct throtl_data *td = key;
+
+	atomic_set(&td->limits_changed, 1);
+	throtl_schedule_delayed_work(td, 0);
+}
+
+static struct blkio_policy_type blkio_policy_throtl = {
+	.ops = {
+		.blkio_unlink_group_fn = throtl_unlink_blkio_group,
+		.blkio_update_group_limits_fn =
+					throtl_update_blkio_group_limits,
+	},
+	.plid = BLKIO_POLICY_THROTL,
+};
+
+int blk_throtl_init(struct request_queue *q)
+{
+	struct throtl_data *td;
+
+	td = kzalloc_node(sizeof(*td), GFP_KERNEL, q->node);
+	if (!td)
+		return -ENOMEM;
+
+	INIT_HLIST_HEAD(&td->tg_list);
+	td->tg_service_tree = THROTL_RB_ROOT;
+	atomic_set(&td->limits_changed, 0);
+	INIT_DELAYED_WORK(&td->throtl_work, throtl_dispatch_work);
+
+	/* The root group is part of td and lives as long as the queue */
+	throtl_init_group(&td->root_tg);
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &td->root_tg.blkg, td, 0,
+				BLKIO_POLICY_THROTL);
+
+	td->queue = q;
+	q->td = td;
+	return 0;
+}
+
+void blk_throtl_exit(struct request_queue *q)
+{
+	struct throtl_data *td = q->td;
+	struct bio_list bl;
+	struct bio *bio;
+
+	if (!td)
+		return;
+
+	/* No group can see a rule update once it is off its cgroup */
+	spin_lock_irq(q->queue_lock);
+	throtl_release_tgs(td);
+	spin_unlock_irq(q->queue_lock);
+
+	cancel_delayed_work_sync(&td->throtl_work);
+
+	bio_list_init(&bl);
+	spin_lock_irq(q->queue_lock);
+	throtl_drain(td, &bl);
+	spin_unlock_irq(q->queue_lock);
+
+	while ((bio = bio_list_pop(&bl)))
+		bio_endio(bio, -EIO);
+
+	rcu_assign_pointer(q->td, NULL);
+
+	/*
+	 * Wait for blk_throtl_bio() callers that found td under RCU, and
+	 * for the cgroup removal path that may still be destroying one of
+	 * our groups.
+	 */
+	synchronize_rcu();
+	kfree(td);
+}
+
+static int __init throtl_init(void)
+{
+	blkio_policy_register(&blkio_policy_throtl);
+	return 0;
+}
+
+module_init(throtl_init);
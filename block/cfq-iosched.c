@@ -12,6 +12,7 @@
 #include <linux/rbtree.h>
 #include <linux/ioprio.h>
 #include <linux/blktrace_api.h>
+#include "blk-cgroup.h"
 
 /*
  * tunables
@@ -40,6 +41,7 @@ static int cfq_slice_idle = HZ / 125;
 
 #define CFQ_SLICE_SCALE		(5)
 #define CFQ_HW_QUEUE_MIN	(5)
+#define CFQ_SERVICE_SHIFT	12
 
 #define RQ_CIC(rq)		\
 	((struct cfq_io_context *) (rq)->elevator_private)
@@ -67,8 +69,10 @@ static DEFINE_SPINLOCK(ioc_gone_lock);
 struct cfq_rb_root {
 	struct rb_root rb;
 	struct rb_node *left;
+	/* for the group service tree: vdisktime the tree has advanced to */
+	u64 min_vdisktime;
 };
-#define CFQ_RB_ROOT	(struct cfq_rb_root) { RB_ROOT, NULL, }
+#define CFQ_RB_ROOT	(struct cfq_rb_root) { RB_ROOT, NULL, 0, }
 
 /*
  * Per process-grouping structure
@@ -99,6 +103,7 @@ struct cfq_queue {
 	/* fifo list of requests in sort_list */
 	struct list_head fifo;
 
+	unsigned long slice_start;
 	unsigned long slice_end;
 	long slice_resid;
 	unsigned int slice_dispatch;
@@ -113,6 +118,34 @@ struct cfq_queue {
 	unsigned short ioprio_class, org_ioprio_class;
 
 	pid_t pid;
+
+	/* group this queue's disk time is charged to */
+	struct cfq_group *cfqg;
+};
+
+/*
+ * Per cgroup, per device structure. Disk time is shared out between the
+ * groups in proportion to their weight, and between the queues of a group
+ * as CFQ always did.
+ */
+struct cfq_group {
+	/* group service_tree member */
+	struct rb_node rb_node;
+	/* group service_tree key: disk time used, scaled by weight */
+	u64 vdisktime;
+	unsigned int weight;
+	bool on_st;
+
+	/* number of cfqq currently on this group's service tree */
+	int nr_cfqq;
+	/* rr list of queues with requests */
+	struct cfq_rb_root service_tree;
+
+	atomic_t ref;
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	struct blkio_group blkg;
+	struct hlist_node cfqd_node;
+#endif
 };
 
 /*
@@ -122,9 +155,15 @@ struct cfq_data {
 	struct request_queue *queue;
 
 	/*
-	 * rr list of queues with requests and the count of them
+	 * rr list of groups with busy queues, sorted by vdisktime. The root
+	 * group is always there, it also holds the async queues.
 	 */
-	struct cfq_rb_root service_tree;
+	struct cfq_rb_root grp_service_tree;
+	struct cfq_group root_group;
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	/* all other groups of this device */
+	struct hlist_head cfqg_list;
+#endif
 
 	/*
 	 * Each priority tree is sorted by next_request position.  These
@@ -432,6 +471,19 @@ static struct cfq_queue *cfq_rb_first(struct cfq_rb_root *root)
 	return NULL;
 }
 
+#define rb_entry_cfqg(node)	rb_entry((node), struct cfq_group, rb_node)
+
+static struct cfq_group *cfq_rb_first_group(struct cfq_rb_root *root)
+{
+	if (!root->left)
+		root->left = rb_first(&root->rb);
+
+	if (root->left)
+		return rb_entry_cfqg(root->left);
+
+	return NULL;
+}
+
 static void rb_erase_init(struct rb_node *n, struct rb_root *root)
 {
 	rb_erase(n, root);
@@ -478,18 +530,341 @@ static unsigned long cfq_slice_offset(struct cfq_data *cfqd,
 	/*
 	 * just an approximation, should be ok.
 	 */
-	return (cfqd->busy_queues - 1) * (cfq_prio_slice(cfqd, 1, 0) -
+	return (cfqq->cfqg->nr_cfqq - 1) * (cfq_prio_slice(cfqd, 1, 0) -
 		       cfq_prio_slice(cfqd, cfq_cfqq_sync(cfqq), cfqq->ioprio));
 }
 
+static void cfq_link_cfqq_cfqg(struct cfq_queue *cfqq, struct cfq_group *cfqg)
+{
+	cfqq->cfqg = cfqg;
+	/* cfqq reference on cfqg */
+	atomic_inc(&cfqg->ref);
+}
+
+/*
+ * The root group is embedded in cfq_data and holds a reference that is
+ * never dropped, so it is never freed here.
+ */
+static void cfq_put_cfqg(struct cfq_group *cfqg)
+{
+	BUG_ON(atomic_read(&cfqg->ref) <= 0);
+
+	if (!atomic_dec_and_test(&cfqg->ref))
+		return;
+
+	BUG_ON(cfqg->on_st || !RB_EMPTY_ROOT(&cfqg->service_tree.rb));
+	kfree(cfqg);
+}
+
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+static inline struct cfq_group *cfqg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct cfq_group, blkg);
+	return NULL;
+}
+
+static void
+cfq_update_blkio_group_weight(struct blkio_group *blkg, unsigned int weight)
+{
+	cfqg_of_blkg(blkg)->weight = weight;
+}
+
+/*
+ * The disk is only registered with its dev_t after the partitions have
+ * been scanned, so this may still return 0 for the first groups.
+ */
+static dev_t cfq_disk_dev(struct cfq_data *cfqd)
+{
+	struct backing_dev_info *bdi = &cfqd->queue->backing_dev_info;
+	unsigned int major, minor;
+
+	if (!bdi->dev ||
+	    sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor) != 2)
+		return 0;
+
+	return MKDEV(major, minor);
+}
+
+static struct cfq_group *
+cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup)
+{
+	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
+	struct blkio_group *blkg;
+	struct cfq_group *cfqg;
+
+	blkg = blkiocg_lookup_group(blkcg, cfqd);
+	if (blkg) {
+		if (!blkg->dev)
+			blkg->dev = cfq_disk_dev(cfqd);
+		return cfqg_of_blkg(blkg);
+	}
+
+	cfqg = kzalloc_node(sizeof(*cfqg), GFP_ATOMIC, cfqd->queue->node);
+	if (!cfqg)
+		return NULL;
+
+	RB_CLEAR_NODE(&cfqg->rb_node);
+	cfqg->service_tree = CFQ_RB_ROOT;
+	cfqg->weight = blkcg->weight;
+
+	/*
+	 * Take the initial reference that will be released on destroy.
+	 * It is held jointly by the cgroup and the elevator, and dropped
+	 * by whichever of cgroup removal or elevator exit comes first.
+	 */
+	atomic_set(&cfqg->ref, 1);
+
+	blkiocg_add_blkio_group(blkcg, &cfqg->blkg, cfqd, cfq_disk_dev(cfqd),
+				BLKIO_POLICY_PROP);
+	hlist_add_head(&cfqg->cfqd_node, &cfqd->cfqg_list);
+
+	return cfqg;
+}
+
+/*
+ * Find or create the group of the current task's cgroup on this device.
+ * Falls back to the root group if we are out of memory. Queue lock must
+ * be held.
+ */
+static struct cfq_group *cfq_get_cfqg(struct cfq_data *cfqd)
+{
+	struct cgroup *cgroup;
+	struct cfq_group *cfqg;
+
+	rcu_read_lock();
+	cgroup = task_cgroup(current, blkio_subsys_id);
+	cfqg = cfq_find_alloc_cfqg(cfqd, cgroup);
+	if (!cfqg)
+		cfqg = &cfqd->root_group;
+	rcu_read_unlock();
+
+	return cfqg;
+}
+
+static void cfq_destroy_cfqg(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	/* Something wrong if we are trying to remove same group twice */
+	BUG_ON(hlist_unhashed(&cfqg->cfqd_node));
+
+	hlist_del_init(&cfqg->cfqd_node);
+
+	/*
+	 * Put the reference taken at the time of creation so that the group
+	 * goes away once its queues are gone.
+	 */
+	cfq_put_cfqg(cfqg);
+}
+
+static void cfq_release_cfq_groups(struct cfq_data *cfqd)
+{
+	struct hlist_node *pos, *n;
+	struct cfq_group *cfqg;
+
+	hlist_for_each_entry_safe(cfqg, pos, n, &cfqd->cfqg_list, cfqd_node) {
+		/*
+		 * If the cgroup removal path got to the blkio_group first and
+		 * unlinked it, it will destroy the cfqg once we drop the
+		 * queue lock.
+		 */
+		if (!blkiocg_del_blkio_group(&cfqg->blkg))
+			cfq_destroy_cfqg(cfqd, cfqg);
+	}
+
+	blkiocg_del_blkio_group(&cfqd->root_group.blkg);
+}
+
+/*
+ * Called from the cgroup removal path with the blkio_group already
+ * unlinked from the cgroup. cfq_exit_queue() waits for an rcu grace
+ * period before freeing cfqd, so it is still valid here.
+ */
+static void cfq_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct cfq_data *cfqd = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+	cfq_destroy_cfqg(cfqd, cfqg_of_blkg(blkg));
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+static inline void
+cfqg_stats_update_timeslice(struct cfq_group *cfqg, unsigned long used)
+{
+	blkiocg_update_timeslice_used(&cfqg->blkg, used);
+}
+
+static inline void
+cfqg_stats_update_dispatch(struct cfq_group *cfqg, struct request *rq)
+{
+	blkiocg_update_dispatch_stats(&cfqg->blkg, blk_rq_sectors(rq));
+}
+
+static inline void
+cfqg_stats_update_completion(struct cfq_group *cfqg, struct request *rq)
+{
+	blkiocg_update_completion_stats(&cfqg->blkg, rq_start_time_ns(rq),
+					rq_io_start_time_ns(rq));
+}
+#else /* CONFIG_CFQ_GROUP_IOSCHED */
+static struct cfq_group *cfq_get_cfqg(struct cfq_data *cfqd)
+{
+	return &cfqd->root_group;
+}
+
+static inline void cfq_release_cfq_groups(struct cfq_data *cfqd) { }
+
+static inline void
+cfqg_stats_update_timeslice(struct cfq_group *cfqg, unsigned long used) { }
+static inline void
+cfqg_stats_update_dispatch(struct cfq_group *cfqg, struct request *rq) { }
+static inline void
+cfqg_stats_update_completion(struct cfq_group *cfqg, struct request *rq) { }
+#endif /* CONFIG_CFQ_GROUP_IOSCHED */
+
 /*
- * The cfqd->service_tree holds all pending cfq_queue's that have
+ * Disk time used by a group advances its vdisktime inversely to its
+ * weight. A group of default weight is charged the time it used.
+ */
+static inline u64 cfq_scale_slice(unsigned long delta, struct cfq_group *cfqg)
+{
+	u64 d = delta << CFQ_SERVICE_SHIFT;
+
+	d = d * BLKIO_WEIGHT_DEFAULT;
+	do_div(d, cfqg->weight);
+	return d;
+}
+
+static inline u64 max_vdisktime(u64 min_vdisktime, u64 vdisktime)
+{
+	s64 delta = (s64)(vdisktime - min_vdisktime);
+
+	if (delta > 0)
+		min_vdisktime = vdisktime;
+
+	return min_vdisktime;
+}
+
+static void update_min_vdisktime(struct cfq_rb_root *st)
+{
+	struct cfq_group *cfqg;
+
+	cfqg = cfq_rb_first_group(st);
+	if (cfqg)
+		st->min_vdisktime = max_vdisktime(st->min_vdisktime,
+						  cfqg->vdisktime);
+}
+
+static inline s64
+cfqg_key(struct cfq_rb_root *st, struct cfq_group *cfqg)
+{
+	return cfqg->vdisktime - st->min_vdisktime;
+}
+
+static void
+__cfq_group_service_tree_add(struct cfq_rb_root *st, struct cfq_group *cfqg)
+{
+	struct rb_node **node = &st->rb.rb_node;
+	struct rb_node *parent = NULL;
+	struct cfq_group *__cfqg;
+	s64 key = cfqg_key(st, cfqg);
+	int left = 1;
+
+	while (*node != NULL) {
+		parent = *node;
+		__cfqg = rb_entry_cfqg(parent);
+
+		if (key < cfqg_key(st, __cfqg))
+			node = &parent->rb_left;
+		else {
+			node = &parent->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		st->left = &cfqg->rb_node;
+
+	rb_link_node(&cfqg->rb_node, parent, node);
+	rb_insert_color(&cfqg->rb_node, &st->rb);
+}
+
+static void
+cfq_group_service_tree_add(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	struct cfq_rb_root *st = &cfqd->grp_service_tree;
+
+	cfqg->nr_cfqq++;
+	if (cfqg->on_st)
+		return;
+
+	/*
+	 * A group coming back after a pause must not be able to claim the
+	 * disk time it did not use meanwhile and starve the others, so start
+	 * it no earlier than where the tree is now.
+	 */
+	cfqg->vdisktime = max_vdisktime(st->min_vdisktime, cfqg->vdisktime);
+	__cfq_group_service_tree_add(st, cfqg);
+	cfqg->on_st = true;
+}
+
+static void
+cfq_group_service_tree_del(struct cfq_data *cfqd, struct cfq_group *cfqg)
+{
+	struct cfq_rb_root *st = &cfqd->grp_service_tree;
+
+	BUG_ON(cfqg->nr_cfqq < 1);
+	cfqg->nr_cfqq--;
+
+	/* If there are other cfq queues under this group, don't delete it */
+	if (cfqg->nr_cfqq)
+		return;
+
+	cfqg->on_st = false;
+	if (!RB_EMPTY_NODE(&cfqg->rb_node))
+		cfq_rb_erase(&cfqg->rb_node, st);
+}
+
+/*
+ * Disk time the active queue held the disk for, idling included. A queue
+ * that expires within the jiffy it started is still charged one.
+ */
+static unsigned long cfq_cfqq_slice_usage(struct cfq_queue *cfqq)
+{
+	unsigned long slice_used = jiffies - cfqq->slice_start;
+
+	return max_t(unsigned long, slice_used, 1);
+}
+
+static void cfq_group_served(struct cfq_data *cfqd, struct cfq_group *cfqg,
+			     struct cfq_queue *cfqq)
+{
+	struct cfq_rb_root *st = &cfqd->grp_service_tree;
+	unsigned long used_sl = cfq_cfqq_slice_usage(cfqq);
+
+	/* Can't update vdisktime while group is on service tree */
+	if (cfqg->on_st)
+		cfq_rb_erase(&cfqg->rb_node, st);
+	cfqg->vdisktime += cfq_scale_slice(used_sl, cfqg);
+	if (cfqg->on_st)
+		__cfq_group_service_tree_add(st, cfqg);
+
+	cfq_log_cfqq(cfqd, cfqq, "served: sl=%lu vt=%llu min_vt=%llu", used_sl,
+		     (unsigned long long) cfqg->vdisktime,
+		     (unsigned long long) st->min_vdisktime);
+	cfqg_stats_update_timeslice(cfqg, used_sl);
+}
+
+/*
+ * Each group's service_tree holds its pending cfq_queue's that have
  * requests waiting to be processed. It is sorted in the order that
  * we will service the queues.
  */
 static void cfq_service_tree_add(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 				 int add_front)
 {
+	struct cfq_rb_root *service_tree = &cfqq->cfqg->service_tree;
 	struct rb_node **p, *parent;
 	struct cfq_queue *__cfqq;
 	unsigned long rb_key;
@@ -497,7 +872,7 @@ static void cfq_service_tree_add(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 
 	if (cfq_class_idle(cfqq)) {
 		rb_key = CFQ_IDLE_DELAY;
-		parent = rb_last(&cfqd->service_tree.rb);
+		parent = rb_last(&service_tree->rb);
 		if (parent && parent != &cfqq->rb_node) {
 			__cfqq = rb_entry(parent, struct cfq_queue, rb_node);
 			rb_key += __cfqq->rb_key;
@@ -517,12 +892,12 @@ static void cfq_service_tree_add(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 		if (rb_key == cfqq->rb_key)
 			return;
 
-		cfq_rb_erase(&cfqq->rb_node, &cfqd->service_tree);
+		cfq_rb_erase(&cfqq->rb_node, service_tree);
 	}
 
 	left = 1;
 	parent = NULL;
-	p = &cfqd->service_tree.rb.rb_node;
+	p = &service_tree->rb.rb_node;
 	while (*p) {
 		struct rb_node **n;
 
@@ -554,11 +929,11 @@ static void cfq_service_tree_add(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 	}
 
 	if (left)
-		cfqd->service_tree.left = &cfqq->rb_node;
+		service_tree->left = &cfqq->rb_node;
 
 	cfqq->rb_key = rb_key;
 	rb_link_node(&cfqq->rb_node, parent, p);
-	rb_insert_color(&cfqq->rb_node, &cfqd->service_tree.rb);
+	rb_insert_color(&cfqq->rb_node, &service_tree->rb);
 }
 
 static struct cfq_queue *
@@ -646,6 +1021,7 @@ static void cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	BUG_ON(cfq_cfqq_on_rr(cfqq));
 	cfq_mark_cfqq_on_rr(cfqq);
 	cfqd->busy_queues++;
+	cfq_group_service_tree_add(cfqd, cfqq->cfqg);
 
 	cfq_resort_rr_list(cfqd, cfqq);
 }
@@ -661,12 +1037,13 @@ static void cfq_del_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfq_clear_cfqq_on_rr(cfqq);
 
 	if (!RB_EMPTY_NODE(&cfqq->rb_node))
-		cfq_rb_erase(&cfqq->rb_node, &cfqd->service_tree);
+		cfq_rb_erase(&cfqq->rb_node, &cfqq->cfqg->service_tree);
 	if (cfqq->p_root) {
 		rb_erase(&cfqq->p_node, cfqq->p_root);
 		cfqq->p_root = NULL;
 	}
 
+	cfq_group_service_tree_del(cfqd, cfqq->cfqg);
 	BUG_ON(!cfqd->busy_queues);
 	cfqd->busy_queues--;
 }
@@ -757,6 +1134,7 @@ static void cfq_activate_request(struct request_queue *q, struct request *rq)
 	cfqd->rq_in_driver[rq_is_sync(rq)]++;
 	cfq_log_cfqq(cfqd, RQ_CFQQ(rq), "activate rq, drv=%d",
 						rq_in_driver(cfqd));
+	set_io_start_time_ns(rq);
 
 	cfqd->last_position = blk_rq_pos(rq) + blk_rq_sectors(rq);
 }
@@ -861,6 +1239,7 @@ static void __cfq_set_active_queue(struct cfq_data *cfqd,
 {
 	if (cfqq) {
 		cfq_log_cfqq(cfqd, cfqq, "set_active");
+		cfqq->slice_start = jiffies;
 		cfqq->slice_end = 0;
 		cfqq->slice_dispatch = 0;
 
@@ -898,6 +1277,7 @@ __cfq_slice_expired(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 		cfq_log_cfqq(cfqd, cfqq, "resid=%ld", cfqq->slice_resid);
 	}
 
+	cfq_group_served(cfqd, cfqq->cfqg, cfqq);
 	cfq_resort_rr_list(cfqd, cfqq);
 
 	if (cfqq == cfqd->active_queue)
@@ -917,16 +1297,30 @@ static inline void cfq_slice_expired(struct cfq_data *cfqd, int timed_out)
 		__cfq_slice_expired(cfqd, cfqq, timed_out);
 }
 
+static struct cfq_group *cfq_get_next_cfqg(struct cfq_data *cfqd)
+{
+	struct cfq_rb_root *st = &cfqd->grp_service_tree;
+
+	if (RB_EMPTY_ROOT(&st->rb))
+		return NULL;
+
+	update_min_vdisktime(st);
+	return cfq_rb_first_group(st);
+}
+
 /*
- * Get next queue for service. Unless we have a queue preemption,
- * we'll simply select the first cfqq in the service tree.
+ * Get next queue for service. The group that has used the least disk time
+ * for its weight goes first. Unless we have a queue preemption, we'll
+ * simply select the first cfqq in that group's service tree.
  */
 static struct cfq_queue *cfq_get_next_queue(struct cfq_data *cfqd)
 {
-	if (RB_EMPTY_ROOT(&cfqd->service_tree.rb))
+	struct cfq_group *cfqg = cfq_get_next_cfqg(cfqd);
+
+	if (!cfqg)
 		return NULL;
 
-	return cfq_rb_first(&cfqd->service_tree);
+	return cfq_rb_first(&cfqg->service_tree);
 }
 
 /*
@@ -1041,6 +1435,10 @@ static struct cfq_queue *cfq_close_cooperator(struct cfq_data *cfqd,
 	if (!cfqq)
 		return NULL;
 
+	/* Jumping to a queue of another group would bypass its share */
+	if (cfqq->cfqg != cur_cfqq->cfqg)
+		return NULL;
+
 	if (cfq_cfqq_coop(cfqq))
 		return NULL;
 
@@ -1114,6 +1512,7 @@ static void cfq_dispatch_insert(struct request_queue *q, struct request *rq)
 	cfq_remove_request(rq);
 	cfqq->dispatched++;
 	elv_dispatch_sort(q, rq);
+	cfqg_stats_update_dispatch(cfqq->cfqg, rq);
 
 	if (cfq_cfqq_sync(cfqq))
 		cfqd->sync_flight++;
@@ -1232,7 +1631,7 @@ static int cfq_forced_dispatch(struct cfq_data *cfqd)
 	struct cfq_queue *cfqq;
 	int dispatched = 0;
 
-	while ((cfqq = cfq_rb_first(&cfqd->service_tree)) != NULL)
+	while ((cfqq = cfq_get_next_queue(cfqd)) != NULL)
 		dispatched += __cfq_forced_dispatch_cfqq(cfqq);
 
 	cfq_slice_expired(cfqd, 0);
@@ -1363,6 +1762,7 @@ static int cfq_dispatch_requests(struct request_queue *q, int force)
 static void cfq_put_queue(struct cfq_queue *cfqq)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
+	struct cfq_group *cfqg;
 
 	BUG_ON(atomic_read(&cfqq->ref) <= 0);
 
@@ -1373,6 +1773,7 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	BUG_ON(rb_first(&cfqq->sort_list));
 	BUG_ON(cfqq->allocated[READ] + cfqq->allocated[WRITE]);
 	BUG_ON(cfq_cfqq_on_rr(cfqq));
+	cfqg = cfqq->cfqg;
 
 	if (unlikely(cfqd->active_queue == cfqq)) {
 		__cfq_slice_expired(cfqd, cfqq, 0);
@@ -1380,6 +1781,7 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	}
 
 	kmem_cache_free(cfq_pool, cfqq);
+	cfq_put_cfqg(cfqg);
 }
 
 /*
@@ -1634,6 +2036,40 @@ static void cfq_ioc_set_ioprio(struct io_context *ioc)
 	ioc->ioprio_changed = 0;
 }
 
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+static void changed_cgroup(struct io_context *ioc, struct cfq_io_context *cic)
+{
+	struct cfq_data *cfqd = cic->key;
+	struct cfq_queue *sync_cfqq;
+	unsigned long flags;
+
+	if (unlikely(!cfqd))
+		return;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+
+	/*
+	 * Drop the reference to the sync queue. A new one will be set up in
+	 * the new group when the next request comes in. Async queues are
+	 * always in the root group.
+	 */
+	sync_cfqq = cic_to_cfqq(cic, 1);
+	if (sync_cfqq) {
+		cfq_log_cfqq(cfqd, sync_cfqq, "changed cgroup");
+		cic_set_cfqq(cic, NULL, 1);
+		cfq_put_queue(sync_cfqq);
+	}
+
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+static void cfq_ioc_set_cgroup(struct io_context *ioc)
+{
+	call_for_each_cic(ioc, changed_cgroup);
+	ioc->cgroup_changed = 0;
+}
+#endif  /* CONFIG_CFQ_GROUP_IOSCHED */
+
 static void cfq_init_cfqq(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 			  pid_t pid, int is_sync)
 {
@@ -1692,6 +2128,14 @@ retry:
 		if (cfqq) {
 			cfq_init_cfqq(cfqd, cfqq, current->pid, is_sync);
 			cfq_init_prio_data(cfqq, ioc);
+			/*
+			 * Async IO is mostly issued by the writeback threads on
+			 * behalf of whoever dirtied the pages, so charging it to
+			 * the submitter's cgroup would be meaningless. Async
+			 * queues are shared in the root group.
+			 */
+			cfq_link_cfqq_cfqg(cfqq, is_sync ? cfq_get_cfqg(cfqd) :
+							   &cfqd->root_group);
 			cfq_log_cfqq(cfqd, cfqq, "alloced");
 		} else
 			cfqq = &cfqd->oom_cfqq;
@@ -1883,6 +2327,10 @@ out:
 	if (unlikely(ioc->ioprio_changed))
 		cfq_ioc_set_ioprio(ioc);
 
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	if (unlikely(ioc->cgroup_changed))
+		cfq_ioc_set_cgroup(ioc);
+#endif
 	return cic;
 err_free:
 	cfq_cic_free(cic);
@@ -1983,6 +2431,13 @@ cfq_should_preempt(struct cfq_data *cfqd, struct cfq_queue *new_cfqq,
 	if (!cfqq)
 		return 0;
 
+	/*
+	 * Never preempt across groups, the group service tree alone decides
+	 * how disk time is shared between them.
+	 */
+	if (new_cfqq->cfqg != cfqq->cfqg)
+		return 0;
+
 	if (cfq_slice_used(cfqq))
 		return 1;
 
@@ -2105,6 +2560,7 @@ static void cfq_insert_request(struct request_queue *q, struct request *rq)
 	cfq_log_cfqq(cfqd, cfqq, "insert_request");
 	cfq_init_prio_data(cfqq, RQ_CIC(rq)->ioc);
 
+	set_start_time_ns(rq);
 	cfq_add_rq_rb(rq);
 
 	list_add_tail(&rq->queuelist, &cfqq->fifo);
@@ -2153,6 +2609,7 @@ static void cfq_completed_request(struct request_queue *q, struct request *rq)
 	WARN_ON(!cfqq->dispatched);
 	cfqd->rq_in_driver[sync]--;
 	cfqq->dispatched--;
+	cfqg_stats_update_completion(cfqq->cfqg, rq);
 
 	if (cfq_cfqq_sync(cfqq))
 		cfqd->sync_flight--;
@@ -2426,24 +2883,47 @@ static void cfq_exit_queue(struct elevator_queue *e)
 	}
 
 	cfq_put_async_queues(cfqd);
+	cfq_release_cfq_groups(cfqd);
 
 	spin_unlock_irq(q->queue_lock);
 
 	cfq_shutdown_timer_wq(cfqd);
 
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	/* Wait for the cgroup removal path to be done with cfqd */
+	synchronize_rcu();
+#endif
 	kfree(cfqd);
 }
 
 static void *cfq_init_queue(struct request_queue *q)
 {
 	struct cfq_data *cfqd;
+	struct cfq_group *cfqg;
 	int i;
 
 	cfqd = kmalloc_node(sizeof(*cfqd), GFP_KERNEL | __GFP_ZERO, q->node);
 	if (!cfqd)
 		return NULL;
 
-	cfqd->service_tree = CFQ_RB_ROOT;
+	cfqd->grp_service_tree = CFQ_RB_ROOT;
+
+	/*
+	 * The root group lives as long as cfqd, its initial reference is
+	 * never dropped.
+	 */
+	cfqg = &cfqd->root_group;
+	RB_CLEAR_NODE(&cfqg->rb_node);
+	cfqg->service_tree = CFQ_RB_ROOT;
+	atomic_set(&cfqg->ref, 1);
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	INIT_HLIST_HEAD(&cfqd->cfqg_list);
+	cfqg->weight = blkio_root_cgroup.weight;
+	blkiocg_add_blkio_group(&blkio_root_cgroup, &cfqg->blkg, cfqd, 0,
+				BLKIO_POLICY_PROP);
+#else
+	cfqg->weight = 2*BLKIO_WEIGHT_DEFAULT;
+#endif
 
 	/*
 	 * Not strictly needed (since RB_ROOT just clears the node and we
@@ -2460,6 +2940,7 @@ static void *cfq_init_queue(struct request_queue *q)
 	 */
 	cfq_init_cfqq(cfqd, &cfqd->oom_cfqq, 1, 0);
 	atomic_inc(&cfqd->oom_cfqq.ref);
+	cfq_link_cfqq_cfqg(&cfqd->oom_cfqq, &cfqd->root_group);
 
 	INIT_LIST_HEAD(&cfqd->cic_list);
 
@@ -2624,6 +3105,16 @@ static struct elevator_type iosched_cfq = {
 	.elevator_owner =	THIS_MODULE,
 };
 
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+static struct blkio_policy_type blkio_policy_cfq = {
+	.ops = {
+		.blkio_unlink_group_fn =	cfq_unlink_blkio_group,
+		.blkio_update_group_weight_fn =	cfq_update_blkio_group_weight,
+	},
+	.plid = BLKIO_POLICY_PROP,
+};
+#endif
+
 static int __init cfq_init(void)
 {
 	/*
@@ -2638,6 +3129,9 @@ static int __init cfq_init(void)
 		return -ENOMEM;
 
 	elv_register(&iosched_cfq);
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	blkio_policy_register(&blkio_policy_cfq);
+#endif
 
 	return 0;
 }
@@ -2646,6 +3140,10 @@ static void __exit cfq_exit(void)
 {
 	DECLARE_COMPLETION_ONSTACK(all_gone);
 	elv_unregister(&iosched_cfq);
+#ifdef CONFIG_CFQ_GROUP_IOSCHED
+	/* only now that no cfqd is left to be unlinked from a cgroup */
+	blkio_policy_unregister(&blkio_policy_cfq);
+#endif
 	ioc_gone = &all_gone;
 	/* ioc_gone's update must be visible before reading ioc_count */
 	smp_wmb();
@@ -0,0 +1,233 @@
+/*
+ * Contiguous Memory Allocator for DMA mapping framework
+ *
+ * One area of memory is reserved at boot with the bootmem allocator.  At
+ * core_initcall time it is released to the buddy allocator as MIGRATE_CMA
+ * pageblocks, which only movable allocations may use.  A bitmap tracks
+ * the pages handed out to drivers; alloc_contig_range() migrates whatever
+ * is living in the requested range before it is returned.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/gfp.h>
+#include <linux/bootmem.h>
+#include <linux/bitops.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/dma-contiguous.h>
+
+struct cma {
+	unsigned long	base_pfn;
+	unsigned long	count;
+	unsigned long	*bitmap;
+};
+
+static struct cma dma_contiguous_area;
+static DEFINE_MUTEX(cma_mutex);
+
+static unsigned long size_cmdline = -1;
+
+static int __init early_cma(char *p)
+{
+	size_cmdline = memparse(p, &p);
+	return 0;
+}
+early_param("cma", early_cma);
+
+/* Area base and size must cover whole pageblocks and MAX_ORDER blocks */
+static unsigned long cma_alignment(void)
+{
+	return PAGE_SIZE << max_t(unsigned int, MAX_ORDER - 1, pageblock_order);
+}
+
+/**
+ * dma_contiguous_reserve() - reserve the contiguous memory area
+ *
+ * Called by the architecture from its bootmem setup, once the bootmem
+ * allocator is running and before mem_init() releases free memory to the
+ * page allocator.
+ */
+void __init dma_contiguous_reserve(void)
+{
+	unsigned long size = CONFIG_CMA_SIZE_MBYTES << 20;
+	unsigned long align = cma_alignment();
+	void *base;
+
+	if (size_cmdline != -1)
+		size = size_cmdline;
+	if (!size)
+		return;
+	size = ALIGN(size, align);
+
+	base = __alloc_bootmem_nopanic(size, align, 0);
+	if (!base) {
+		printk(KERN_ERR "cma: failed to reserve %lu MiB\n",
+		       size >> 20);
+		return;
+	}
+
+	dma_contiguous_area.base_pfn = __pa(base) >> PAGE_SHIFT;
+	dma_contiguous_area.count = size >> PAGE_SHIFT;
+	printk(KERN_INFO "cma: reserved %lu MiB at 0x%08lx\n",
+	       size >> 20, (unsigned long)__pa(base));
+}
+
+static int __init cma_activate_area(void)
+{
+	struct cma *cma = &dma_contiguous_area;
+	unsigned long pfn = cma->base_pfn;
+	unsigned long i = cma->count >> pageblock_order;
+	struct zone *zone;
+
+	if (!cma->count)
+		return 0;
+
+	cma->bitmap = kzalloc(BITS_TO_LONGS(cma->count) * sizeof(long),
+			      GFP_KERNEL);
+	if (!cma->bitmap) {
+		cma->count = 0;
+		return -ENOMEM;
+	}
+
+	zone = page_zone(pfn_to_page(pfn));
+	do {
+		unsigned long base_pfn = pfn, j;
+
+		/* alloc_contig_range() works on a single zone only */
+		for (j = pageblock_nr_pages; j; --j, pfn++) {
+			WARN_ON_ONCE(!pfn_valid(pfn));
+			if (page_zone(pfn_to_page(pfn)) != zone)
+				goto fail;
+		}
+		init_cma_reserved_pageblock(pfn_to_page(base_pfn));
+	} while (--i);
+
+	return 0;
+
+fail:
+	printk(KERN_ERR "cma: area at pfn 0x%lx spans zones, disabled\n",
+	       cma->base_pfn);
+	kfree(cma->bitmap);
+	cma->count = 0;
+	return -EINVAL;
+}
+core_initcall(cma_activate_area);
+
+/* First run of @nr zero bits at or after @start, aligned to @align_mask + 1 */
+static unsigned long cma_find_zero_area(unsigned long *map,
+					unsigned long size, unsigned long start,
+					unsigned long nr,
+					unsigned long align_mask)
+{
+	unsigned long index, end, i;
+
+	index = start;
+	for (;;) {
+		index = find_next_zero_bit(map, size, index);
+		index = (index + align_mask) & ~align_mask;
+		end = index + nr;
+		if (end > size)
+			return size;
+		i = find_next_bit(map, end, index);
+		if (i >= end)
+			return index;
+		index = i + 1;
+	}
+}
+
+/**
+ * dma_alloc_from_contiguous() - allocate pages from the contiguous area
+ * @dev:   Pointer to device for which the allocation is performed.
+ * @count: Requested number of pages.
+ * @align: Requested alignment of the first page, as a page order.
+ *
+ * Returns the first of @count physically contiguous, order-0 refcounted
+ * pages, or NULL if the area is not set up or no range could be freed.
+ * May sleep.
+ */
+struct page *dma_alloc_from_contiguous(struct device *dev, int count,
+				       unsigned int align)
+{
+	struct cma *cma = &dma_contiguous_area;
+	unsigned long mask, pageno, start = 0;
+	struct page *page = NULL;
+	int ret;
+
+	if (!cma->count || count <= 0)
+		return NULL;
+
+	if (align > MAX_ORDER - 1)
+		align = MAX_ORDER - 1;
+	mask = (1UL << align) - 1;
+
+	mutex_lock(&cma_mutex);
+	for (;;) {
+		pageno = cma_find_zero_area(cma->bitmap, cma->count, start,
+					    count, mask);
+		if (pageno >= cma->count)
+			break;
+
+		ret = alloc_contig_range(cma->base_pfn + pageno,
+					 cma->base_pfn + pageno + count);
+		if (ret == 0) {
+			unsigned long i;
+
+			for (i = 0; i < count; i++)
+				__set_bit(pageno + i, cma->bitmap);
+			page = pfn_to_page(cma->base_pfn + pageno);
+			break;
+		} else if (ret != -EBUSY) {
+			break;
+		}
+		pr_debug("%s(): memory range at pfn 0x%lx is busy, retrying\n",
+			 __func__, cma->base_pfn + pageno);
+		/* try again with a bit different memory target */
+		start = pageno + mask + 1;
+	}
+	mutex_unlock(&cma_mutex);
+
+	return page;
+}
+EXPORT_SYMBOL_GPL(dma_alloc_from_contiguous);
+
+/**
+ * dma_release_from_contiguous() - release pages allocated from the area
+ * @dev:   Pointer to device which allocated the buffer.
+ * @pages: First page of the buffer.
+ * @count: Number of pages in the buffer.
+ *
+ * Returns false if @pages does not belong to the contiguous area, in
+ * which case the caller must free them itself.
+ */
+bool dma_release_from_contiguous(struct device *dev, struct page *pages,
+				 int count)
+{
+	struct cma *cma = &dma_contiguous_area;
+	unsigned long pfn, i;
+
+	if (!cma->count || !pages)
+		return false;
+
+	pfn = page_to_pfn(pages);
+	if (pfn < cma->base_pfn || pfn >= cma->base_pfn + cma->count)
+		return false;
+
+	VM_BUG_ON(pfn + count > cma->base_pfn + cma->count);
+
+	mutex_lock(&cma_mutex);
+	for (i = 0; i < count; i++)
+		__clear_bit(pfn - cma->base_pfn + i, cma->bitmap);
+	free_contig_range(pfn, count);
+	mutex_unlock(&cma_mutex);
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(dma_release_from_contiguous);
@@ -13,6 +13,7 @@
 #include <linux/moduleparam.h>
 #include <linux/major.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/gfp.h>
@@ -285,26 +286,29 @@ out:
 	return err;
 }
 
-static int brd_make_request(struct request_queue *q, struct bio *bio)
+/*
+ * Requests are served synchronously from the submitting context, so the
+ * hardware queue never has to be stopped.
+ */
+static int brd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq,
+			bool last)
 {
-	struct block_device *bdev = bio->bi_bdev;
-	struct brd_device *brd = bdev->bd_disk->private_data;
-	int rw;
+	struct brd_device *brd = hctx->queue->queuedata;
+	int rw = rq_data_dir(rq);
+	struct req_iterator iter;
 	struct bio_vec *bvec;
 	sector_t sector;
-	int i;
 	int err = -EIO;
 
-	sector = bio->bi_sector;
-	if (sector + (bio->bi_size >> SECTOR_SHIFT) >
-						get_capacity(bdev->bd_disk))
+	if (!blk_fs_request(rq))
 		goto out;
 
-	rw = bio_rw(bio);
-	if (rw == READA)
-		rw = READ;
+	sector = blk_rq_pos(rq);
+	if (sector + blk_rq_sectors(rq) > get_capacity(rq->rq_disk))
+		goto out;
 
-	bio_for_each_segment(bvec, bio, i) {
+	err = 0;
+	rq_for_each_segment(bvec, rq, iter) {
 		unsigned int len = bvec->bv_len;
 		err = brd_do_bvec(brd, bvec->bv_page, len,
 					bvec->bv_offset, rw, sector);
@@ -314,11 +318,23 @@ static int brd_make_request(struct request_queue *q, struct bio *bio)
 	}
 
 out:
-	bio_endio(bio, err);
+	blk_mq_end_io(rq, err);
 
-	return 0;
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
+static struct blk_mq_ops brd_mq_ops = {
+	.queue_rq	= brd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg brd_mq_reg = {
+	.ops		= &brd_mq_ops,
+	.queue_depth	= 64,
+	.numa_node	= -1,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
 #ifdef CONFIG_BLK_DEV_XIP
 static int brd_direct_access (struct block_device *bdev, sector_t sector,
 			void **kaddr, unsigned long *pfn)
@@ -390,12 +406,15 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static int rd_hw_queues = 1;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(rd_hw_queues, int, 0);
+MODULE_PARM_DESC(rd_hw_queues, "Number of hardware queues per RAM disk");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -429,10 +448,11 @@ static struct brd_device *brd_alloc(int i)
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+	brd_mq_reg.nr_hw_queues = rd_hw_queues;
+	brd->brd_queue = blk_mq_init_queue(&brd_mq_reg, brd);
 	if (!brd->brd_queue)
 		goto out_free_dev;
-	blk_queue_make_request(brd->brd_queue, brd_make_request);
+	brd->brd_queue->queuedata = brd;
 	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG, NULL);
 	blk_queue_max_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
@@ -1,6 +1,7 @@
 //#define DEBUG
 #include <linux/spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_ids.h>
@@ -11,6 +12,10 @@
 
 static int major, index;
 
+static unsigned int virtblk_queue_depth = 64;
+module_param_named(queue_depth, virtblk_queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "requests in flight per device");
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -21,35 +26,29 @@ struct virtio_blk
 	/* The disk structure for the kernel. */
 	struct gendisk *disk;
 
-	/* Request tracking. */
-	struct list_head reqs;
-
-	mempool_t *pool;
-
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
-
-	/* Scatterlist: can be too big for stack. */
-	struct scatterlist sg[/*sg_elems*/];
 };
 
+/* Lives behind each preallocated request, see blk_mq_rq_to_pdu() */
 struct virtblk_req
 {
-	struct list_head list;
 	struct request *req;
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
 	u8 status;
+
+	/* Scatterlist: can be too big for stack. */
+	struct scatterlist sg[/*sg_elems*/];
 };
 
-static void blk_done(struct virtqueue *vq)
+/* Complete the requests the host is done with. Called with vblk->lock held */
+static int __blk_done(struct virtio_blk *vblk)
 {
-	struct virtio_blk *vblk = vq->vdev->priv;
 	struct virtblk_req *vbr;
 	unsigned int len;
-	unsigned long flags;
+	int found = 0;
 
-	spin_lock_irqsave(&vblk->lock, flags);
 	while ((vbr = vblk->vq->vq_ops->get_buf(vblk->vq, &len)) != NULL) {
 		int error;
 
@@ -71,27 +70,48 @@ static void blk_done(struct virtqueue *vq)
 			vbr->req->errors = vbr->in_hdr.errors;
 		}
 
-		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
-		mempool_free(vbr, vblk->pool);
+		blk_mq_end_io(vbr->req, error);
+		found++;
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (found)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+	return found;
+}
+
+static void blk_done(struct virtqueue *vq)
+{
+	struct virtio_blk *vblk = vq->vdev->priv;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vblk->lock, flags);
+	__blk_done(vblk);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
-static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
-		   struct request *req)
+/* Reap completions from the used ring for a task polling in blk_poll() */
+static int virtblk_poll(struct blk_mq_hw_ctx *hctx)
 {
-	unsigned long num, out = 0, in = 0;
-	struct virtblk_req *vbr;
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	unsigned long flags;
+	int found;
 
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	spin_lock_irqsave(&vblk->lock, flags);
+	found = __blk_done(vblk);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return found;
+}
+
+static int virtio_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			   bool last)
+{
+	struct virtio_blk *vblk = hctx->queue->queuedata;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+	unsigned long num, out = 0, in = 0, flags;
+
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
-	vbr->req = req;
 	switch (req->cmd_type) {
 	case REQ_TYPE_FS:
 		vbr->out_hdr.type = 0;
@@ -119,7 +139,7 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	if (blk_barrier_rq(vbr->req))
 		vbr->out_hdr.type |= VIRTIO_BLK_T_BARRIER;
 
-	sg_set_buf(&vblk->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
+	sg_set_buf(&vbr->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
 
 	/*
 	 * If this is a packet command we need a couple of additional headers.
@@ -128,17 +148,17 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	 * inhdr with additional status information before the normal inhdr.
 	 */
 	if (blk_pc_request(vbr->req))
-		sg_set_buf(&vblk->sg[out++], vbr->req->cmd, vbr->req->cmd_len);
+		sg_set_buf(&vbr->sg[out++], vbr->req->cmd, vbr->req->cmd_len);
 
-	num = blk_rq_map_sg(q, vbr->req, vblk->sg + out);
+	num = blk_rq_map_sg(hctx->queue, vbr->req, vbr->sg + out);
 
 	if (blk_pc_request(vbr->req)) {
-		sg_set_buf(&vblk->sg[num + out + in++], vbr->req->sense, 96);
-		sg_set_buf(&vblk->sg[num + out + in++], &vbr->in_hdr,
+		sg_set_buf(&vbr->sg[num + out + in++], vbr->req->sense, 96);
+		sg_set_buf(&vbr->sg[num + out + in++], &vbr->in_hdr,
 			   sizeof(vbr->in_hdr));
 	}
 
-	sg_set_buf(&vblk->sg[num + out + in++], &vbr->status,
+	sg_set_buf(&vbr->sg[num + out + in++], &vbr->status,
 		   sizeof(vbr->status));
 
 	if (num) {
@@ -151,37 +171,45 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
-	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
-		mempool_free(vbr, vblk->pool);
-		return false;
+	spin_lock_irqsave(&vblk->lock, flags);
+	if (vblk->vq->vq_ops->add_buf(vblk->vq, vbr->sg, out, in, vbr) < 0) {
+		/* The ring is full: stop the queue until blk_done() restarts it */
+		vblk->vq->vq_ops->kick(vblk->vq);
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
 	}
 
-	list_add_tail(&vbr->list, &vblk->reqs);
-	return true;
+	if (last)
+		vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+	return BLK_MQ_RQ_QUEUE_OK;
 }
 
-static void do_virtblk_request(struct request_queue *q)
+static int virtblk_init_request(void *data, struct request *rq,
+				unsigned int hctx_idx, unsigned int request_idx)
 {
-	struct virtio_blk *vblk = q->queuedata;
-	struct request *req;
-	unsigned int issued = 0;
+	struct virtio_blk *vblk = data;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(rq);
 
-	while ((req = blk_peek_request(q)) != NULL) {
-		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+	vbr->req = rq;
+	sg_init_table(vbr->sg, vblk->sg_elems);
+	return 0;
+}
 
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_stop_queue(q);
-			break;
-		}
-		blk_start_request(req);
-		issued++;
-	}
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtio_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.init_request	= virtblk_init_request,
+	.poll		= virtblk_poll,
+};
 
-	if (issued)
-		vblk->vq->vq_ops->kick(vblk->vq);
-}
+static struct blk_mq_reg virtio_mq_reg = {
+	.ops		= &virtio_mq_ops,
+	.nr_hw_queues	= 1,
+	.numa_node	= -1,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
 
 /* return ATA identify data
  */
@@ -292,18 +320,15 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 
 	/* We need an extra sg elements at head and tail. */
 	sg_elems += 2;
-	vdev->priv = vblk = kmalloc(sizeof(*vblk) +
-				    sizeof(vblk->sg[0]) * sg_elems, GFP_KERNEL);
+	vdev->priv = vblk = kmalloc(sizeof(*vblk), GFP_KERNEL);
 	if (!vblk) {
 		err = -ENOMEM;
 		goto out;
 	}
 
-	INIT_LIST_HEAD(&vblk->reqs);
 	spin_lock_init(&vblk->lock);
 	vblk->vdev = vdev;
 	vblk->sg_elems = sg_elems;
-	sg_init_table(vblk->sg, vblk->sg_elems);
 
 	/* We expect one virtqueue, for output. */
 	vblk->vq = virtio_find_single_vq(vdev, blk_done, "requests");
@@ -312,20 +337,18 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_free_vblk;
 	}
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
-	if (!vblk->pool) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
-
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	virtio_mq_reg.queue_depth = virtblk_queue_depth;
+	virtio_mq_reg.cmd_size = sizeof(struct virtblk_req) +
+				 sizeof(struct scatterlist) * sg_elems;
+
+	vblk->disk->queue = blk_mq_init_queue(&virtio_mq_reg, vblk);
 	if (!vblk->disk->queue) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -409,8 +432,6 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 
 out_put_disk:
 	put_disk(vblk->disk);
-out_mempool:
-	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
 out_free_vblk:
@@ -423,16 +444,12 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 {
 	struct virtio_blk *vblk = vdev->priv;
 
-	/* Nothing should be pending. */
-	BUG_ON(!list_empty(&vblk->reqs));
-
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
 
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
-	mempool_destroy(vblk->pool);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk);
 }
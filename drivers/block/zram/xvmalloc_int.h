@@ -0,0 +1,82 @@
+/*
+ * xvmalloc memory allocator
+ *
+ * Internal definitions: every page of the pool is carved into blocks,
+ * each preceded by a XV_ALIGN byte header holding its size and the offset
+ * of the previous block in the same page.  Free blocks are kept on
+ * segregated free lists, one per FL_DELTA bytes of size, with a bitmap of
+ * the non-empty lists so that the next larger list is a find_next_bit()
+ * away.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _XV_MALLOC_INT_H_
+#define _XV_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+/* Each individual block is aligned and its header takes this much */
+#define XV_ALIGN_SHIFT	2
+#define XV_ALIGN	(1 << XV_ALIGN_SHIFT)
+#define XV_ALIGN_MASK	(XV_ALIGN - 1)
+
+/* This must be greater than sizeof(struct link_free) */
+#define XV_MIN_ALLOC_SIZE	32
+#define XV_MAX_ALLOC_SIZE	(PAGE_SIZE - XV_ALIGN - FL_DELTA)
+
+/* Free lists are separated by FL_DELTA bytes */
+#define FL_DELTA_SHIFT	3
+#define FL_DELTA	(1 << FL_DELTA_SHIFT)
+#define FL_DELTA_MASK	(FL_DELTA - 1)
+#define NUM_FREE_LISTS	((PAGE_SIZE - XV_ALIGN - XV_MIN_ALLOC_SIZE) \
+				/ FL_DELTA + 1)
+
+/* Low bits of block_header.prev hold the block flags */
+enum blockflags {
+	BLOCK_FREE,
+	PREV_FREE,
+	__NR_BLOCKFLAGS,
+};
+
+#define FLAGS_MASK	XV_ALIGN_MASK
+#define PREV_MASK	(~FLAGS_MASK)
+
+struct freelist_entry {
+	struct page *page;
+	u16 offset;
+	u16 pad;
+};
+
+/* Kept in the data area of a free block */
+struct link_free {
+	struct page *prev_page;
+	struct page *next_page;
+	u16 prev_offset;
+	u16 next_offset;
+};
+
+struct block_header {
+	union {
+		/* This common header must be XV_ALIGN bytes */
+		u8 common[XV_ALIGN];
+		struct {
+			u16 size;
+			u16 prev;
+		};
+	};
+	struct link_free link;
+};
+
+struct xv_pool {
+	unsigned long flbitmap[BITS_TO_LONGS(NUM_FREE_LISTS)];
+	struct freelist_entry freelist[NUM_FREE_LISTS];
+	u64 total_pages;	/* stats */
+	spinlock_t lock;
+};
+
+#endif
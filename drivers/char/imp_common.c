@@ -25,6 +25,7 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/dma-mapping.h>
+#include <linux/dma-contiguous.h>
 #include <linux/interrupt.h>
 #include <linux/uaccess.h>
 #include <linux/device.h>
@@ -85,6 +86,22 @@ int imp_common_mmap(struct file *filp,
 }
 EXPORT_SYMBOL(imp_common_mmap);
 
+/*
+ * Allocate a frame buffer.  Large buffers come from the contiguous
+ * memory area when there is one, so that they can still be found once
+ * the buddy allocator is fragmented.
+ */
+static unsigned long imp_common_alloc_pages(unsigned long bufsize)
+{
+	int order = get_order(bufsize);
+	struct page *page;
+
+	page = dma_alloc_from_contiguous(NULL, 1 << order, order);
+	if (page)
+		return (unsigned long)page_address(page);
+	return __get_free_pages(GFP_KERNEL | GFP_DMA, order);
+}
+
 /* inline function to free reserver pages  */
 static inline void imp_common_free_pages(unsigned long addr,
 					 unsigned long bufsize)
@@ -98,6 +115,9 @@ static inline void imp_common_free_pages(unsigned long addr,
 		addr += PAGE_SIZE;
 		size -= PAGE_SIZE;
 	}
+	if (dma_release_from_contiguous(NULL, virt_to_page(ad),
+					1 << get_order(bufsize)))
+		return;
 	free_pages(ad, get_order(bufsize));
 }
 
@@ -393,10 +413,7 @@ int imp_common_request_buffer(struct device *dev,
 			/* allocate memory for buffer of size passed
 			   in reqbufs */
 			buffer->offset =
-			    (unsigned long)__get_free_pages(GFP_KERNEL |
-							    GFP_DMA,
-							    get_order
-							    (reqbufs->size));
+			    imp_common_alloc_pages(reqbufs->size);
 
 			/* if memory allocation fails, return error */
 			if (!(buffer->offset)) {
@@ -569,10 +586,7 @@ int imp_common_request_buffer(struct device *dev,
 			/* allocate memory for buffer of size passed
 			   in reqbufs */
 			buffer->offset =
-			    (unsigned long)__get_free_pages(GFP_KERNEL |
-							    GFP_DMA,
-							    get_order
-							    (reqbufs->size));
+			    imp_common_alloc_pages(reqbufs->size);
 
 			/* if memory allocation fails, return error */
 			if (!(buffer->offset)) {
@@ -744,10 +758,7 @@ int imp_common_request_buffer(struct device *dev,
 			/* allocate memory for buffer of size passed
 			   in reqbufs */
 			buffer->offset =
-			    (unsigned long)__get_free_pages(GFP_KERNEL |
-							    GFP_DMA,
-							    get_order
-							    (reqbufs->size));
+			    imp_common_alloc_pages(reqbufs->size);
 
 			/* if memory allocation fails, return error */
 			if (!(buffer->offset)) {
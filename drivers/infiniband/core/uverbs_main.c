@@ -880,7 +880,7 @@ static int __init ib_uverbs_init(void)
 	return 0;
 
 out_mnt:
-	mntput(uverbs_event_mnt);
+	kern_unmount(uverbs_event_mnt);
 
 out_fs:
 	unregister_filesystem(&uverbs_event_fs);
@@ -898,7 +898,7 @@ out:
 static void __exit ib_uverbs_cleanup(void)
 {
 	ib_unregister_client(&uverbs_client);
-	mntput(uverbs_event_mnt);
+	kern_unmount(uverbs_event_mnt);
 	unregister_filesystem(&uverbs_event_fs);
 	class_destroy(uverbs_class);
 	unregister_chrdev_region(IB_UVERBS_BASE_DEV, IB_UVERBS_MAX_DEVICES);
@@ -216,7 +216,7 @@ static int __init capifs_init(void)
 static void __exit capifs_exit(void)
 {
 	unregister_filesystem(&capifs_fs_type);
-	mntput(capifs_mnt);
+	kern_unmount(capifs_mnt);
 }
 
 EXPORT_SYMBOL(capifs_new_ncci);
@@ -1186,6 +1186,7 @@ static int emac_net_tx_complete(struct emac_priv *priv,
 				int num_tokens, u32 ch)
 {
 	u32 cnt;
+	unsigned int pkts = 0, bytes = 0;
 
 	if (unlikely(num_tokens && netif_queue_stopped(priv->ndev)))
 		netif_start_queue(priv->ndev);
@@ -1193,10 +1194,13 @@ static int emac_net_tx_complete(struct emac_priv *priv,
 		struct sk_buff *skb = (struct sk_buff *)net_data_tokens[cnt];
 		if (skb == NULL)
 			continue;
-		priv->net_dev_stats.tx_packets++;
-		priv->net_dev_stats.tx_bytes += skb->len;
+		pkts++;
+		bytes += skb->len;
 		dev_kfree_skb_any(skb);
 	}
+	priv->net_dev_stats.tx_packets += pkts;
+	priv->net_dev_stats.tx_bytes += bytes;
+	netdev_completed_queue(priv->ndev, pkts, bytes);
 	return 0;
 }
 
@@ -1363,6 +1367,7 @@ static int emac_send(struct emac_priv *priv, struct emac_netpktobj *pkt, u32 ch)
 	struct emac_tx_bd __iomem *curr_bd;
 	struct emac_txch *txch;
 	struct emac_netbufobj *buf_list;
+	unsigned int bytes = pkt->pkt_length; /* skb->len, before padding */
 
 	txch = priv->txch[ch];
 	buf_list = pkt->buf_list;   /* get handle to the buffer array */
@@ -1394,6 +1399,9 @@ static int emac_send(struct emac_priv *priv, struct emac_netpktobj *pkt, u32 ch)
 	/* flush the packet from cache if write back cache is present */
 	BD_CACHE_WRITEBACK_INVALIDATE(curr_bd, EMAC_BD_LENGTH_FOR_CACHE);
 
+	/* account it before tx_lock lets emac_tx_bdproc() complete it */
+	netdev_sent_queue(priv->ndev, bytes);
+
 	/* send the packet */
 	if (txch->active_queue_head == NULL) {
 		txch->active_queue_head = curr_bd;
@@ -1503,6 +1511,7 @@ static void emac_dev_tx_timeout(struct net_device *ndev)
 	emac_stop_txch(priv, EMAC_DEF_TX_CH);
 	emac_cleanup_txch(priv, EMAC_DEF_TX_CH);
 	emac_init_txch(priv, EMAC_DEF_TX_CH);
+	netdev_reset_queue(ndev);
 	emac_write(EMAC_TXHDP(0), 0);
 	emac_write(EMAC_TXINTMASKSET, BIT(EMAC_DEF_TX_CH));
 	emac_int_enable(priv);
@@ -2407,6 +2416,7 @@ static int emac_dev_open(struct net_device *ndev)
 		dev_err(emac_dev, "DaVinci EMAC: emac_init_txch() failed");
 		return rc;
 	}
+	netdev_reset_queue(ndev);
 	rc = emac_init_rxch(priv, EMAC_DEF_RX_CH, priv->mac_addr);
 	if (0 != rc) {
 		dev_err(emac_dev, "DaVinci EMAC: emac_init_rxch() failed");
@@ -64,6 +64,9 @@ struct virtnet_info
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Reaps sent buffers after a send queue interrupt. */
+	struct tasklet_struct tx_tasklet;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 };
@@ -116,7 +119,33 @@ static void skb_xmit_done(struct virtqueue *svq)
 	svq->vq_ops->disable_cb(svq);
 
 	/* We were probably waiting for more output buffers. */
+	tasklet_schedule(&vi->tx_tasklet);
+}
+
+static unsigned int free_old_xmit_skbs(struct virtnet_info *vi);
+
+/*
+ * Completed buffers are normally reaped by the next start_xmit().  When
+ * the queue is stopped, by us or by its byte queue limit, there is no
+ * next start_xmit() until they are, so reap them here.  skb_xmit_done()
+ * left the callback disabled: while the queue stays stopped, turn it
+ * back on so that the next completion runs us again.
+ */
+static void xmit_tasklet(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+
+	netif_tx_lock(vi->dev);
+	free_old_xmit_skbs(vi);
 	netif_wake_queue(vi->dev);
+
+	while (netif_xmit_stopped(netdev_get_tx_queue(vi->dev, 0)) &&
+	       !vi->svq->vq_ops->enable_cb(vi->svq)) {
+		/* More just got used, free them then recheck. */
+		vi->svq->vq_ops->disable_cb(vi->svq);
+		free_old_xmit_skbs(vi);
+	}
+	netif_tx_unlock(vi->dev);
 }
 
 static void receive_skb(struct net_device *dev, struct sk_buff *skb,
@@ -447,15 +476,19 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int pkts = 0, bytes = 0;
 
 	while ((skb = vi->svq->vq_ops->get_buf(vi->svq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
 		__skb_unlink(skb, &vi->send);
-		vi->dev->stats.tx_bytes += skb->len;
-		vi->dev->stats.tx_packets++;
+		pkts++;
+		bytes += skb->len;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		kfree_skb(skb);
 	}
+	vi->dev->stats.tx_bytes += bytes;
+	vi->dev->stats.tx_packets += pkts;
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
@@ -534,6 +567,13 @@ again:
 	}
 
 	vi->svq->vq_ops->kick(vi->svq);
+	netdev_sent_queue(dev, skb->len);
+
+	/* Over the byte queue limit: ask for an interrupt to restart us. */
+	if (unlikely(netif_xmit_stopped(netdev_get_tx_queue(dev, 0))) &&
+	    !vi->svq->vq_ops->enable_cb(vi->svq))
+		tasklet_schedule(&vi->tx_tasklet);
+
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
 	nf_reset(skb);
@@ -884,6 +924,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 	vdev->priv = vi;
 	vi->pages = NULL;
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_tasklet, xmit_tasklet, (unsigned long)vi);
 
 	/* If we can receive ANY GSO packets, we must allocate large ones. */
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_TSO4)
@@ -943,6 +984,7 @@ unregister:
 	cancel_delayed_work_sync(&vi->refill);
 free_vqs:
 	vdev->config->del_vqs(vdev);
+	tasklet_kill(&vi->tx_tasklet);
 free:
 	free_netdev(dev);
 	return err;
@@ -955,6 +997,7 @@ static void virtnet_remove(struct virtio_device *vdev)
 
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
+	tasklet_kill(&vi->tx_tasklet);
 
 	/* Free our skbs in send and recv queues, if any. */
 	while ((skb = __skb_dequeue(&vi->recv)) != NULL) {
@@ -256,11 +256,13 @@ static inline int __simple_empty(struct dentry *dentry)
 	struct dentry *child;
 	int ret = 0;
 
+	spin_lock(&dentry->d_lock);
 	list_for_each_entry(child, &dentry->d_subdirs, d_u.d_child)
 		if (simple_positive(child))
 			goto out;
 	ret = 1;
 out:
+	spin_unlock(&dentry->d_lock);
 	return ret;
 }
 
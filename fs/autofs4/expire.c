@@ -93,19 +93,29 @@ done:
 /*
  * Calculate next entry in top down tree traversal.
  * From next_mnt in namespace.c - elegant.
+ *
+ * Called with dcache_lock held, which keeps the dentries in place; the
+ * children lists themselves are protected by the parent's d_lock.
  */
 static struct dentry *next_dentry(struct dentry *p, struct dentry *root)
 {
-	struct list_head *next = p->d_subdirs.next;
+	struct list_head *next;
+	struct dentry *parent;
 
+	spin_lock(&p->d_lock);
+	next = p->d_subdirs.next;
+	spin_unlock(&p->d_lock);
 	if (next == &p->d_subdirs) {
 		while (1) {
 			if (p == root)
 				return NULL;
+			parent = p->d_parent;
+			spin_lock(&parent->d_lock);
 			next = p->d_u.d_child.next;
-			if (next != &p->d_parent->d_subdirs)
+			spin_unlock(&parent->d_lock);
+			if (next != &parent->d_subdirs)
 				break;
-			p = p->d_parent;
+			p = parent;
 		}
 	}
 	return list_entry(next, struct dentry, d_u.d_child);
@@ -316,6 +326,7 @@ struct dentry *autofs4_expire_indirect(struct super_block *sb,
 	timeout = sbi->exp_timeout;
 
 	spin_lock(&dcache_lock);
+	spin_lock(&root->d_lock);
 	next = root->d_subdirs.next;
 
 	/* On exit from the loop expire is set to a dgot dentry
@@ -330,6 +341,7 @@ struct dentry *autofs4_expire_indirect(struct super_block *sb,
 		}
 
 		dentry = dget(dentry);
+		spin_unlock(&root->d_lock);
 		spin_unlock(&dcache_lock);
 
 		spin_lock(&sbi->fs_lock);
@@ -396,8 +408,10 @@ next:
 		spin_unlock(&sbi->fs_lock);
 		dput(dentry);
 		spin_lock(&dcache_lock);
+		spin_lock(&root->d_lock);
 		next = next->next;
 	}
+	spin_unlock(&root->d_lock);
 	spin_unlock(&dcache_lock);
 	return NULL;
 
@@ -409,7 +423,9 @@ found:
 	init_completion(&ino->expire_complete);
 	spin_unlock(&sbi->fs_lock);
 	spin_lock(&dcache_lock);
+	spin_lock(&expired->d_parent->d_lock);
 	list_move(&expired->d_parent->d_subdirs, &expired->d_u.d_child);
+	spin_unlock(&expired->d_parent->d_lock);
 	spin_unlock(&dcache_lock);
 	return expired;
 }
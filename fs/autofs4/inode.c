@@ -110,6 +110,7 @@ static void autofs4_force_release(struct autofs_sb_info *sbi)
 		return;
 
 	spin_lock(&dcache_lock);
+	spin_lock(&this_parent->d_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
 resume:
@@ -123,11 +124,14 @@ resume:
 		}
 
 		if (!list_empty(&dentry->d_subdirs)) {
+			spin_unlock(&this_parent->d_lock);
 			this_parent = dentry;
+			spin_lock(&this_parent->d_lock);
 			goto repeat;
 		}
 
 		next = next->next;
+		spin_unlock(&this_parent->d_lock);
 		spin_unlock(&dcache_lock);
 
 		DPRINTK("dentry %p %.*s",
@@ -135,20 +139,26 @@ resume:
 
 		dput(dentry);
 		spin_lock(&dcache_lock);
+		spin_lock(&this_parent->d_lock);
 	}
 
 	if (this_parent != sbi->sb->s_root) {
 		struct dentry *dentry = this_parent;
 
-		next = this_parent->d_u.d_child.next;
-		this_parent = this_parent->d_parent;
+		spin_unlock(&dentry->d_lock);
+		this_parent = dentry->d_parent;
+		spin_lock(&this_parent->d_lock);
+		next = dentry->d_u.d_child.next;
+		spin_unlock(&this_parent->d_lock);
 		spin_unlock(&dcache_lock);
 		DPRINTK("parent dentry %p %.*s",
 			dentry, (int)dentry->d_name.len, dentry->d_name.name);
 		dput(dentry);
 		spin_lock(&dcache_lock);
+		spin_lock(&this_parent->d_lock);
 		goto resume;
 	}
+	spin_unlock(&this_parent->d_lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -1152,7 +1152,7 @@ __getblk_slow(struct block_device *bdev, sector_t block, int size)
  * inode list.
  *
  * mark_buffer_dirty() is atomic.  It takes bh->b_page->mapping->private_lock,
- * mapping->tree_lock and the global inode_lock.
+ * mapping->tree_lock, inode->i_lock and the backing device's wb.list_lock.
  */
 void mark_buffer_dirty(struct buffer_head *bh)
 {
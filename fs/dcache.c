@@ -14,6 +14,36 @@
  * the dcache entry is deleted or garbage collected.
  */
 
+/*
+ * Locking:
+ *
+ * dcache_hash_bucket->lock protects:
+ *   - a dentry_hashtable chain and the d_hash of the dentries on it
+ * sb->s_anon_lock protects:
+ *   - the sb->s_anon list of disconnected (IS_ROOT but hashed) dentries
+ * sb->s_dentry_lru_lock protects:
+ *   - the sb->s_dentry_lru list, d_lru and sb->s_nr_dentry_unused
+ * dentry->d_lock protects:
+ *   - d_flags, d_name, d_seq and the d_count transition to and from zero
+ *   - the d_subdirs list of the dentry's children and their d_u.d_child
+ * dcache_lock protects:
+ *   - d_alias, i_dentry and d_inode
+ *   - d_parent: nobody may move or kill a dentry without it, so a
+ *     tree walker holding dcache_lock only needs the d_lock of the
+ *     directory it is currently scanning
+ *
+ * Ordering:
+ * dcache_lock
+ *   rename_lock
+ *     dentry->d_parent->d_lock
+ *       dentry->d_lock
+ *         dcache_hash_bucket->lock, sb->s_anon_lock
+ *         sb->s_dentry_lru_lock
+ *
+ * Anybody taking more than one d_lock holds dcache_lock, which is what
+ * makes the parent-before-child order safe against d_move().
+ */
+
 #include <linux/syscalls.h>
 #include <linux/string.h>
 #include <linux/mm.h>
@@ -58,15 +88,42 @@ static struct kmem_cache *dentry_cache __read_mostly;
 #define D_HASHBITS     d_hash_shift
 #define D_HASHMASK     d_hash_mask
 
+struct dcache_hash_bucket {
+	spinlock_t lock;
+	struct hlist_head head;
+};
+
 static unsigned int d_hash_mask __read_mostly;
 static unsigned int d_hash_shift __read_mostly;
-static struct hlist_head *dentry_hashtable __read_mostly;
+static struct dcache_hash_bucket *dentry_hashtable __read_mostly;
 
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+static struct percpu_counter nr_dentry __cacheline_aligned_in_smp;
+static struct percpu_counter nr_dentry_unused __cacheline_aligned_in_smp;
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+/*
+ * Handle nr_dentry sysctl
+ */
+int proc_nr_dentry(ctl_table *table, int write, void __user *buffer,
+		   size_t *lenp, loff_t *ppos)
+{
+	dentry_stat.nr_dentry = percpu_counter_sum_positive(&nr_dentry);
+	dentry_stat.nr_unused = percpu_counter_sum_positive(&nr_dentry_unused);
+	return proc_dointvec(table, write, buffer, lenp, ppos);
+}
+#else
+int proc_nr_dentry(ctl_table *table, int write, void __user *buffer,
+		   size_t *lenp, loff_t *ppos)
+{
+	return -ENOSYS;
+}
+#endif
+
 static void __d_free(struct dentry *dentry)
 {
 	WARN_ON(!list_empty(&dentry->d_alias));
@@ -82,8 +139,7 @@ static void d_callback(struct rcu_head *head)
 }
 
 /*
- * no dcache_lock, please.  The caller must decrement dentry_stat.nr_dentry
- * inside dcache_lock.
+ * no dcache_lock, please.  The caller must decrement nr_dentry.
  */
 static void d_free(struct dentry *dentry)
 {
@@ -108,6 +164,7 @@ static void dentry_iput(struct dentry * dentry)
 	if (inode) {
 		dentry->d_inode = NULL;
 		list_del_init(&dentry->d_alias);
+		dentry_rcuwalk_barrier(dentry);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
 		if (!inode->i_nlink)
@@ -123,37 +180,55 @@ static void dentry_iput(struct dentry * dentry)
 }
 
 /*
- * dentry_lru_(add|add_tail|del|del_init) must be called with dcache_lock held.
+ * The dentry_lru_* helpers take sb->s_dentry_lru_lock themselves, so they
+ * nest inside d_lock.  A dentry may sit on a private list of
+ * __shrink_dcache_sb() rather than on s_dentry_lru; it is still accounted
+ * as unused and the helpers treat it exactly the same.
  */
-static void dentry_lru_add(struct dentry *dentry)
+static void __dentry_lru_del(struct dentry *dentry)
 {
-	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-	dentry->d_sb->s_nr_dentry_unused++;
-	dentry_stat.nr_unused++;
+	list_del_init(&dentry->d_lru);
+	dentry->d_sb->s_nr_dentry_unused--;
+	percpu_counter_dec(&nr_dentry_unused);
 }
 
-static void dentry_lru_add_tail(struct dentry *dentry)
+static void dentry_lru_add(struct dentry *dentry)
 {
-	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-	dentry->d_sb->s_nr_dentry_unused++;
-	dentry_stat.nr_unused++;
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	if (list_empty(&dentry->d_lru)) {
+		list_add(&dentry->d_lru, &sb->s_dentry_lru);
+		sb->s_nr_dentry_unused++;
+		percpu_counter_inc(&nr_dentry_unused);
+	}
+	spin_unlock(&sb->s_dentry_lru_lock);
 }
 
-static void dentry_lru_del(struct dentry *dentry)
+static void dentry_lru_move_tail(struct dentry *dentry)
 {
-	if (!list_empty(&dentry->d_lru)) {
-		list_del(&dentry->d_lru);
-		dentry->d_sb->s_nr_dentry_unused--;
-		dentry_stat.nr_unused--;
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	if (list_empty(&dentry->d_lru)) {
+		list_add_tail(&dentry->d_lru, &sb->s_dentry_lru);
+		sb->s_nr_dentry_unused++;
+		percpu_counter_inc(&nr_dentry_unused);
+	} else {
+		list_move_tail(&dentry->d_lru, &sb->s_dentry_lru);
 	}
+	spin_unlock(&sb->s_dentry_lru_lock);
 }
 
-static void dentry_lru_del_init(struct dentry *dentry)
+static void dentry_lru_del(struct dentry *dentry)
 {
-	if (likely(!list_empty(&dentry->d_lru))) {
-		list_del_init(&dentry->d_lru);
-		dentry->d_sb->s_nr_dentry_unused--;
-		dentry_stat.nr_unused--;
+	struct super_block *sb = dentry->d_sb;
+
+	if (!list_empty(&dentry->d_lru)) {
+		spin_lock(&sb->s_dentry_lru_lock);
+		if (!list_empty(&dentry->d_lru))
+			__dentry_lru_del(dentry);
+		spin_unlock(&sb->s_dentry_lru_lock);
 	}
 }
 
@@ -161,7 +236,8 @@ static void dentry_lru_del_init(struct dentry *dentry)
  * d_kill - kill dentry and return parent
  * @dentry: dentry to kill
  *
- * The dentry must already be unhashed and removed from the LRU.
+ * The dentry must already be unhashed and removed from the LRU, and the
+ * caller must hold dcache_lock and dentry->d_lock.
  *
  * If this is the root of the dentry tree, return NULL.
  */
@@ -171,14 +247,27 @@ static struct dentry *d_kill(struct dentry *dentry)
 {
 	struct dentry *parent;
 
-	list_del(&dentry->d_u.d_child);
-	dentry_stat.nr_dentry--;	/* For d_free, below */
-	/*drops the locks, at that point nobody can reach this dentry */
-	dentry_iput(dentry);
-	if (IS_ROOT(dentry))
+	if (IS_ROOT(dentry)) {
 		parent = NULL;
-	else
+		list_del(&dentry->d_u.d_child);
+	} else {
 		parent = dentry->d_parent;
+		/*
+		 * The parent lock nests outside ours.  Nobody can take a new
+		 * reference to an unhashed dentry while we hold dcache_lock,
+		 * so it is safe to let go of d_lock and take both in order.
+		 */
+		if (!spin_trylock(&parent->d_lock)) {
+			spin_unlock(&dentry->d_lock);
+			spin_lock(&parent->d_lock);
+			spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED);
+		}
+		list_del(&dentry->d_u.d_child);
+		spin_unlock(&parent->d_lock);
+	}
+	percpu_counter_dec(&nr_dentry);	/* For d_free, below */
+	/*drops the locks, at that point nobody can reach this dentry */
+	dentry_iput(dentry);
 	d_free(dentry);
 	return parent;
 }
@@ -220,6 +309,29 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
+		return;
+
+	/*
+	 * The common case is a hashed dentry the filesystem has no opinion
+	 * about: it just goes on the LRU, and d_lock is all that needs.
+	 */
+	if (!(dentry->d_op && dentry->d_op->d_delete) && !d_unhashed(dentry)) {
+		if (list_empty(&dentry->d_lru)) {
+			dentry->d_flags |= DCACHE_REFERENCED;
+			dentry_lru_add(dentry);
+		}
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	/*
+	 * Otherwise the dentry may have to be killed, which needs dcache_lock
+	 * and that nests outside d_lock.  Take our reference back and redo
+	 * the final put in the right order.
+	 */
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -320,7 +432,7 @@ int d_invalidate(struct dentry * dentry)
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	dentry_lru_del_init(dentry);
+	dentry_lru_del(dentry);
 	return dentry;
 }
 
@@ -436,7 +548,7 @@ static void prune_one_dentry(struct dentry * dentry)
 
 		if (dentry->d_op && dentry->d_op->d_delete)
 			dentry->d_op->d_delete(dentry);
-		dentry_lru_del_init(dentry);
+		dentry_lru_del(dentry);
 		__d_drop(dentry);
 		dentry = d_kill(dentry);
 		spin_lock(&dcache_lock);
@@ -460,10 +572,10 @@ static void __shrink_dcache_sb(struct super_block *sb, int *count, int flags)
 
 	BUG_ON(!sb);
 	BUG_ON((flags & DCACHE_REFERENCED) && count == NULL);
-	spin_lock(&dcache_lock);
 	if (count != NULL)
 		/* called from prune_dcache() and shrink_dcache_parent() */
 		cnt = *count;
+	spin_lock(&sb->s_dentry_lru_lock);
 restart:
 	if (count == NULL)
 		list_splice_init(&sb->s_dentry_lru, &tmp);
@@ -473,7 +585,13 @@ restart:
 					struct dentry, d_lru);
 			BUG_ON(dentry->d_sb != sb);
 
-			spin_lock(&dentry->d_lock);
+			/* d_lock nests outside the LRU lock */
+			if (!spin_trylock(&dentry->d_lock)) {
+				spin_unlock(&sb->s_dentry_lru_lock);
+				cpu_relax();
+				spin_lock(&sb->s_dentry_lru_lock);
+				continue;
+			}
 			/*
 			 * If we are honouring the DCACHE_REFERENCED flag and
 			 * the dentry has this flag set, don't free it. Clear
@@ -491,13 +609,28 @@ restart:
 				if (!cnt)
 					break;
 			}
-			cond_resched_lock(&dcache_lock);
+			cond_resched_lock(&sb->s_dentry_lru_lock);
 		}
 	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+
+	/*
+	 * The dentries on tmp are still accounted as unused and the
+	 * dentry_lru_* helpers may take them off it behind our back, so
+	 * only look at the list with the LRU lock held.
+	 */
+	spin_lock(&dcache_lock);
+	spin_lock(&sb->s_dentry_lru_lock);
 	while (!list_empty(&tmp)) {
 		dentry = list_entry(tmp.prev, struct dentry, d_lru);
-		dentry_lru_del_init(dentry);
-		spin_lock(&dentry->d_lock);
+		if (!spin_trylock(&dentry->d_lock)) {
+			spin_unlock(&sb->s_dentry_lru_lock);
+			cpu_relax();
+			spin_lock(&sb->s_dentry_lru_lock);
+			continue;
+		}
+		__dentry_lru_del(dentry);
+		spin_unlock(&sb->s_dentry_lru_lock);
 		/*
 		 * We found an inuse dentry which was not removed from
 		 * the LRU because of laziness during lookup.  Do not free
@@ -505,19 +638,21 @@ restart:
 		 */
 		if (atomic_read(&dentry->d_count)) {
 			spin_unlock(&dentry->d_lock);
-			continue;
+		} else {
+			prune_one_dentry(dentry);
+			/* dentry->d_lock was dropped in prune_one_dentry() */
 		}
-		prune_one_dentry(dentry);
-		/* dentry->d_lock was dropped in prune_one_dentry() */
 		cond_resched_lock(&dcache_lock);
+		spin_lock(&sb->s_dentry_lru_lock);
 	}
+	spin_unlock(&dcache_lock);
 	if (count == NULL && !list_empty(&sb->s_dentry_lru))
 		goto restart;
 	if (count != NULL)
 		*count = cnt;
 	if (!list_empty(&referenced))
 		list_splice(&referenced, &sb->s_dentry_lru);
-	spin_unlock(&dcache_lock);
+	spin_unlock(&sb->s_dentry_lru_lock);
 }
 
 /**
@@ -533,13 +668,12 @@ static void prune_dcache(int count)
 {
 	struct super_block *sb;
 	int w_count;
-	int unused = dentry_stat.nr_unused;
+	int unused = percpu_counter_read_positive(&nr_dentry_unused);
 	int prune_ratio;
 	int pruned;
 
 	if (unused == 0 || count == 0)
 		return;
-	spin_lock(&dcache_lock);
 restart:
 	if (count >= unused)
 		prune_ratio = 1;
@@ -575,11 +709,9 @@ restart:
 		if (down_read_trylock(&sb->s_umount)) {
 			if ((sb->s_root != NULL) &&
 			    (!list_empty(&sb->s_dentry_lru))) {
-				spin_unlock(&dcache_lock);
 				__shrink_dcache_sb(sb, &w_count,
 						DCACHE_REFERENCED);
 				pruned -= w_count;
-				spin_lock(&dcache_lock);
 			}
 			up_read(&sb->s_umount);
 		}
@@ -595,7 +727,6 @@ restart:
 		}
 	}
 	spin_unlock(&sb_lock);
-	spin_unlock(&dcache_lock);
 }
 
 /**
@@ -625,7 +756,7 @@ static void shrink_dcache_for_umount_subtree(struct dentry *dentry)
 
 	/* detach this root from the system */
 	spin_lock(&dcache_lock);
-	dentry_lru_del_init(dentry);
+	dentry_lru_del(dentry);
 	__d_drop(dentry);
 	spin_unlock(&dcache_lock);
 
@@ -639,7 +770,7 @@ static void shrink_dcache_for_umount_subtree(struct dentry *dentry)
 			spin_lock(&dcache_lock);
 			list_for_each_entry(loop, &dentry->d_subdirs,
 					    d_u.d_child) {
-				dentry_lru_del_init(loop);
+				dentry_lru_del(loop);
 				__d_drop(loop);
 				cond_resched_lock(&dcache_lock);
 			}
@@ -707,15 +838,14 @@ static void shrink_dcache_for_umount_subtree(struct dentry *dentry)
 	}
 out:
 	/* several dentries were freed, need to correct nr_dentry */
-	spin_lock(&dcache_lock);
-	dentry_stat.nr_dentry -= detached;
-	spin_unlock(&dcache_lock);
+	percpu_counter_sub(&nr_dentry, detached);
 }
 
 /*
  * destroy the dentries attached to a superblock on unmounting
- * - we don't need to use dentry->d_lock, and only need dcache_lock when
- *   removing the dentry from the system lists and hashes because:
+ * - we don't need to use dentry->d_lock, and only need dcache_lock (plus the
+ *   hash and LRU locks the helpers take themselves) when removing the dentry
+ *   from the system lists and hashes because:
  *   - the superblock is detached from all mountings and open files, so the
  *     dentry trees will not be rearranged by the VFS
  *   - s_umount is write-locked, so the memory pressure shrinker will ignore
@@ -763,6 +893,7 @@ int have_submounts(struct dentry *parent)
 	spin_lock(&dcache_lock);
 	if (d_mountpoint(parent))
 		goto positive;
+	spin_lock(&this_parent->d_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
 resume:
@@ -771,10 +902,18 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 		/* Have we found a mount point ? */
-		if (d_mountpoint(dentry))
+		if (d_mountpoint(dentry)) {
+			spin_unlock(&this_parent->d_lock);
 			goto positive;
+		}
+		/*
+		 * dcache_lock keeps dentry where it is, so there is no need
+		 * to hand the lock over.
+		 */
 		if (!list_empty(&dentry->d_subdirs)) {
+			spin_unlock(&this_parent->d_lock);
 			this_parent = dentry;
+			spin_lock(&this_parent->d_lock);
 			goto repeat;
 		}
 	}
@@ -782,10 +921,15 @@ resume:
 	 * All done at this level ... ascend and resume the search.
 	 */
 	if (this_parent != parent) {
-		next = this_parent->d_u.d_child.next;
-		this_parent = this_parent->d_parent;
+		struct dentry *child = this_parent;
+
+		spin_unlock(&child->d_lock);
+		this_parent = child->d_parent;
+		spin_lock(&this_parent->d_lock);
+		next = child->d_u.d_child.next;
 		goto resume;
 	}
+	spin_unlock(&this_parent->d_lock);
 	spin_unlock(&dcache_lock);
 	return 0; /* No mount points found in tree */
 positive:
@@ -814,6 +958,7 @@ static int select_parent(struct dentry * parent)
 	int found = 0;
 
 	spin_lock(&dcache_lock);
+	spin_lock(&this_parent->d_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
 resume:
@@ -822,15 +967,18 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 
-		dentry_lru_del_init(dentry);
+		spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED);
 		/* 
 		 * move only zero ref count dentries to the end 
 		 * of the unused list for prune_dcache
 		 */
 		if (!atomic_read(&dentry->d_count)) {
-			dentry_lru_add_tail(dentry);
+			dentry_lru_move_tail(dentry);
 			found++;
+		} else {
+			dentry_lru_del(dentry);
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -844,7 +992,9 @@ resume:
 		 * Descend a level if the d_subdirs list is non-empty.
 		 */
 		if (!list_empty(&dentry->d_subdirs)) {
+			spin_unlock(&this_parent->d_lock);
 			this_parent = dentry;
+			spin_lock(&this_parent->d_lock);
 			goto repeat;
 		}
 	}
@@ -852,11 +1002,16 @@ resume:
 	 * All done at this level ... ascend and resume the search.
 	 */
 	if (this_parent != parent) {
-		next = this_parent->d_u.d_child.next;
-		this_parent = this_parent->d_parent;
+		struct dentry *child = this_parent;
+
+		spin_unlock(&child->d_lock);
+		this_parent = child->d_parent;
+		spin_lock(&this_parent->d_lock);
+		next = child->d_u.d_child.next;
 		goto resume;
 	}
 out:
+	spin_unlock(&this_parent->d_lock);
 	spin_unlock(&dcache_lock);
 	return found;
 }
@@ -896,7 +1051,8 @@ static int shrink_dcache_memory(int nr, gfp_t gfp_mask)
 			return -1;
 		prune_dcache(nr);
 	}
-	return (dentry_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
+	return (percpu_counter_read_positive(&nr_dentry_unused) / 100) *
+		sysctl_vfs_cache_pressure;
 }
 
 static struct shrinker dcache_shrinker = {
@@ -942,6 +1098,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -956,15 +1113,14 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	if (parent) {
 		dentry->d_parent = dget(parent);
 		dentry->d_sb = parent->d_sb;
+		spin_lock(&parent->d_lock);
+		list_add(&dentry->d_u.d_child, &parent->d_subdirs);
+		spin_unlock(&parent->d_lock);
 	} else {
 		INIT_LIST_HEAD(&dentry->d_u.d_child);
 	}
 
-	spin_lock(&dcache_lock);
-	if (parent)
-		list_add(&dentry->d_u.d_child, &parent->d_subdirs);
-	dentry_stat.nr_dentry++;
-	spin_unlock(&dcache_lock);
+	percpu_counter_inc(&nr_dentry);
 
 	return dentry;
 }
@@ -1108,7 +1264,7 @@ struct dentry * d_alloc_root(struct inode * root_inode)
 	return res;
 }
 
-static inline struct hlist_head *d_hash(struct dentry *parent,
+static inline struct dcache_hash_bucket *d_hash(struct dentry *parent,
 					unsigned long hash)
 {
 	hash += ((unsigned long) parent ^ GOLDEN_RATIO_PRIME) / L1_CACHE_BYTES;
@@ -1116,6 +1272,38 @@ static inline struct hlist_head *d_hash(struct dentry *parent,
 	return dentry_hashtable + (hash & D_HASHMASK);
 }
 
+/*
+ * A hashed IS_ROOT dentry is a disconnected one on sb->s_anon (see
+ * d_obtain_alias()); everything else lives in dentry_hashtable.  The
+ * caller holds d_lock, which keeps d_parent and the name hash stable.
+ */
+static spinlock_t *d_hash_lock(struct dentry *dentry)
+{
+	if (IS_ROOT(dentry))
+		return &dentry->d_sb->s_anon_lock;
+	return &d_hash(dentry->d_parent, dentry->d_name.hash)->lock;
+}
+
+/**
+ * __d_drop - drop a dentry
+ * @dentry: dentry to drop
+ *
+ * Same as d_drop(), for callers already holding dentry->d_lock.
+ */
+void __d_drop(struct dentry *dentry)
+{
+	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
+		spinlock_t *lock = d_hash_lock(dentry);
+
+		spin_lock(lock);
+		dentry->d_flags |= DCACHE_UNHASHED;
+		hlist_del_rcu(&dentry->d_hash);
+		spin_unlock(lock);
+		dentry_rcuwalk_barrier(dentry);
+	}
+}
+EXPORT_SYMBOL(__d_drop);
+
 /**
  * d_obtain_alias - find or allocate a dentry for a given inode
  * @inode: inode to allocate the dentry for
@@ -1171,7 +1359,9 @@ struct dentry *d_obtain_alias(struct inode *inode)
 	tmp->d_flags |= DCACHE_DISCONNECTED;
 	tmp->d_flags &= ~DCACHE_UNHASHED;
 	list_add(&tmp->d_alias, &inode->i_dentry);
-	hlist_add_head(&tmp->d_hash, &inode->i_sb->s_anon);
+	spin_lock(&tmp->d_sb->s_anon_lock);
+	hlist_add_head(&tmp->d_hash, &tmp->d_sb->s_anon);
+	spin_unlock(&tmp->d_sb->s_anon_lock);
 	spin_unlock(&tmp->d_lock);
 
 	spin_unlock(&dcache_lock);
@@ -1362,14 +1552,14 @@ struct dentry * __d_lookup(struct dentry * parent, struct qstr * name)
 	unsigned int len = name->len;
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
-	struct hlist_head *head = d_hash(parent,hash);
+	struct dcache_hash_bucket *b = d_hash(parent, hash);
 	struct dentry *found = NULL;
 	struct hlist_node *node;
 	struct dentry *dentry;
 
 	rcu_read_lock();
 	
-	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+	hlist_for_each_entry_rcu(dentry, node, &b->head, d_hash) {
 		struct qstr *qstr;
 
 		if (dentry->d_name.hash != hash)
@@ -1418,6 +1608,63 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without taking a reference
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seq: returns the d_seq value the match was found under
+ *
+ * This is the lookup used by the RCU path walk.  Nothing is locked and no
+ * reference is taken, so the result is only a hint: the caller must hold
+ * rcu_read_lock() and validate @seq with read_seqcount_retry() before it
+ * trusts anything it read from the dentry, and must recheck @seq under
+ * d_lock before pinning it.
+ *
+ * Parents with ->d_compare() are not supported; the caller is expected to
+ * fall back to __d_lookup() for those.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+			      unsigned *seq)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct dcache_hash_bucket *b = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, &b->head, d_hash) {
+		const unsigned char *tname;
+		unsigned int tlen;
+		unsigned int dseq;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+seqretry:
+		dseq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		tlen = dentry->d_name.len;
+		tname = dentry->d_name.name;
+		/*
+		 * d_move() may be switching the name under us; make sure the
+		 * length and pointer we compare belong together.  The name
+		 * storage itself stays valid until an RCU grace period passes.
+		 */
+		if (read_seqcount_retry(&dentry->d_seq, dseq)) {
+			cpu_relax();
+			goto seqretry;
+		}
+		if (tlen != len || memcmp(tname, str, len))
+			continue;
+		*seq = dseq;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1456,7 +1703,7 @@ out:
  
 int d_validate(struct dentry *dentry, struct dentry *dparent)
 {
-	struct hlist_head *base;
+	struct dcache_hash_bucket *b;
 	struct hlist_node *lhp;
 
 	/* Check whether the ptr might be valid at all.. */
@@ -1467,17 +1714,17 @@ int d_validate(struct dentry *dentry, struct dentry *dparent)
 		goto out;
 
 	spin_lock(&dcache_lock);
-	base = d_hash(dparent, dentry->d_name.hash);
-	hlist_for_each(lhp,base) { 
-		/* hlist_for_each_entry_rcu() not required for d_hash list
-		 * as it is parsed under dcache_lock
-		 */
+	b = d_hash(dparent, dentry->d_name.hash);
+	spin_lock(&b->lock);
+	hlist_for_each(lhp, &b->head) {
 		if (dentry == hlist_entry(lhp, struct dentry, d_hash)) {
+			spin_unlock(&b->lock);
 			__dget_locked(dentry);
 			spin_unlock(&dcache_lock);
 			return 1;
 		}
 	}
+	spin_unlock(&b->lock);
 	spin_unlock(&dcache_lock);
 out:
 	return 0;
@@ -1528,11 +1775,12 @@ void d_delete(struct dentry * dentry)
 	fsnotify_nameremove(dentry, isdir);
 }
 
-static void __d_rehash(struct dentry * entry, struct hlist_head *list)
+static void __d_rehash(struct dentry * entry, struct dcache_hash_bucket *b)
 {
-
+	spin_lock(&b->lock);
  	entry->d_flags &= ~DCACHE_UNHASHED;
- 	hlist_add_head_rcu(&entry->d_hash, list);
+ 	hlist_add_head_rcu(&entry->d_hash, &b->head);
+	spin_unlock(&b->lock);
 }
 
 static void _d_rehash(struct dentry * entry)
@@ -1549,11 +1797,9 @@ static void _d_rehash(struct dentry * entry)
  
 void d_rehash(struct dentry * entry)
 {
-	spin_lock(&dcache_lock);
 	spin_lock(&entry->d_lock);
 	_d_rehash(entry);
 	spin_unlock(&entry->d_lock);
-	spin_unlock(&dcache_lock);
 }
 
 /*
@@ -1620,6 +1866,32 @@ static void switch_names(struct dentry *dentry, struct dentry *target)
  * under the original name of the file that was moved on top of it.
  */
  
+/*
+ * Take the d_locks of both parents, then of dentry and target.  The
+ * caller holds dcache_lock, so nobody else can be taking more than one
+ * d_lock at the same time and the subclasses are only there to keep
+ * lockdep informed.
+ */
+static void dentry_lock_for_move(struct dentry *dentry, struct dentry *target)
+{
+	if (!IS_ROOT(dentry))
+		spin_lock(&dentry->d_parent->d_lock);
+	if (!IS_ROOT(target) && target->d_parent != dentry->d_parent)
+		spin_lock_nested(&target->d_parent->d_lock,
+				 DENTRY_D_LOCK_NESTED);
+	spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED_2);
+	spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED_3);
+}
+
+static void dentry_unlock_parents_for_move(struct dentry *old_parent,
+					   struct dentry *new_parent)
+{
+	if (new_parent && new_parent != old_parent)
+		spin_unlock(&new_parent->d_lock);
+	if (old_parent)
+		spin_unlock(&old_parent->d_lock);
+}
+
 /*
  * d_move_locked - move a dentry
  * @dentry: entry to move
@@ -1630,32 +1902,23 @@ static void switch_names(struct dentry *dentry, struct dentry *target)
  */
 static void d_move_locked(struct dentry * dentry, struct dentry * target)
 {
-	struct hlist_head *list;
+	struct dentry *old_parent, *new_parent;
 
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
-	write_seqlock(&rename_lock);
-	/*
-	 * XXXX: do we really need to take target->d_lock?
-	 */
-	if (target < dentry) {
-		spin_lock(&target->d_lock);
-		spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED);
-	} else {
-		spin_lock(&dentry->d_lock);
-		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
-	}
+	old_parent = IS_ROOT(dentry) ? NULL : dentry->d_parent;
+	new_parent = IS_ROOT(target) ? NULL : target->d_parent;
 
-	/* Move the dentry to the target hash queue, if on different bucket */
-	if (d_unhashed(dentry))
-		goto already_unhashed;
+	write_seqlock(&rename_lock);
+	dentry_lock_for_move(dentry, target);
 
-	hlist_del_rcu(&dentry->d_hash);
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
 
-already_unhashed:
-	list = d_hash(target->d_parent, target->d_name.hash);
-	__d_rehash(dentry, list);
+	/* Move the dentry to the target hash queue */
+	__d_drop(dentry);
+	__d_rehash(dentry, d_hash(target->d_parent, target->d_name.hash));
 
 	/* Unhash the target: dput() will then get rid of it */
 	__d_drop(target);
@@ -1680,6 +1943,9 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+	dentry_unlock_parents_for_move(old_parent, new_parent);
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1767,11 +2033,32 @@ out_err:
 
 /*
  * Prepare an anonymous dentry for life in the superblock's dentry tree as a
- * named dentry in place of the dentry to be replaced.
+ * named dentry in place of the dentry to be replaced.  Returns with
+ * anon->d_lock held.
  */
 static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
+	__acquires(anon->d_lock)
 {
 	struct dentry *dparent, *aparent;
+	struct dentry *locked_parent = NULL;
+
+	/*
+	 * anon is a disconnected root, so the only children list that
+	 * changes is that of dentry's parent.  As in d_move_locked(),
+	 * dcache_lock makes the order of the d_locks a lockdep matter only.
+	 */
+	if (!IS_ROOT(dentry)) {
+		locked_parent = dentry->d_parent;
+		spin_lock(&locked_parent->d_lock);
+	}
+	spin_lock_nested(&anon->d_lock, DENTRY_D_LOCK_NESTED);
+	spin_lock_nested(&dentry->d_lock, DENTRY_D_LOCK_NESTED_2);
+
+	/* anon leaves s_anon, it is rehashed under its new name by the caller */
+	__d_drop(anon);
+
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&anon->d_seq);
 
 	switch_names(dentry, anon);
 	swap(dentry->d_name.hash, anon->d_name.hash);
@@ -1793,6 +2080,12 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 	else
 		INIT_LIST_HEAD(&anon->d_u.d_child);
 
+	write_seqcount_end(&anon->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+	spin_unlock(&dentry->d_lock);
+	if (locked_parent)
+		spin_unlock(&locked_parent->d_lock);
+
 	anon->d_flags &= ~DCACHE_DISCONNECTED;
 }
 
@@ -1828,9 +2121,7 @@ struct dentry *d_materialise_unique(struct dentry *dentry, struct inode *inode)
 			/* Is this an anonymous mountpoint that we could splice
 			 * into our tree? */
 			if (IS_ROOT(alias)) {
-				spin_lock(&alias->d_lock);
 				__d_materialise_dentry(dentry, alias);
-				__d_drop(alias);
 				goto found;
 			}
 			/* Nope, but we must(!) avoid directory aliasing */
@@ -1909,7 +2200,7 @@ char *__d_path(const struct path *path, struct path *root,
 	char *end = buffer + buflen;
 	char *retval;
 
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	prepend(&end, &buflen, "\0", 1);
 	if (d_unlinked(dentry) &&
 		(prepend(&end, &buflen, " (deleted)", 10) != 0))
@@ -1945,7 +2236,7 @@ char *__d_path(const struct path *path, struct path *root,
 	}
 
 out:
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	return retval;
 
 global_root:
@@ -2176,6 +2467,7 @@ void d_genocide(struct dentry *root)
 	struct list_head *next;
 
 	spin_lock(&dcache_lock);
+	spin_lock(&this_parent->d_lock);
 repeat:
 	next = this_parent->d_subdirs.next;
 resume:
@@ -2186,17 +2478,24 @@ resume:
 		if (d_unhashed(dentry)||!dentry->d_inode)
 			continue;
 		if (!list_empty(&dentry->d_subdirs)) {
+			spin_unlock(&this_parent->d_lock);
 			this_parent = dentry;
+			spin_lock(&this_parent->d_lock);
 			goto repeat;
 		}
 		atomic_dec(&dentry->d_count);
 	}
 	if (this_parent != root) {
-		next = this_parent->d_u.d_child.next;
-		atomic_dec(&this_parent->d_count);
-		this_parent = this_parent->d_parent;
+		struct dentry *child = this_parent;
+
+		atomic_dec(&child->d_count);
+		spin_unlock(&child->d_lock);
+		this_parent = child->d_parent;
+		spin_lock(&this_parent->d_lock);
+		next = child->d_u.d_child.next;
 		goto resume;
 	}
+	spin_unlock(&this_parent->d_lock);
 	spin_unlock(&dcache_lock);
 }
 
@@ -2250,7 +2549,7 @@ static void __init dcache_init_early(void)
 
 	dentry_hashtable =
 		alloc_large_system_hash("Dentry cache",
-					sizeof(struct hlist_head),
+					sizeof(struct dcache_hash_bucket),
 					dhash_entries,
 					13,
 					HASH_EARLY,
@@ -2258,8 +2557,10 @@ static void __init dcache_init_early(void)
 					&d_hash_mask,
 					0);
 
-	for (loop = 0; loop < (1 << d_hash_shift); loop++)
-		INIT_HLIST_HEAD(&dentry_hashtable[loop]);
+	for (loop = 0; loop < (1 << d_hash_shift); loop++) {
+		spin_lock_init(&dentry_hashtable[loop].lock);
+		INIT_HLIST_HEAD(&dentry_hashtable[loop].head);
+	}
 }
 
 static void __init dcache_init(void)
@@ -2273,6 +2574,9 @@ static void __init dcache_init(void)
 	 */
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
+
+	percpu_counter_init(&nr_dentry, 0);
+	percpu_counter_init(&nr_dentry_unused, 0);
 	
 	register_shrinker(&dcache_shrinker);
 
@@ -2282,7 +2586,7 @@ static void __init dcache_init(void)
 
 	dentry_hashtable =
 		alloc_large_system_hash("Dentry cache",
-					sizeof(struct hlist_head),
+					sizeof(struct dcache_hash_bucket),
 					dhash_entries,
 					13,
 					0,
@@ -2290,8 +2594,10 @@ static void __init dcache_init(void)
 					&d_hash_mask,
 					0);
 
-	for (loop = 0; loop < (1 << d_hash_shift); loop++)
-		INIT_HLIST_HEAD(&dentry_hashtable[loop]);
+	for (loop = 0; loop < (1 << d_hash_shift); loop++) {
+		spin_lock_init(&dentry_hashtable[loop].lock);
+		INIT_HLIST_HEAD(&dentry_hashtable[loop].head);
+	}
 }
 
 /* SLAB cache for __getname() consumers */
@@ -12,6 +12,7 @@
 struct super_block;
 struct linux_binprm;
 struct path;
+struct inode;
 
 /*
  * block_dev.c
@@ -48,6 +49,16 @@ static inline int __sync_blockdev(struct block_device *bdev, int wait)
  */
 extern void __init chrdev_init(void);
 
+/*
+ * fs-writeback.c
+ */
+extern void inode_wb_list_del(struct inode *inode);
+
+/*
+ * inode.c
+ */
+extern int get_nr_dirty_inodes(void);
+
 /*
  * exec.c
  */
@@ -61,6 +72,7 @@ extern int copy_mount_string(const void __user *, char **);
 
 extern void free_vfsmnt(struct vfsmount *);
 extern struct vfsmount *alloc_vfsmnt(const char *);
+extern unsigned int mnt_get_count(struct vfsmount *);
 extern struct vfsmount *__lookup_mnt(struct vfsmount *, struct dentry *, int);
 extern void mnt_set_mountpoint(struct vfsmount *, struct dentry *,
 				struct vfsmount *);
@@ -465,6 +465,166 @@ ok:
 	return security_inode_permission(inode, MAY_EXEC);
 }
 
+/*
+ * Variant of exec_permission_lite() for the RCU path walk.  Nothing in
+ * here may block, so ->permission() and ->check_acl() are off limits,
+ * and so is the capability override (it has side effects and auditing).
+ * Returns 0 when search permission is granted by the mode bits alone,
+ * -EAGAIN when the caller must let the refcounted walk decide.
+ */
+static int exec_permission_rcu(struct inode *inode)
+{
+	umode_t mode = inode->i_mode;
+
+	if (inode->i_op->permission)
+		return -EAGAIN;
+
+	if (current_fsuid() == inode->i_uid)
+		mode >>= 6;
+	else {
+		if (IS_POSIXACL(inode) && (mode & S_IRWXG) &&
+		    inode->i_op->check_acl)
+			return -EAGAIN;
+		if (in_group_p(inode->i_gid))
+			mode >>= 3;
+	}
+
+	if (!(mode & MAY_EXEC))
+		return -EAGAIN;
+	if (security_inode_permission(inode, MAY_EXEC))
+		return -EAGAIN;
+	return 0;
+}
+
+/*
+ * Can the RCU path walk look at inodes of this superblock?  Only if
+ * nobody frees them without waiting for a grace period.
+ */
+static inline int rcu_walk_allowed(struct super_block *sb)
+{
+	return !sb->s_op->destroy_inode ||
+		(sb->s_type->fs_flags & FS_RCU_INODES);
+}
+
+/*
+ * RCU path walk.
+ *
+ * Resolve as many leading intermediate components of @*pname as we can
+ * without touching d_count or d_lock: every dentry we step through is
+ * validated against its d_seq instead, and only the dentry we stop at is
+ * pinned.  Anything out of the ordinary - "..", symlinks, mount points,
+ * ->d_hash/->d_compare/->d_revalidate, ->permission, ACLs, negative or
+ * missing dentries - simply ends the walk, and __link_path_walk() carries
+ * on from there with the refcounted walk.  The last component is always
+ * left to the refcounted walk, so LOOKUP_PARENT, LOOKUP_FOLLOW, intents
+ * and the like never need to know about us.
+ *
+ * On return nd->path.dentry is pinned (its old reference dropped if we
+ * moved) and @*pname points at the first unresolved component.
+ */
+static void link_path_walk_rcu(const char **pname, struct nameidata *nd)
+{
+	struct dentry *parent = nd->path.dentry;
+	struct inode *inode = parent->d_inode;
+	const char *name = *pname;
+	const char *resume = name;
+	unsigned int seq;
+
+	if (nd->flags & LOOKUP_REVAL)
+		return;
+	if (!rcu_walk_allowed(parent->d_sb))
+		return;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&parent->d_seq);
+	for (;;) {
+		struct dentry *dentry;
+		unsigned long hash;
+		struct qstr this;
+		unsigned int c;
+		unsigned int dseq;
+
+		if (exec_permission_rcu(inode))
+			break;
+
+		this.name = (const unsigned char *)name;
+		c = *(const unsigned char *)name;
+
+		hash = init_name_hash();
+		do {
+			name++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)name;
+		} while (c && (c != '/'));
+		this.len = name - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* the final component is done by the refcounted walk */
+		if (!c)
+			break;
+		while (*++name == '/');
+		if (!*name)
+			break;
+
+		if (this.name[0] == '.') {
+			if (this.len == 1) {
+				resume = name;
+				continue;
+			}
+			if (this.len == 2 && this.name[1] == '.')
+				break;
+		}
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			break;
+
+		dentry = __d_lookup_rcu(parent, &this, &dseq);
+		if (!dentry)
+			break;
+		/*
+		 * The parent must not have changed under us, or the
+		 * permission check above was done on the wrong inode.
+		 */
+		if (read_seqcount_retry(&parent->d_seq, seq))
+			break;
+		if (dentry->d_op && dentry->d_op->d_revalidate)
+			break;
+		if (d_mountpoint(dentry))
+			break;
+		inode = dentry->d_inode;
+		if (!inode || !inode->i_op->lookup)
+			break;
+
+		parent = dentry;
+		seq = dseq;
+		resume = name;
+	}
+
+	if (parent != nd->path.dentry) {
+		/*
+		 * Pin the dentry we stopped at.  Unhashing it, killing it or
+		 * changing its inode, name or parent all bump d_seq under
+		 * d_lock, so an unchanged d_seq here means it is still the
+		 * dentry we walked to and taking a reference is safe.
+		 */
+		spin_lock(&parent->d_lock);
+		if (read_seqcount_retry(&parent->d_seq, seq)) {
+			spin_unlock(&parent->d_lock);
+			rcu_read_unlock();
+			return;
+		}
+		atomic_inc(&parent->d_count);
+		spin_unlock(&parent->d_lock);
+		rcu_read_unlock();
+
+		dput(nd->path.dentry);
+		nd->path.dentry = parent;
+	} else
+		rcu_read_unlock();
+
+	*pname = resume;
+}
+
 /*
  * This is called when everything else fails, and we actually have
  * to go to the low-level filesystem to find out what we should do..
@@ -685,15 +845,15 @@ int follow_up(struct path *path)
 {
 	struct vfsmount *parent;
 	struct dentry *mountpoint;
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	parent = path->mnt->mnt_parent;
 	if (parent == path->mnt) {
-		spin_unlock(&vfsmount_lock);
+		vfsmount_read_unlock();
 		return 0;
 	}
 	mntget(parent);
 	mountpoint = dget(path->mnt->mnt_mountpoint);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	dput(path->dentry);
 	path->dentry = mountpoint;
 	mntput(path->mnt);
@@ -772,15 +932,15 @@ static __always_inline void follow_dotdot(struct nameidata *nd)
 			break;
 		}
 		spin_unlock(&dcache_lock);
-		spin_lock(&vfsmount_lock);
+		vfsmount_read_lock();
 		parent = nd->path.mnt->mnt_parent;
 		if (parent == nd->path.mnt) {
-			spin_unlock(&vfsmount_lock);
+			vfsmount_read_unlock();
 			break;
 		}
 		mntget(parent);
 		nd->path.dentry = dget(nd->path.mnt->mnt_mountpoint);
-		spin_unlock(&vfsmount_lock);
+		vfsmount_read_unlock();
 		dput(old);
 		mntput(nd->path.mnt);
 		nd->path.mnt = parent;
@@ -847,6 +1007,7 @@ static int __link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		goto return_reval;
 
+	link_path_walk_rcu(&name, nd);
 	inode = nd->path.dentry->d_inode;
 	if (nd->depth)
 		lookup_flags = LOOKUP_FOLLOW | (nd->flags & LOOKUP_CONTINUE);
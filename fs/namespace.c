@@ -37,8 +37,8 @@
 #define HASH_SHIFT ilog2(PAGE_SIZE / sizeof(struct list_head))
 #define HASH_SIZE (1UL << HASH_SHIFT)
 
-/* spinlock for vfsmount related operations, inplace of dcache_lock */
-__cacheline_aligned_in_smp DEFINE_SPINLOCK(vfsmount_lock);
+/* seqlock for vfsmount related operations, inplace of dcache_lock */
+__cacheline_aligned_in_smp DEFINE_SEQLOCK(vfsmount_lock);
 
 static int event;
 static DEFINE_IDA(mnt_id_ida);
@@ -71,11 +71,11 @@ static int mnt_alloc_id(struct vfsmount *mnt)
 
 retry:
 	ida_pre_get(&mnt_id_ida, GFP_KERNEL);
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	res = ida_get_new_above(&mnt_id_ida, mnt_id_start, &mnt->mnt_id);
 	if (!res)
 		mnt_id_start = mnt->mnt_id + 1;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	if (res == -EAGAIN)
 		goto retry;
 
@@ -85,11 +85,11 @@ retry:
 static void mnt_free_id(struct vfsmount *mnt)
 {
 	int id = mnt->mnt_id;
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	ida_remove(&mnt_id_ida, id);
 	if (mnt_id_start > id)
 		mnt_id_start = id;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 }
 
 /*
@@ -125,6 +125,68 @@ void mnt_release_group_id(struct vfsmount *mnt)
 	mnt->mnt_group_id = 0;
 }
 
+/*
+ * vfsmount lifetime:
+ *
+ * mnt_count is split per cpu.  While a mount is attached to a namespace
+ * (mnt_ns set) or is a kern_mount() (MNT_INTERNAL), that attachment owns
+ * a reference, so mntput() cannot be dropping the last one and only
+ * decrements its own cpu's counter under rcu_read_lock().  Whoever ends
+ * the attachment clears the indicator under vfsmount_lock and waits for
+ * a grace period before dropping the attachment's reference; from then
+ * on every mntput() takes vfsmount_lock before it decrements and sums the
+ * counters, which is exact because no fast path decrement can still be
+ * in flight.
+ *
+ * lookup_mnt() walks the mount hash without locks and validates what it
+ * found against the vfsmount_lock sequence count, so vfsmounts are only
+ * freed after a grace period.
+ */
+static inline void mnt_add_count(struct vfsmount *mnt, int n)
+{
+#ifdef CONFIG_SMP
+	preempt_disable();
+	per_cpu_ptr(mnt->mnt_pcp, smp_processor_id())->mnt_count += n;
+	preempt_enable();
+#else
+	preempt_disable();
+	mnt->mnt_count += n;
+	preempt_enable();
+#endif
+}
+
+static inline void mnt_set_count(struct vfsmount *mnt, int n)
+{
+#ifdef CONFIG_SMP
+	preempt_disable();
+	per_cpu_ptr(mnt->mnt_pcp, smp_processor_id())->mnt_count = n;
+	preempt_enable();
+#else
+	mnt->mnt_count = n;
+#endif
+}
+
+unsigned int mnt_get_count(struct vfsmount *mnt)
+{
+#ifdef CONFIG_SMP
+	unsigned int count = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu_ptr(mnt->mnt_pcp, cpu)->mnt_count;
+
+	return count;
+#else
+	return mnt->mnt_count;
+#endif
+}
+
+/* Does something other than the reference we hold keep @mnt alive? */
+static inline int mnt_is_attached(struct vfsmount *mnt)
+{
+	return mnt->mnt_ns || (mnt->mnt_flags & MNT_INTERNAL);
+}
+
 struct vfsmount *alloc_vfsmnt(const char *name)
 {
 	struct vfsmount *mnt = kmem_cache_zalloc(mnt_cache, GFP_KERNEL);
@@ -141,7 +203,12 @@ struct vfsmount *alloc_vfsmnt(const char *name)
 				goto out_free_id;
 		}
 
-		atomic_set(&mnt->mnt_count, 1);
+#ifdef CONFIG_SMP
+		mnt->mnt_pcp = alloc_percpu(struct mnt_pcp);
+		if (!mnt->mnt_pcp)
+			goto out_free_devname;
+#endif
+		mnt_set_count(mnt, 1);
 		INIT_LIST_HEAD(&mnt->mnt_hash);
 		INIT_LIST_HEAD(&mnt->mnt_child);
 		INIT_LIST_HEAD(&mnt->mnt_mounts);
@@ -150,13 +217,6 @@ struct vfsmount *alloc_vfsmnt(const char *name)
 		INIT_LIST_HEAD(&mnt->mnt_share);
 		INIT_LIST_HEAD(&mnt->mnt_slave_list);
 		INIT_LIST_HEAD(&mnt->mnt_slave);
-#ifdef CONFIG_SMP
-		mnt->mnt_writers = alloc_percpu(int);
-		if (!mnt->mnt_writers)
-			goto out_free_devname;
-#else
-		mnt->mnt_writers = 0;
-#endif
 	}
 	return mnt;
 
@@ -203,7 +263,7 @@ EXPORT_SYMBOL_GPL(__mnt_is_readonly);
 static inline void inc_mnt_writers(struct vfsmount *mnt)
 {
 #ifdef CONFIG_SMP
-	(*per_cpu_ptr(mnt->mnt_writers, smp_processor_id()))++;
+	per_cpu_ptr(mnt->mnt_pcp, smp_processor_id())->mnt_writers++;
 #else
 	mnt->mnt_writers++;
 #endif
@@ -212,7 +272,7 @@ static inline void inc_mnt_writers(struct vfsmount *mnt)
 static inline void dec_mnt_writers(struct vfsmount *mnt)
 {
 #ifdef CONFIG_SMP
-	(*per_cpu_ptr(mnt->mnt_writers, smp_processor_id()))--;
+	per_cpu_ptr(mnt->mnt_pcp, smp_processor_id())->mnt_writers--;
 #else
 	mnt->mnt_writers--;
 #endif
@@ -225,7 +285,7 @@ static unsigned int count_mnt_writers(struct vfsmount *mnt)
 	int cpu;
 
 	for_each_possible_cpu(cpu) {
-		count += *per_cpu_ptr(mnt->mnt_writers, cpu);
+		count += per_cpu_ptr(mnt->mnt_pcp, cpu)->mnt_writers;
 	}
 
 	return count;
@@ -344,7 +404,7 @@ static int mnt_make_readonly(struct vfsmount *mnt)
 {
 	int ret = 0;
 
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	mnt->mnt_flags |= MNT_WRITE_HOLD;
 	/*
 	 * After storing MNT_WRITE_HOLD, we'll read the counters. This store
@@ -378,15 +438,15 @@ static int mnt_make_readonly(struct vfsmount *mnt)
 	 */
 	smp_wmb();
 	mnt->mnt_flags &= ~MNT_WRITE_HOLD;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	return ret;
 }
 
 static void __mnt_unmake_readonly(struct vfsmount *mnt)
 {
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	mnt->mnt_flags &= ~MNT_READONLY;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 }
 
 void simple_set_mnt(struct vfsmount *mnt, struct super_block *sb)
@@ -397,16 +457,23 @@ void simple_set_mnt(struct vfsmount *mnt, struct super_block *sb)
 
 EXPORT_SYMBOL(simple_set_mnt);
 
-void free_vfsmnt(struct vfsmount *mnt)
+static void free_vfsmnt_rcu(struct rcu_head *head)
 {
+	struct vfsmount *mnt = container_of(head, struct vfsmount, mnt_rcu);
+
 	kfree(mnt->mnt_devname);
-	mnt_free_id(mnt);
 #ifdef CONFIG_SMP
-	free_percpu(mnt->mnt_writers);
+	free_percpu(mnt->mnt_pcp);
 #endif
 	kmem_cache_free(mnt_cache, mnt);
 }
 
+void free_vfsmnt(struct vfsmount *mnt)
+{
+	mnt_free_id(mnt);
+	call_rcu(&mnt->mnt_rcu, free_vfsmnt_rcu);
+}
+
 /*
  * find the first or last mount at @dentry on vfsmount @mnt depending on
  * @dir. If @dir is set return the first mount else return the last mount.
@@ -432,6 +499,58 @@ struct vfsmount *__lookup_mnt(struct vfsmount *mnt, struct dentry *dentry,
 	return found;
 }
 
+/*
+ * Lockless __lookup_mnt(@mnt, @dentry, 1), called under rcu_read_lock().
+ * Writers may move a vfsmount we are standing on to another list, so the
+ * sequence count is rechecked before every step; -EAGAIN means the caller
+ * has to start over.
+ */
+static struct vfsmount *__lookup_mnt_rcu(struct vfsmount *mnt,
+					 struct dentry *dentry, unsigned seq)
+{
+	struct list_head *head = mount_hashtable + hash(mnt, dentry);
+	struct list_head *tmp;
+
+	for (tmp = rcu_dereference(head->next); ;
+	     tmp = rcu_dereference(tmp->next)) {
+		struct vfsmount *p;
+
+		if (read_seqretry(&vfsmount_lock, seq))
+			return ERR_PTR(-EAGAIN);
+		if (tmp == head)
+			return NULL;
+		p = list_entry(tmp, struct vfsmount, mnt_hash);
+		if (p->mnt_parent == mnt && p->mnt_mountpoint == dentry)
+			return p;
+	}
+}
+
+/*
+ * Take a reference on a vfsmount found by __lookup_mnt_rcu() under
+ * sequence count @seq.  Returns 0 on success.  If a writer got in the way
+ * we return 1 when the reference could be dropped right here, or -1 when
+ * the caller has to mntput() it outside the RCU read side section.
+ */
+static int legitimize_mnt(struct vfsmount *mnt, unsigned seq)
+{
+	mnt_add_count(mnt, 1);
+	smp_mb();
+	if (likely(!read_seqretry(&vfsmount_lock, seq)))
+		return 0;
+	/*
+	 * It may have been unhashed and lost its last reference meanwhile,
+	 * in which case our increment must not lead to a second free.
+	 */
+	vfsmount_write_lock();
+	if (unlikely(mnt->mnt_flags & MNT_DOOMED)) {
+		mnt_add_count(mnt, -1);
+		vfsmount_write_unlock();
+		return 1;
+	}
+	vfsmount_write_unlock();
+	return -1;
+}
+
 /*
  * lookup_mnt increments the ref count before returning
  * the vfsmount struct.
@@ -439,10 +558,27 @@ struct vfsmount *__lookup_mnt(struct vfsmount *mnt, struct dentry *dentry,
 struct vfsmount *lookup_mnt(struct path *path)
 {
 	struct vfsmount *child_mnt;
-	spin_lock(&vfsmount_lock);
-	if ((child_mnt = __lookup_mnt(path->mnt, path->dentry, 1)))
-		mntget(child_mnt);
-	spin_unlock(&vfsmount_lock);
+	unsigned seq;
+	int ret;
+
+	rcu_read_lock();
+again:
+	seq = read_seqbegin(&vfsmount_lock);
+	child_mnt = __lookup_mnt_rcu(path->mnt, path->dentry, seq);
+	if (IS_ERR(child_mnt))
+		goto again;
+	if (child_mnt) {
+		ret = legitimize_mnt(child_mnt, seq);
+		if (ret > 0)
+			goto again;
+		if (ret < 0) {
+			rcu_read_unlock();
+			mntput(child_mnt);
+			rcu_read_lock();
+			goto again;
+		}
+	}
+	rcu_read_unlock();
 	return child_mnt;
 }
 
@@ -561,7 +697,7 @@ static struct vfsmount *clone_mnt(struct vfsmount *old, struct dentry *root,
 				goto out_free;
 		}
 
-		mnt->mnt_flags = old->mnt_flags;
+		mnt->mnt_flags = old->mnt_flags & ~MNT_INTERNAL;
 		atomic_inc(&sb->s_active);
 		mnt->mnt_sb = sb;
 		mnt->mnt_root = dget(root);
@@ -606,7 +742,7 @@ static inline void __mntput(struct vfsmount *mnt)
 	 * to make r/w->r/o transitions.
 	 */
 	/*
-	 * atomic_dec_and_lock() used to deal with ->mnt_count decrements
+	 * vfsmount_lock taken by mntput_no_expire() to sum up ->mnt_count
 	 * provides barriers, so count_mnt_writers() below is safe.  AV
 	 */
 	WARN_ON(count_mnt_writers(mnt));
@@ -618,40 +754,91 @@ static inline void __mntput(struct vfsmount *mnt)
 void mntput_no_expire(struct vfsmount *mnt)
 {
 repeat:
-	if (atomic_dec_and_lock(&mnt->mnt_count, &vfsmount_lock)) {
-		if (likely(!mnt->mnt_pinned)) {
-			spin_unlock(&vfsmount_lock);
-			__mntput(mnt);
-			return;
-		}
-		atomic_add(mnt->mnt_pinned + 1, &mnt->mnt_count);
-		mnt->mnt_pinned = 0;
-		spin_unlock(&vfsmount_lock);
-		acct_auto_close_mnt(mnt);
-		security_sb_umount_close(mnt);
-		goto repeat;
+	rcu_read_lock();
+	if (likely(mnt_is_attached(mnt))) {
+		/* the attachment's reference is still there */
+		mnt_add_count(mnt, -1);
+		rcu_read_unlock();
+		return;
 	}
+	/*
+	 * Detached: decrement and sum under the lock, so that two final
+	 * mntput()s cannot both see zero, and no decrement on one cpu can
+	 * slip in between the sum of the others.
+	 */
+	vfsmount_write_lock();
+	rcu_read_unlock();
+	mnt_add_count(mnt, -1);
+	if (mnt_get_count(mnt)) {
+		vfsmount_write_unlock();
+		return;
+	}
+	if (unlikely(mnt->mnt_flags & MNT_DOOMED)) {
+		vfsmount_write_unlock();
+		return;
+	}
+	if (likely(!mnt->mnt_pinned)) {
+		mnt->mnt_flags |= MNT_DOOMED;
+		vfsmount_write_unlock();
+		__mntput(mnt);
+		return;
+	}
+	mnt_add_count(mnt, mnt->mnt_pinned + 1);
+	mnt->mnt_pinned = 0;
+	vfsmount_write_unlock();
+	acct_auto_close_mnt(mnt);
+	security_sb_umount_close(mnt);
+	goto repeat;
 }
 
 EXPORT_SYMBOL(mntput_no_expire);
 
+struct vfsmount *mntget(struct vfsmount *mnt)
+{
+	if (mnt)
+		mnt_add_count(mnt, 1);
+	return mnt;
+}
+
+EXPORT_SYMBOL(mntget);
+
+/**
+ * kern_unmount - drop the reference returned by kern_mount()
+ * @mnt: the internal mount
+ *
+ * kern_mount()ed vfsmounts keep their reference count per cpu with no
+ * locking; this ends that and drops the reference, which may free @mnt.
+ */
+void kern_unmount(struct vfsmount *mnt)
+{
+	if (mnt && !IS_ERR(mnt)) {
+		vfsmount_write_lock();
+		mnt->mnt_flags &= ~MNT_INTERNAL;
+		vfsmount_write_unlock();
+		synchronize_rcu();
+		mntput(mnt);
+	}
+}
+
+EXPORT_SYMBOL(kern_unmount);
+
 void mnt_pin(struct vfsmount *mnt)
 {
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	mnt->mnt_pinned++;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 }
 
 EXPORT_SYMBOL(mnt_pin);
 
 void mnt_unpin(struct vfsmount *mnt)
 {
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	if (mnt->mnt_pinned) {
-		atomic_inc(&mnt->mnt_count);
+		mnt_add_count(mnt, 1);
 		mnt->mnt_pinned--;
 	}
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 }
 
 EXPORT_SYMBOL(mnt_unpin);
@@ -934,12 +1121,12 @@ int may_umount_tree(struct vfsmount *mnt)
 	int minimum_refs = 0;
 	struct vfsmount *p;
 
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	for (p = mnt; p; p = next_mnt(p, mnt)) {
-		actual_refs += atomic_read(&p->mnt_count);
+		actual_refs += mnt_get_count(p);
 		minimum_refs += 2;
 	}
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 
 	if (actual_refs > minimum_refs)
 		return 0;
@@ -965,10 +1152,10 @@ EXPORT_SYMBOL(may_umount_tree);
 int may_umount(struct vfsmount *mnt)
 {
 	int ret = 1;
-	spin_lock(&vfsmount_lock);
+	vfsmount_read_lock();
 	if (propagate_mount_busy(mnt, 2))
 		ret = 0;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	return ret;
 }
 
@@ -977,19 +1164,26 @@ EXPORT_SYMBOL(may_umount);
 void release_mounts(struct list_head *head)
 {
 	struct vfsmount *mnt;
+
+	/*
+	 * umount_tree() cleared ->mnt_ns; wait for mntput() fast paths that
+	 * still saw it set before we drop the references the tree owned.
+	 */
+	if (!list_empty(head))
+		synchronize_rcu();
 	while (!list_empty(head)) {
 		mnt = list_first_entry(head, struct vfsmount, mnt_hash);
 		list_del_init(&mnt->mnt_hash);
 		if (mnt->mnt_parent != mnt) {
 			struct dentry *dentry;
 			struct vfsmount *m;
-			spin_lock(&vfsmount_lock);
+			vfsmount_write_lock();
 			dentry = mnt->mnt_mountpoint;
 			m = mnt->mnt_parent;
 			mnt->mnt_mountpoint = mnt->mnt_root;
 			mnt->mnt_parent = mnt;
 			m->mnt_ghosts--;
-			spin_unlock(&vfsmount_lock);
+			vfsmount_write_unlock();
 			dput(dentry);
 			mntput(m);
 		}
@@ -1044,7 +1238,7 @@ static int do_umount(struct vfsmount *mnt, int flags)
 		    flags & (MNT_FORCE | MNT_DETACH))
 			return -EINVAL;
 
-		if (atomic_read(&mnt->mnt_count) != 2)
+		if (mnt_get_count(mnt) != 2)
 			return -EBUSY;
 
 		if (!xchg(&mnt->mnt_expiry_mark, 1))
@@ -1087,7 +1281,7 @@ static int do_umount(struct vfsmount *mnt, int flags)
 	}
 
 	down_write(&namespace_sem);
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	event++;
 
 	if (!(flags & MNT_DETACH))
@@ -1099,7 +1293,7 @@ static int do_umount(struct vfsmount *mnt, int flags)
 			umount_tree(mnt, 1, &umount_list);
 		retval = 0;
 	}
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	if (retval)
 		security_sb_umount_busy(mnt);
 	up_write(&namespace_sem);
@@ -1206,19 +1400,19 @@ struct vfsmount *copy_tree(struct vfsmount *mnt, struct dentry *dentry,
 			q = clone_mnt(p, p->mnt_root, flag);
 			if (!q)
 				goto Enomem;
-			spin_lock(&vfsmount_lock);
+			vfsmount_write_lock();
 			list_add_tail(&q->mnt_list, &res->mnt_list);
 			attach_mnt(q, &path);
-			spin_unlock(&vfsmount_lock);
+			vfsmount_write_unlock();
 		}
 	}
 	return res;
 Enomem:
 	if (res) {
 		LIST_HEAD(umount_list);
-		spin_lock(&vfsmount_lock);
+		vfsmount_write_lock();
 		umount_tree(res, 0, &umount_list);
-		spin_unlock(&vfsmount_lock);
+		vfsmount_write_unlock();
 		release_mounts(&umount_list);
 	}
 	return NULL;
@@ -1237,9 +1431,9 @@ void drop_collected_mounts(struct vfsmount *mnt)
 {
 	LIST_HEAD(umount_list);
 	down_write(&namespace_sem);
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	umount_tree(mnt, 0, &umount_list);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	up_write(&namespace_sem);
 	release_mounts(&umount_list);
 }
@@ -1357,7 +1551,7 @@ static int attach_recursive_mnt(struct vfsmount *source_mnt,
 			set_mnt_shared(p);
 	}
 
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	if (parent_path) {
 		detach_mnt(source_mnt, parent_path);
 		attach_mnt(source_mnt, path);
@@ -1371,7 +1565,7 @@ static int attach_recursive_mnt(struct vfsmount *source_mnt,
 		list_del_init(&child->mnt_hash);
 		commit_tree(child);
 	}
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	return 0;
 
  out_cleanup_ids:
@@ -1433,10 +1627,10 @@ static int do_change_type(struct path *path, int flag)
 			goto out_unlock;
 	}
 
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	for (m = mnt; m; m = (recurse ? next_mnt(m, mnt) : NULL))
 		change_mnt_propagation(m, type);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 
  out_unlock:
 	up_write(&namespace_sem);
@@ -1480,9 +1674,9 @@ static int do_loopback(struct path *path, char *old_name,
 	err = graft_tree(mnt, path);
 	if (err) {
 		LIST_HEAD(umount_list);
-		spin_lock(&vfsmount_lock);
+		vfsmount_write_lock();
 		umount_tree(mnt, 0, &umount_list);
-		spin_unlock(&vfsmount_lock);
+		vfsmount_write_unlock();
 		release_mounts(&umount_list);
 	}
 
@@ -1540,9 +1734,9 @@ static int do_remount(struct path *path, int flags, int mnt_flags,
 	if (!err) {
 		security_sb_post_remount(path->mnt, flags, data);
 
-		spin_lock(&vfsmount_lock);
+		vfsmount_write_lock();
 		touch_mnt_namespace(path->mnt->mnt_ns);
-		spin_unlock(&vfsmount_lock);
+		vfsmount_write_unlock();
 	}
 	return err;
 }
@@ -1717,7 +1911,7 @@ void mark_mounts_for_expiry(struct list_head *mounts)
 		return;
 
 	down_write(&namespace_sem);
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 
 	/* extract from the expiration list every vfsmount that matches the
 	 * following criteria:
@@ -1736,7 +1930,7 @@ void mark_mounts_for_expiry(struct list_head *mounts)
 		touch_mnt_namespace(mnt->mnt_ns);
 		umount_tree(mnt, 1, &umounts);
 	}
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	up_write(&namespace_sem);
 
 	release_mounts(&umounts);
@@ -2011,9 +2205,9 @@ static struct mnt_namespace *dup_mnt_ns(struct mnt_namespace *mnt_ns,
 		kfree(new_ns);
 		return ERR_PTR(-ENOMEM);
 	}
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	list_add_tail(&new_ns->list, &new_ns->root->mnt_list);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 
 	/*
 	 * Second pass: switch the tsk->fs->* elements and mark new vfsmounts
@@ -2210,7 +2404,7 @@ SYSCALL_DEFINE2(pivot_root, const char __user *, new_root,
 		goto out2; /* not attached */
 	/* make sure we can reach put_old from new_root */
 	tmp = old.mnt;
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	if (tmp != new.mnt) {
 		for (;;) {
 			if (tmp->mnt_parent == tmp)
@@ -2230,7 +2424,7 @@ SYSCALL_DEFINE2(pivot_root, const char __user *, new_root,
 	/* mount new_root on / */
 	attach_mnt(new.mnt, &root_parent);
 	touch_mnt_namespace(current->nsproxy->mnt_ns);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	chroot_fs_refs(&root, &new);
 	security_sb_post_pivotroot(&root, &new);
 	error = 0;
@@ -2246,7 +2440,7 @@ out1:
 out0:
 	return error;
 out3:
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	goto out2;
 }
 
@@ -2309,15 +2503,15 @@ void put_mnt_ns(struct mnt_namespace *ns)
 	struct vfsmount *root;
 	LIST_HEAD(umount_list);
 
-	if (!atomic_dec_and_lock(&ns->count, &vfsmount_lock))
+	if (!atomic_dec_and_lock(&ns->count, &vfsmount_lock.lock))
 		return;
 	root = ns->root;
 	ns->root = NULL;
-	spin_unlock(&vfsmount_lock);
+	vfsmount_read_unlock();
 	down_write(&namespace_sem);
-	spin_lock(&vfsmount_lock);
+	vfsmount_write_lock();
 	umount_tree(root, 0, &umount_list);
-	spin_unlock(&vfsmount_lock);
+	vfsmount_write_unlock();
 	up_write(&namespace_sem);
 	release_mounts(&umount_list);
 	kfree(ns);
@@ -99,6 +99,7 @@ static struct file_system_type proc_fs_type = {
 	.name		= "proc",
 	.get_sb		= proc_get_sb,
 	.kill_sb	= proc_kill_sb,
+	.fs_flags	= FS_RCU_INODES,
 };
 
 void __init proc_root_init(void)
@@ -218,7 +219,7 @@ int pid_ns_prepare_proc(struct pid_namespace *ns)
 
 void pid_ns_release_proc(struct pid_namespace *ns)
 {
-	mntput(ns->proc_mnt);
+	kern_unmount(ns->proc_mnt);
 }
 
 EXPORT_SYMBOL(proc_symlink);
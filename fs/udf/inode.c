@@ -91,7 +91,7 @@ no_delete:
 
 /*
  * If we are going to release inode from memory, we truncate last inode extent
- * to proper length. We could use drop_inode() but it's called under inode_lock
+ * to proper length. We could use drop_inode() but it's called under inode->i_lock
  * and thus we cannot mark inode dirty there.  We use clear_inode() but we have
  * to make sure to write inode as it's not written automatically.
  */
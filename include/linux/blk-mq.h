@@ -0,0 +1,158 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_tags;
+struct blk_mq_ctx;
+
+/* log2 buckets of blk_poll() latency in usecs, see io_poll_stats */
+#define BLK_MQ_POLL_LAT_BKTS	16
+
+/*
+ * A hardware dispatch queue. Requests are staged in the per-cpu software
+ * queues mapped to it and handed to the driver through ->queue_rq().
+ */
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;	/* requests the driver was busy for */
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+	cpumask_var_t		cpumask;
+
+	unsigned long		flags;		/* BLK_MQ_F_* flags */
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+
+	void			*driver_data;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;	/* software queues with requests */
+
+	struct blk_mq_tags	*tags;
+	unsigned int		queue_depth;
+
+	/* blk_poll() statistics, updated without locking */
+	unsigned long		poll_invoked;
+	unsigned long		poll_success;
+	unsigned long		poll_lat[BLK_MQ_POLL_LAT_BKTS];
+};
+
+/*
+ * Passed to blk_mq_init_queue() by the driver.
+ */
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* per-request driver data */
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* flags */
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *, bool);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *, const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+typedef int (init_request_fn)(void *, struct request *, unsigned int,
+			      unsigned int);
+typedef int (poll_fn)(struct blk_mq_hw_ctx *);
+
+struct blk_mq_ops {
+	/*
+	 * Queue request. Called in process context with no locks held,
+	 * possibly on several cpus at once for the same hardware queue.
+	 * The last argument is false if more requests follow immediately,
+	 * so the driver may defer notifying the hardware. A driver that
+	 * returns BLK_MQ_RQ_QUEUE_BUSY must stop the hardware queue first
+	 * and restart it once resources free up.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Map a software queue (cpu) to a hardware queue. Usually
+	 * blk_mq_map_queue().
+	 */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * Called once for each hardware queue when the queue is set up and
+	 * torn down, with the driver_data passed to blk_mq_init_queue().
+	 */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+
+	/*
+	 * Called once for each preallocated request: driver_data, request,
+	 * hardware queue index, request index.
+	 */
+	init_request_fn		*init_request;
+
+	/*
+	 * Optional. Reap completed requests from the hardware queue without
+	 * waiting for its interrupt, completing them as the interrupt
+	 * handler would. Returns the number of requests completed. Called
+	 * in process context with no locks held, see blk_poll().
+	 */
+	poll_fn			*poll;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+void blk_mq_free_queue(struct request_queue *);
+
+void blk_mq_insert_request(struct request *, bool, bool, bool);
+void blk_mq_run_queues(struct request_queue *, bool);
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+void blk_mq_start_stopped_hw_queues(struct request_queue *, bool);
+
+struct request *blk_mq_alloc_request(struct request_queue *, int, gfp_t);
+void blk_mq_free_request(struct request *);
+void blk_mq_end_io(struct request *, int);
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+/*
+ * Driver command data is placed directly after the request.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+
+static inline int blk_mq_hctx_stopped(struct blk_mq_hw_ctx *hctx)
+{
+	return test_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#define hctx_for_each_ctx(hctx, ctx, i)					\
+	for ((i) = 0; (i) < (hctx)->nr_ctx &&				\
+	     ({ ctx = (hctx)->ctxs[(i)]; 1; }); (i)++)
+
+#endif
@@ -5,6 +5,7 @@
 #include <linux/list.h>
 #include <linux/rculist.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
 #include <linux/cache.h>
 #include <linux/rcupdate.h>
 
@@ -90,6 +91,7 @@ struct dentry {
 	atomic_t d_count;
 	unsigned int d_flags;		/* protected by d_lock */
 	spinlock_t d_lock;		/* per dentry lock */
+	seqcount_t d_seq;		/* per dentry seqlock, for RCU walk */
 	int d_mounted;
 	struct inode *d_inode;		/* Where the name belongs to - NULL is
 					 * negative */
@@ -101,7 +103,7 @@ struct dentry {
 	struct dentry *d_parent;	/* parent directory */
 	struct qstr d_name;
 
-	struct list_head d_lru;		/* LRU list */
+	struct list_head d_lru;		/* LRU list, sb->s_dentry_lru_lock */
 	/*
 	 * d_child and d_rcu can share memory
 	 */
@@ -109,7 +111,7 @@ struct dentry {
 		struct list_head d_child;	/* child of parent list */
 	 	struct rcu_head d_rcu;
 	} d_u;
-	struct list_head d_subdirs;	/* our children */
+	struct list_head d_subdirs;	/* our children, protected by d_lock */
 	struct list_head d_alias;	/* inode alias list */
 	unsigned long d_time;		/* used by d_revalidate */
 	const struct dentry_operations *d_op;
@@ -124,11 +126,15 @@ struct dentry {
  *
  * 0: normal
  * 1: nested
+ * 2, 3: d_move() and d_materialise_unique(), which lock up to four
+ *       dentries (both parents, then the two dentries)
  */
 enum dentry_d_lock_class
 {
 	DENTRY_D_LOCK_NORMAL, /* implicitly used by plain spin_lock() APIs. */
-	DENTRY_D_LOCK_NESTED
+	DENTRY_D_LOCK_NESTED,
+	DENTRY_D_LOCK_NESTED_2,
+	DENTRY_D_LOCK_NESTED_3
 };
 
 struct dentry_operations {
@@ -204,22 +210,27 @@ extern seqlock_t rename_lock;
  *
  * __d_drop requires dentry->d_lock.
  */
+extern void __d_drop(struct dentry *dentry);
 
-static inline void __d_drop(struct dentry *dentry)
+/**
+ * dentry_rcuwalk_barrier - invalidate in-progress RCU path walks
+ * @dentry: dentry whose name, parent, inode or hash state changed
+ *
+ * Bumps d_seq so that any RCU walker which sampled it earlier notices
+ * the change and falls back to the refcounted walk. The caller holds
+ * dentry->d_lock, which is what serializes the d_seq writers.
+ */
+static inline void dentry_rcuwalk_barrier(struct dentry *dentry)
 {
-	if (!(dentry->d_flags & DCACHE_UNHASHED)) {
-		dentry->d_flags |= DCACHE_UNHASHED;
-		hlist_del_rcu(&dentry->d_hash);
-	}
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 }
 
 static inline void d_drop(struct dentry *dentry)
 {
-	spin_lock(&dcache_lock);
 	spin_lock(&dentry->d_lock);
  	__d_drop(dentry);
 	spin_unlock(&dentry->d_lock);
-	spin_unlock(&dcache_lock);
 }
 
 static inline int dname_external(struct dentry *dentry)
@@ -301,6 +312,8 @@ extern struct dentry *d_ancestor(struct dentry *, struct dentry *);
 /* appendix may either be NULL or be used for transname suffixes */
 extern struct dentry * d_lookup(struct dentry *, struct qstr *);
 extern struct dentry * __d_lookup(struct dentry *, struct qstr *);
+extern struct dentry *__d_lookup_rcu(struct dentry *, struct qstr *,
+				     unsigned *);
 extern struct dentry * d_hash_and_lookup(struct dentry *, struct qstr *);
 
 /* validate "insecure" dentry pointer */
@@ -0,0 +1,56 @@
+#ifndef __LINUX_DMA_CONTIGUOUS_H
+#define __LINUX_DMA_CONTIGUOUS_H
+
+/*
+ * Contiguous Memory Allocator for DMA mapping framework
+ *
+ * A region of memory is reserved at boot and handed to the page
+ * allocator as MIGRATE_CMA pageblocks.  Only movable allocations may
+ * borrow pages from those blocks, so when a driver asks for a large
+ * coherent buffer the pages in the wanted range can be migrated away
+ * and the range given to the driver.
+ *
+ * The architecture calls dma_contiguous_reserve() while the bootmem
+ * allocator is still up, and its dma_alloc_coherent() implementation
+ * tries dma_alloc_from_contiguous() before the buddy allocator.  The
+ * size of the area is CONFIG_CMA_SIZE_MBYTES unless overridden by the
+ * "cma=" kernel parameter.
+ */
+
+#ifdef __KERNEL__
+
+struct device;
+struct page;
+
+#ifdef CONFIG_CMA
+
+extern void dma_contiguous_reserve(void);
+
+struct page *dma_alloc_from_contiguous(struct device *dev, int count,
+				       unsigned int order);
+bool dma_release_from_contiguous(struct device *dev, struct page *pages,
+				 int count);
+
+#else
+
+static inline void dma_contiguous_reserve(void) { }
+
+static inline
+struct page *dma_alloc_from_contiguous(struct device *dev, int count,
+				       unsigned int order)
+{
+	return NULL;
+}
+
+static inline
+bool dma_release_from_contiguous(struct device *dev, struct page *pages,
+				 int count)
+{
+	return false;
+}
+
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Dynamic byte queue limits.
+ *
+ * The goal of dynamic queue limits (dql) is to set the limit on the
+ * number of objects in a queue (typically bytes in a NIC transmit ring)
+ * to the smallest value that never lets the consumer (the hardware)
+ * starve.  Anything queued beyond that only adds latency.
+ *
+ * The producer calls dql_queued() for every object it queues, and
+ * checks dql_avail() to see whether it may continue: a negative value
+ * means the limit has been reached and the queue should be stopped.
+ * The consumer calls dql_completed() for the objects that finished, at
+ * most once per completion interval.  The limit is then adjusted:
+ *
+ *   - if the queue ran empty while it was over the limit in the last
+ *     interval, it was starved and the limit is increased;
+ *   - if the queue stayed busy, the minimum amount of data that was
+ *     queued beyond what was needed (the slack) over slack_hold_time
+ *     is removed from the limit.
+ *
+ * dql_queued() and dql_avail() must be serialized against each other,
+ * as must calls to dql_completed(); the two sides may run concurrently.
+ */
+
+#ifndef _LINUX_DQL_H
+#define _LINUX_DQL_H
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>
+#include <linux/cache.h>
+
+struct dql {
+	/* Fields accessed in enqueue path (dql_queued) */
+	unsigned int	num_queued;		/* Total ever queued */
+	unsigned int	adj_limit;		/* limit + num_completed */
+	unsigned int	last_obj_cnt;		/* Count at last queuing */
+
+	/* Fields accessed only by completion path (dql_completed) */
+
+	unsigned int	limit ____cacheline_aligned_in_smp; /* Current limit */
+	unsigned int	num_completed;		/* Total ever completed */
+
+	unsigned int	prev_ovlimit;		/* Previous over limit */
+	unsigned int	prev_num_queued;	/* Previous queue total */
+	unsigned int	prev_last_obj_cnt;	/* Previous queuing cnt */
+
+	unsigned int	lowest_slack;		/* Lowest slack found */
+	unsigned long	slack_start_time;	/* Time slacks seen */
+
+	/* Configuration */
+	unsigned int	max_limit;		/* Max limit */
+	unsigned int	min_limit;		/* Minimum limit */
+	unsigned int	slack_hold_time;	/* Time to measure slack */
+};
+
+/* Set some static maximums */
+#define DQL_MAX_OBJECT (UINT_MAX / 16)
+#define DQL_MAX_LIMIT ((UINT_MAX / 2) - DQL_MAX_OBJECT)
+
+/*
+ * Record number of objects queued. Assumes that caller has already checked
+ * availability in the queue with dql_avail.
+ */
+static inline void dql_queued(struct dql *dql, unsigned int count)
+{
+	BUG_ON(count > DQL_MAX_OBJECT);
+
+	dql->num_queued += count;
+	dql->last_obj_cnt = count;
+}
+
+/* Returns how many objects can be queued, < 0 indicates over limit. */
+static inline int dql_avail(const struct dql *dql)
+{
+	return ACCESS_ONCE(dql->adj_limit) - ACCESS_ONCE(dql->num_queued);
+}
+
+/* Record number of completed objects and recalculate the limit. */
+void dql_completed(struct dql *dql, unsigned int count);
+
+/* Reset dql state */
+void dql_reset(struct dql *dql);
+
+/* Initialize dql state */
+int dql_init(struct dql *dql, unsigned hold_time);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_DQL_H */
@@ -0,0 +1,86 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+
+/*
+ * A frontswap backend is offered every page on its way out to swap and
+ * may keep it, in which case swap_writepage() does no I/O.  Pages it has
+ * accepted are read back through ->load() instead of from the device.
+ * ->store() and ->load() return 0 on success.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*store)(unsigned type, pgoff_t offset, struct page *page);
+	int (*load)(unsigned type, pgoff_t offset, struct page *page);
+	void (*invalidate_page)(unsigned type, pgoff_t offset);
+	void (*invalidate_area)(unsigned type);
+};
+
+#ifdef CONFIG_FRONTSWAP
+extern bool frontswap_enabled;
+
+extern void frontswap_register_ops(struct frontswap_ops *ops);
+extern void __frontswap_init(unsigned type, unsigned long maxpages);
+extern int __frontswap_store(struct page *page);
+extern int __frontswap_load(struct page *page);
+extern void __frontswap_invalidate_page(unsigned type, pgoff_t offset);
+extern void __frontswap_invalidate_area(unsigned type);
+
+static inline void frontswap_init(unsigned type, unsigned long maxpages)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type, maxpages);
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_store(page);
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_load(page);
+	return -1;
+}
+
+static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_page(type, offset);
+}
+
+static inline void frontswap_invalidate_area(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_area(type);
+}
+#else
+static inline void frontswap_init(unsigned type, unsigned long maxpages)
+{
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	return -1;
+}
+
+static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+}
+
+static inline void frontswap_invalidate_area(unsigned type)
+{
+}
+#endif /* CONFIG_FRONTSWAP */
+
+#endif /* _LINUX_FRONTSWAP_H */
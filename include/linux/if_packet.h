@@ -48,6 +48,11 @@ struct sockaddr_ll
 #define PACKET_RESERVE			12
 #define PACKET_TX_RING			13
 #define PACKET_LOSS			14
+#define PACKET_FANOUT			18
+
+#define PACKET_FANOUT_HASH		0
+#define PACKET_FANOUT_LB		1
+#define PACKET_FANOUT_CPU		2
 
 struct tpacket_stats
 {
@@ -55,6 +60,19 @@ struct tpacket_stats
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3
+{
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;	/* times the ring ran out of blocks */
+};
+
+union tpacket_stats_u
+{
+	struct tpacket_stats	stats1;
+	struct tpacket_stats_v3	stats3;
+};
+
 struct tpacket_auxdata
 {
 	__u32		tp_status;
@@ -71,6 +89,7 @@ struct tpacket_auxdata
 #define TP_STATUS_COPY		0x2
 #define TP_STATUS_LOSING	0x4
 #define TP_STATUS_CSUMNOTREADY	0x8
+#define TP_STATUS_BLK_TMO	0x20	/* TPACKET_V3 block retired by timeout */
 
 /* Tx ring - header status */
 #define TP_STATUS_AVAILABLE	0x0
@@ -107,10 +126,66 @@ struct tpacket2_hdr
 
 #define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket_hdr_variant1
+{
+	__u32		tp_rxhash;
+	__u32		tp_vlan_tci;
+};
+
+struct tpacket3_hdr
+{
+	__u32		tp_next_offset;	/* to the next packet, 0 for the last */
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	union {
+		struct tpacket_hdr_variant1 hv1;
+	};
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts
+{
+	unsigned int	ts_sec;
+	union {
+		unsigned int	ts_usec;
+		unsigned int	ts_nsec;
+	};
+};
+
+struct tpacket_hdr_v1
+{
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+	__u32		blk_len;	/* bytes used, including this header */
+	__u64		seq_num __attribute__((aligned(8)));
+	struct tpacket_bd_ts	ts_first_pkt;
+	struct tpacket_bd_ts	ts_last_pkt;
+};
+
+union tpacket_bd_header_u
+{
+	struct tpacket_hdr_v1	bh1;
+};
+
+struct tpacket_block_desc
+{
+	__u32		version;
+	__u32		offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
 enum tpacket_versions
 {
 	TPACKET_V1,
 	TPACKET_V2,
+	TPACKET_V3,
 };
 
 /*
@@ -124,6 +199,15 @@ enum tpacket_versions
    - Start+tp_mac: [ Optional MAC header ]
    - Start+tp_net: Packet data, aligned to TPACKET_ALIGNMENT=16.
    - Pad to align to TPACKET_ALIGNMENT=16
+
+   TPACKET_V3 receive ring: the ring is a set of blocks rather than
+   frames.  Each block starts with a struct tpacket_block_desc, followed
+   by tp_sizeof_priv bytes for the application, then by packets laid
+   out as above but with a struct tpacket3_hdr, each aligned to 8 bytes
+   and linked by tp_next_offset.  The kernel hands a whole block over by
+   setting TP_STATUS_USER in block_status, when it is full or when
+   tp_retire_blk_tov milliseconds have passed (TP_STATUS_BLK_TMO also
+   set), and user space gives it back by writing TP_STATUS_KERNEL.
  */
 
 struct tpacket_req
@@ -134,6 +218,26 @@ struct tpacket_req
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+struct tpacket_req3
+{
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Maximum size of a packet */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* Timeout in msecs, 0 for default */
+	unsigned int	tp_sizeof_priv;	/* Private area at the block start */
+	unsigned int	tp_feature_req_word;
+};
+
+/* tp_feature_req_word */
+#define TP_FT_REQ_FILL_RXHASH	0x1
+
+union tpacket_req_u
+{
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
 struct packet_mreq
 {
 	int		mr_ifindex;
@@ -13,6 +13,8 @@
 #include <linux/list.h>
 #include <linux/nodemask.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <asm/atomic.h>
 
 struct super_block;
@@ -31,6 +33,8 @@ struct mnt_namespace;
 
 #define MNT_SHRINKABLE	0x100
 #define MNT_WRITE_HOLD	0x200
+#define MNT_INTERNAL	0x400	/* kern_mount()ed, see kern_unmount() */
+#define MNT_DOOMED	0x800	/* last reference gone, being freed */
 
 #define MNT_SHARED	0x1000	/* if the vfsmount is a shared mount */
 #define MNT_UNBINDABLE	0x2000	/* if the vfsmount is a unbindable mount */
@@ -61,33 +65,58 @@ struct vfsmount {
 	 * to let these frequently modified fields in a separate cache line
 	 * (so that reads of mnt_flags wont ping-pong on SMP machines)
 	 */
-	atomic_t mnt_count;
-	int mnt_expiry_mark;		/* true if marked for expiry */
-	int mnt_pinned;
-	int mnt_ghosts;
 #ifdef CONFIG_SMP
-	int *mnt_writers;
+	struct mnt_pcp *mnt_pcp;	/* per-cpu mnt_count and mnt_writers */
 #else
+	int mnt_count;
 	int mnt_writers;
 #endif
+	int mnt_expiry_mark;		/* true if marked for expiry */
+	int mnt_pinned;
+	int mnt_ghosts;
+	struct rcu_head mnt_rcu;	/* lockless lookup_mnt() may still see us */
 };
 
-static inline int *get_mnt_writers_ptr(struct vfsmount *mnt)
+/*
+ * The reference and writer counts are split per cpu.  Summing mnt_count
+ * is only exact once nobody can take the lockless mntput() fast path any
+ * more, see mntput_no_expire().
+ */
+struct mnt_pcp {
+	int mnt_count;
+	int mnt_writers;
+};
+
+/*
+ * vfsmount_lock protects the mount tree and hash.  Anything changing
+ * them takes the write side, which bumps the sequence count so that
+ * lockless lookup_mnt() callers retry.  Walkers that only need a stable
+ * tree can take the spinlock alone and leave lockless readers alone.
+ */
+extern seqlock_t vfsmount_lock;
+
+static inline void vfsmount_write_lock(void)
 {
-#ifdef CONFIG_SMP
-	return mnt->mnt_writers;
-#else
-	return &mnt->mnt_writers;
-#endif
+	write_seqlock(&vfsmount_lock);
+}
+
+static inline void vfsmount_write_unlock(void)
+{
+	write_sequnlock(&vfsmount_lock);
+}
+
+static inline void vfsmount_read_lock(void)
+{
+	spin_lock(&vfsmount_lock.lock);
 }
 
-static inline struct vfsmount *mntget(struct vfsmount *mnt)
+static inline void vfsmount_read_unlock(void)
 {
-	if (mnt)
-		atomic_inc(&mnt->mnt_count);
-	return mnt;
+	spin_unlock(&vfsmount_lock.lock);
 }
 
+extern struct vfsmount *mntget(struct vfsmount *mnt);
+
 struct file; /* forward dec */
 
 extern int mnt_want_write(struct vfsmount *mnt);
@@ -123,7 +152,6 @@ extern int do_add_mount(struct vfsmount *newmnt, struct path *path,
 
 extern void mark_mounts_for_expiry(struct list_head *mounts);
 
-extern spinlock_t vfsmount_lock;
 extern dev_t name_to_dev_t(char *name);
 
 #endif /* _LINUX_MOUNT_H */
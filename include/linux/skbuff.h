@@ -243,6 +243,8 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -307,6 +309,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
+ *	@rxhash: flow hash computed on receive for packet steering
  *	@vlan_tci: vlan tag control information
  */
 
@@ -392,6 +395,8 @@ struct sk_buff {
 
 	__u32			mark;
 
+	__u32			rxhash;
+
 	__u16			vlan_tci;
 
 	sk_buff_data_t		transport_header;
@@ -2039,6 +2044,15 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+
+	return skb->rxhash;
+}
+
 #ifdef CONFIG_XFRM
 static inline struct sec_path *skb_sec_path(struct sk_buff *skb)
 {
@@ -32,18 +32,37 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	CPU_PARTIAL_ALLOC,	/* Cpu slab taken from the cpu partial list */
+	CPU_PARTIAL_FREE,	/* Freeing moves slab to the cpu partial list */
+	CPU_PARTIAL_NODE,	/* Slab moved from node to cpu partial list */
+	CPU_PARTIAL_DRAIN,	/* Cpu partial list returned to the node */
+	CMPXCHG_DOUBLE_CPU_FAIL,/* Lockless fastpath cmpxchg had to retry */
 	NR_SLUB_STAT_ITEMS };
 
+/*
+ * freelist and tid are updated together by cmpxchg_double_local() on
+ * architectures that have it, which needs them adjacent and aligned to
+ * twice the word size.
+ */
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+#define __kmem_cache_cpu_align	__aligned(2 * sizeof(void *))
+#else
+#define __kmem_cache_cpu_align
+#endif
+
 struct kmem_cache_cpu {
 	void **freelist;	/* Pointer to first free per cpu object */
+	unsigned long tid;	/* Transaction id, bumped on freelist change */
 	struct page *page;	/* The slab from which we are allocating */
 	int node;		/* The node of the page (or -1 for debug) */
 	unsigned int offset;	/* Freepointer offset (in word units) */
 	unsigned int objsize;	/* Size of an object (from kmem_cache) */
+	struct list_head partial;	/* Frozen partial slabs of this cpu */
+	unsigned int nr_partial;	/* Number of slabs on partial */
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
-};
+} __kmem_cache_cpu_align;
 
 struct kmem_cache_node {
 	spinlock_t list_lock;	/* Protect partial list and nr_partial */
@@ -91,6 +110,7 @@ struct kmem_cache {
 	int inuse;		/* Offset to metadata */
 	int align;		/* Alignment */
 	unsigned long min_partial;
+	unsigned int cpu_partial;	/* Max slabs on each cpu partial list */
 	const char *name;	/* Name (only for display!) */
 	struct list_head list;	/* List of slab caches */
 #ifdef CONFIG_SLUB_DEBUG
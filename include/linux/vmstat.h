@@ -52,6 +52,12 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		UNEVICTABLE_PGCLEARED,	/* on COW, page truncate */
 		UNEVICTABLE_PGSTRANDED,	/* unable to isolate on unlock */
 		UNEVICTABLE_MLOCKFREED,
+#ifdef CONFIG_COMPACTION
+		FOR_ALL_ZONES(COMPACTBLOCKS),
+		FOR_ALL_ZONES(COMPACTPAGES),
+		FOR_ALL_ZONES(COMPACTPAGEFAILED),
+		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+#endif
 		NR_VM_EVENT_ITEMS
 };
 
@@ -133,6 +139,10 @@ static inline void vm_events_fold_cpu(int cpu)
 		__count_vm_events(item##_NORMAL - ZONE_NORMAL + \
 		zone_idx(zone), delta)
 
+#define count_zone_vm_events(item, zone, delta) \
+		count_vm_events(item##_NORMAL - ZONE_NORMAL + \
+		zone_idx(zone), delta)
+
 /*
  * Zone based page accounting with per cpu differentials.
  */
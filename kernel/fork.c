@@ -1114,6 +1114,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 #ifdef CONFIG_DEBUG_MUTEXES
 	p->blocked_on = NULL; /* not blocked yet */
 #endif
+#ifdef CONFIG_BLOCK
+	p->plug = NULL;
+#endif
 
 	p->bts = NULL;
 
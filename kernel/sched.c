@@ -5373,6 +5373,18 @@ pick_next_task(struct rq *rq)
 	}
 }
 
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	/*
+	 * If we are going to sleep and we have plugged IO queued,
+	 * make sure to submit it to avoid deadlocks.
+	 */
+	if (blk_needs_flush_plug(tsk))
+		blk_schedule_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -5383,6 +5395,8 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
+
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
@@ -0,0 +1,135 @@
+/*
+ * mm/cma-test.c
+ *
+ * Contiguous Memory Allocator test: fills memory with page cache written
+ * alternately to two shmem files, then drops one of them so that free
+ * memory is left as isolated single pages.  It then allocates 1080p frame
+ * buffers with dma_alloc_coherent(), which takes them from the contiguous
+ * area by migrating the page cache away, and for comparison tries to get
+ * the same order straight from the buddy allocator.  Results are printed
+ * to the kernel log when the module is loaded.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/dma-mapping.h>
+#include <asm/uaccess.h>
+
+#define FRAME_SIZE	(1920 * 1080 * 2)	/* 1080p YUV 4:2:2 */
+#define MAX_FRAMES	16
+
+static int frames = 4;
+module_param(frames, int, 0444);
+MODULE_PARM_DESC(frames, "number of 1080p frame buffers to allocate");
+
+static int fragment_mb = 32;
+module_param(fragment_mb, int, 0444);
+MODULE_PARM_DESC(fragment_mb, "MiB of page cache used to fragment memory");
+
+static void *frame[MAX_FRAMES];
+static dma_addr_t frame_dma[MAX_FRAMES];
+
+/* Interleave the pages of two files, then drop one of them */
+static struct file *cma_test_fragment(void)
+{
+	struct file *keep, *drop;
+	unsigned long i, nr = (unsigned long)fragment_mb << (20 - PAGE_SHIFT);
+	loff_t pos_keep = 0, pos_drop = 0;
+	mm_segment_t old_fs;
+	char *buf;
+
+	buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return ERR_PTR(-ENOMEM);
+	memset(buf, 0x5a, PAGE_SIZE);
+
+	keep = shmem_file_setup("cma_test_keep", (loff_t)nr << PAGE_SHIFT, 0);
+	if (IS_ERR(keep))
+		goto out;
+	drop = shmem_file_setup("cma_test_drop", (loff_t)nr << PAGE_SHIFT, 0);
+	if (IS_ERR(drop)) {
+		fput(keep);
+		keep = drop;
+		goto out;
+	}
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (i = 0; i < nr; i++) {
+		if (vfs_write(keep, buf, PAGE_SIZE, &pos_keep) != PAGE_SIZE ||
+		    vfs_write(drop, buf, PAGE_SIZE, &pos_drop) != PAGE_SIZE)
+			break;
+		cond_resched();
+	}
+	set_fs(old_fs);
+
+	fput(drop);
+out:
+	free_page((unsigned long)buf);
+	return keep;
+}
+
+static int __init cma_test_init(void)
+{
+	unsigned int order = get_order(FRAME_SIZE);
+	struct page *page;
+	struct file *filp;
+	ktime_t start;
+	int i, n;
+
+	if (frames <= 0 || frames > MAX_FRAMES || fragment_mb < 0)
+		return -EINVAL;
+
+	filp = cma_test_fragment();
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+
+	page = alloc_pages(GFP_KERNEL | __GFP_NOWARN, order);
+	printk(KERN_INFO "cma_test: buddy order-%u allocation %s\n", order,
+	       page ? "succeeded" : "failed");
+	if (page)
+		__free_pages(page, order);
+
+	for (n = 0; n < frames; n++) {
+		s64 us;
+
+		start = ktime_get();
+		frame[n] = dma_alloc_coherent(NULL, FRAME_SIZE, &frame_dma[n],
+					      GFP_KERNEL);
+		us = ktime_to_us(ktime_sub(ktime_get(), start));
+		if (!frame[n]) {
+			printk(KERN_INFO "cma_test: frame %d: allocation "
+			       "failed after %lld us\n", n, us);
+			break;
+		}
+		printk(KERN_INFO "cma_test: frame %d at 0x%08llx in %lld us\n",
+		       n, (unsigned long long)frame_dma[n], us);
+	}
+
+	for (i = 0; i < n; i++)
+		dma_free_coherent(NULL, FRAME_SIZE, frame[i], frame_dma[i]);
+	fput(filp);
+
+	printk(KERN_INFO "cma_test: %d of %d frames allocated\n", n, frames);
+	return 0;
+}
+module_init(cma_test_init);
+
+static void __exit cma_test_exit(void)
+{
+}
+module_exit(cma_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Contiguous Memory Allocator test");
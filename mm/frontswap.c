@@ -0,0 +1,170 @@
+/*
+ * mm/frontswap.c
+ *
+ * Hooks that let a backend such as zswap keep swapped out pages somewhere
+ * other than the swap device.  swap_writepage() offers each page to the
+ * backend before doing any I/O, and swap_readpage() asks the backend for
+ * it before going to the device.  A per swap device bitmap records which
+ * offsets the backend holds, so reads of other pages cost one bit test.
+ *
+ * Only one backend can be registered; it should do so before swapon, as
+ * swap devices that are already active are not handed to it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/vmalloc.h>
+#include <linux/debugfs.h>
+#include <linux/frontswap.h>
+#include <linux/module.h>
+
+static struct frontswap_ops frontswap_ops __read_mostly;
+
+bool frontswap_enabled __read_mostly;
+EXPORT_SYMBOL(frontswap_enabled);
+
+/*
+ * Statistics, exported in debugfs.  They are updated without locking
+ * and so may be slightly off; the hit rate of the backend is
+ * loads / (loads + failed_loads).
+ */
+static u64 frontswap_loads;
+static u64 frontswap_failed_loads;
+static u64 frontswap_succ_stores;
+static u64 frontswap_failed_stores;
+static u64 frontswap_invalidates;
+
+void frontswap_register_ops(struct frontswap_ops *ops)
+{
+	frontswap_ops = *ops;
+	frontswap_enabled = true;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+/* Called from swapon, before the device is made available for swapping */
+void __frontswap_init(unsigned type, unsigned long maxpages)
+{
+	struct swap_info_struct *sis = get_swap_info_struct(type);
+	size_t size = BITS_TO_LONGS(maxpages) * sizeof(long);
+
+	atomic_set(&sis->frontswap_pages, 0);
+	sis->frontswap_map = vmalloc(size);
+	if (!sis->frontswap_map)
+		return;
+	memset(sis->frontswap_map, 0, size);
+	frontswap_ops.init(type);
+}
+
+/*
+ * Offer a locked swap cache page to the backend.  If the offset was
+ * stored before and the backend refuses the new contents, the stale copy
+ * is dropped so that the page is read back from the device.
+ */
+int __frontswap_store(struct page *page)
+{
+	swp_entry_t entry = { .val = page_private(page), };
+	unsigned type = swp_type(entry);
+	pgoff_t offset = swp_offset(entry);
+	struct swap_info_struct *sis = get_swap_info_struct(type);
+	int dup, ret;
+
+	BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map)
+		return -1;
+
+	dup = test_bit(offset, sis->frontswap_map);
+	ret = frontswap_ops.store(type, offset, page);
+	if (ret == 0) {
+		if (!dup) {
+			set_bit(offset, sis->frontswap_map);
+			atomic_inc(&sis->frontswap_pages);
+		}
+		frontswap_succ_stores++;
+	} else {
+		if (dup) {
+			clear_bit(offset, sis->frontswap_map);
+			atomic_dec(&sis->frontswap_pages);
+			frontswap_ops.invalidate_page(type, offset);
+		}
+		frontswap_failed_stores++;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_store);
+
+int __frontswap_load(struct page *page)
+{
+	swp_entry_t entry = { .val = page_private(page), };
+	unsigned type = swp_type(entry);
+	pgoff_t offset = swp_offset(entry);
+	struct swap_info_struct *sis = get_swap_info_struct(type);
+	int ret = -1;
+
+	BUG_ON(!PageLocked(page));
+	if (!sis->frontswap_map)
+		return -1;
+
+	if (test_bit(offset, sis->frontswap_map))
+		ret = frontswap_ops.load(type, offset, page);
+	if (ret == 0)
+		frontswap_loads++;
+	else
+		frontswap_failed_loads++;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_load);
+
+/* Called with swap_lock held when the swap slot is freed */
+void __frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct swap_info_struct *sis = get_swap_info_struct(type);
+
+	if (sis->frontswap_map && test_bit(offset, sis->frontswap_map)) {
+		frontswap_ops.invalidate_page(type, offset);
+		clear_bit(offset, sis->frontswap_map);
+		atomic_dec(&sis->frontswap_pages);
+		frontswap_invalidates++;
+	}
+}
+EXPORT_SYMBOL(__frontswap_invalidate_page);
+
+/* Called from swapoff once every page has been brought back in */
+void __frontswap_invalidate_area(unsigned type)
+{
+	struct swap_info_struct *sis = get_swap_info_struct(type);
+	unsigned long *map = sis->frontswap_map;
+
+	if (!map)
+		return;
+	frontswap_ops.invalidate_area(type);
+	atomic_set(&sis->frontswap_pages, 0);
+	sis->frontswap_map = NULL;
+	vfree(map);
+}
+EXPORT_SYMBOL(__frontswap_invalidate_area);
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *root = debugfs_create_dir("frontswap", NULL);
+
+	if (root == NULL)
+		return -ENXIO;
+	debugfs_create_u64("loads", S_IRUGO, root, &frontswap_loads);
+	debugfs_create_u64("failed_loads", S_IRUGO, root,
+			   &frontswap_failed_loads);
+	debugfs_create_u64("succ_stores", S_IRUGO, root,
+			   &frontswap_succ_stores);
+	debugfs_create_u64("failed_stores", S_IRUGO, root,
+			   &frontswap_failed_stores);
+	debugfs_create_u64("invalidates", S_IRUGO, root,
+			   &frontswap_invalidates);
+#endif
+	return 0;
+}
+module_init(init_frontswap);
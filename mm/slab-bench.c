@@ -0,0 +1,100 @@
+/*
+ * mm/slab-bench.c
+ *
+ * Slab allocator microbenchmark: compares allocating and freeing objects
+ * one at a time with kmem_cache_alloc()/kmem_cache_free() against the
+ * kmem_cache_alloc_bulk()/kmem_cache_free_bulk() interfaces, for a range
+ * of batch sizes.  Results are printed to the kernel log when the module
+ * is loaded, as nanoseconds per object for an alloc+free pair.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+#define MAX_BATCH	256
+
+static int objsize = 256;
+module_param(objsize, int, 0444);
+MODULE_PARM_DESC(objsize, "object size of the test cache");
+
+static int objects = 1 << 20;
+module_param(objects, int, 0444);
+MODULE_PARM_DESC(objects, "objects allocated and freed per measurement");
+
+static void *objs[MAX_BATCH];
+
+static unsigned long bench_single(struct kmem_cache *s, int batch)
+{
+	ktime_t start;
+	int i, j;
+
+	start = ktime_get();
+	for (i = 0; i < objects; i += batch) {
+		for (j = 0; j < batch; j++) {
+			objs[j] = kmem_cache_alloc(s, GFP_KERNEL);
+			if (!objs[j])
+				break;
+		}
+		while (--j >= 0)
+			kmem_cache_free(s, objs[j]);
+		cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start)) / objects;
+}
+
+static unsigned long bench_bulk(struct kmem_cache *s, int batch)
+{
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < objects; i += batch) {
+		if (kmem_cache_alloc_bulk(s, GFP_KERNEL, batch, objs))
+			kmem_cache_free_bulk(s, batch, objs);
+		cond_resched();
+	}
+	return ktime_to_ns(ktime_sub(ktime_get(), start)) / objects;
+}
+
+static int __init slab_bench_init(void)
+{
+	struct kmem_cache *s;
+	int batch;
+
+	if (objsize <= 0 || objects <= 0)
+		return -EINVAL;
+
+	s = kmem_cache_create("slab_bench", objsize, 0, 0, NULL);
+	if (!s)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slab_bench: objsize %d, %d objects per run\n",
+	       objsize, objects);
+	for (batch = 1; batch <= MAX_BATCH; batch <<= 1) {
+		unsigned long single = bench_single(s, batch);
+		unsigned long bulk = bench_bulk(s, batch);
+
+		printk(KERN_INFO "slab_bench: batch %3d: single %4lu ns/obj, "
+		       "bulk %4lu ns/obj\n", batch, single, bulk);
+	}
+
+	kmem_cache_destroy(s);
+	return 0;
+}
+module_init(slab_bench_init);
+
+static void __exit slab_bench_exit(void)
+{
+}
+module_exit(slab_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab allocator bulk API microbenchmark");
@@ -28,6 +28,7 @@
 #include <linux/memory.h>
 #include <linux/math64.h>
 #include <linux/fault-inject.h>
+#include <linux/uaccess.h>
 
 /*
  * Lock order:
@@ -137,6 +138,12 @@
  */
 #define MAX_PARTIAL 10
 
+/*
+ * Upper limit for the number of frozen partial slabs each cpu may keep
+ * (/sys/kernel/slab/<cache>/cpu_partial).
+ */
+#define MAX_CPU_PARTIAL 128
+
 #define DEBUG_DEFAULT_FLAGS (SLAB_DEBUG_FREE | SLAB_RED_ZONE | \
 				SLAB_POISON | SLAB_STORE_USER)
 
@@ -171,6 +178,7 @@
 /* Internal SLUB flags */
 #define __OBJECT_POISON		0x80000000 /* Poison object */
 #define __SYSFS_ADD_DEFERRED	0x40000000 /* Not yet visible via sysfs */
+#define __CMPXCHG_DOUBLE	0x20000000 /* Lockless fastpaths usable */
 
 static int kmem_size = sizeof(struct kmem_cache);
 
@@ -1322,10 +1330,15 @@ static inline int lock_and_freeze_slab(struct kmem_cache_node *n,
 
 /*
  * Try to allocate a partial slab from a specific node.
+ *
+ * While the list_lock is held, also move up to half of s->cpu_partial
+ * further slabs onto the cpu partial list so that the next few refills
+ * of this cpu do not have to come back here.
  */
-static struct page *get_partial_node(struct kmem_cache_node *n)
+static struct page *get_partial_node(struct kmem_cache *s,
+		struct kmem_cache_node *n, struct kmem_cache_cpu *c)
 {
-	struct page *page;
+	struct page *page = NULL, *next, *p;
 
 	/*
 	 * Racy check. If we mistakenly see no partial slabs then we
@@ -1337,11 +1350,22 @@ static struct page *get_partial_node(struct kmem_cache_node *n)
 		return NULL;
 
 	spin_lock(&n->list_lock);
-	list_for_each_entry(page, &n->partial, lru)
-		if (lock_and_freeze_slab(n, page))
-			goto out;
-	page = NULL;
-out:
+	list_for_each_entry_safe(p, next, &n->partial, lru) {
+		if (!lock_and_freeze_slab(n, p))
+			continue;
+		if (!page) {
+			page = p;
+		} else {
+			slab_unlock(p);
+			list_add_tail(&p->lru, &c->partial);
+			c->nr_partial++;
+			stat(c, CPU_PARTIAL_NODE);
+		}
+		if (SLABDEBUG && PageSlubDebug(p))
+			break;
+		if (c->nr_partial >= s->cpu_partial / 2)
+			break;
+	}
 	spin_unlock(&n->list_lock);
 	return page;
 }
@@ -1349,7 +1373,8 @@ out:
 /*
  * Get a page from somewhere. Search in increasing NUMA distances.
  */
-static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
+static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags,
+		struct kmem_cache_cpu *c)
 {
 #ifdef CONFIG_NUMA
 	struct zonelist *zonelist;
@@ -1388,7 +1413,7 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 
 		if (n && cpuset_zone_allowed_hardwall(zone, flags) &&
 				n->nr_partial > s->min_partial) {
-			page = get_partial_node(n);
+			page = get_partial_node(s, n, c);
 			if (page)
 				return page;
 		}
@@ -1400,16 +1425,17 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 /*
  * Get a partial page, lock it and return it.
  */
-static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node)
+static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node,
+		struct kmem_cache_cpu *c)
 {
 	struct page *page;
 	int searchnode = (node == -1) ? numa_node_id() : node;
 
-	page = get_partial_node(get_node(s, searchnode));
+	page = get_partial_node(s, get_node(s, searchnode), c);
 	if (page || (flags & __GFP_THISNODE))
 		return page;
 
-	return get_any_partial(s, flags);
+	return get_any_partial(s, flags, c);
 }
 
 /*
@@ -1460,6 +1486,15 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 	}
 }
 
+/*
+ * Every change of a cpu's freelist or cpu slab advances its transaction
+ * id, see slab_alloc_lockless() and slab_free_lockless().
+ */
+static inline unsigned long next_tid(unsigned long tid)
+{
+	return tid + 1;
+}
+
 /*
  * Remove the cpu slab
  */
@@ -1490,9 +1525,32 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 		page->inuse--;
 	}
 	c->page = NULL;
+	c->tid = next_tid(c->tid);
 	unfreeze_slab(s, page, tail);
 }
 
+/*
+ * Return the slabs on the cpu partial list to their nodes.
+ *
+ * Must be called with interrupts disabled, either on the cpu owning
+ * @c or for a cpu that has gone offline.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page, *next;
+
+	if (list_empty(&c->partial))
+		return;
+
+	stat(c, CPU_PARTIAL_DRAIN);
+	list_for_each_entry_safe(page, next, &c->partial, lru) {
+		list_del(&page->lru);
+		slab_lock(page);
+		unfreeze_slab(s, page, 1);
+	}
+	c->nr_partial = 0;
+}
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(c, CPUSLAB_FLUSH);
@@ -1509,8 +1567,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+	if (c->page)
 		flush_slab(s, c);
+	unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1638,6 +1699,7 @@ static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
 	stat(c, ALLOC_REFILL);
 
 load_freelist:
+	c->tid = next_tid(c->tid);
 	object = c->page->freelist;
 	if (unlikely(!object))
 		goto another_slab;
@@ -1657,7 +1719,19 @@ another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
-	new = get_partial(s, gfpflags, node);
+	if (!list_empty(&c->partial)) {
+		new = list_first_entry(&c->partial, struct page, lru);
+		if (node == -1 || page_to_nid(new) == node) {
+			list_del(&new->lru);
+			c->nr_partial--;
+			slab_lock(new);
+			c->page = new;
+			stat(c, CPU_PARTIAL_ALLOC);
+			goto load_freelist;
+		}
+	}
+
+	new = get_partial(s, gfpflags, node, c);
 	if (new) {
 		c->page = new;
 		stat(c, ALLOC_FROM_PARTIAL);
@@ -1695,6 +1769,116 @@ debug:
 	goto unlock_out;
 }
 
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+/*
+ * Lockless fastpaths.
+ *
+ * c->freelist and c->tid are replaced together with a cmpxchg that is
+ * atomic against interrupts on this cpu.  Preemption is disabled so we
+ * stay on the cpu whose kmem_cache_cpu we look at; an interrupt that
+ * allocates or frees in between changes c->tid and makes the cmpxchg
+ * fail, which also protects against the freelist head having been
+ * allocated and freed again (ABA).  All other updates of c->freelist
+ * and c->page happen with interrupts disabled and advance c->tid.
+ *
+ * Both helpers return 0 if the fastpath cannot be used and the caller
+ * has to take the interrupt disabling path.  That is always the case for
+ * caches without __CMPXCHG_DOUBLE, see check_cpu_slab_lockless().
+ */
+static inline void *get_freepointer_safe(struct kmem_cache_cpu *c,
+					 void **object)
+{
+	void *p;
+
+	/*
+	 * The object may have been allocated, and its slab freed, by an
+	 * interrupt since we read it.  The cmpxchg will then fail, but the
+	 * read must not fault.
+	 */
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	probe_kernel_read(&p, object + c->offset, sizeof(p));
+#else
+	p = object[c->offset];
+#endif
+	return p;
+}
+
+static __always_inline void *slab_alloc_lockless(struct kmem_cache *s,
+						 int node)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long tid;
+	void **object;
+
+	if (unlikely(!(s->flags & __CMPXCHG_DOUBLE)))
+		return NULL;
+
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+redo:
+	tid = c->tid;
+	barrier();
+	object = c->freelist;
+	if (unlikely(!object || !node_match(c, node))) {
+		preempt_enable();
+		return NULL;
+	}
+	if (unlikely(!cmpxchg_double_local(&c->freelist, &c->tid,
+					   object, tid,
+					   get_freepointer_safe(c, object),
+					   next_tid(tid)))) {
+		stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+		goto redo;
+	}
+	stat(c, ALLOC_FASTPATH);
+	preempt_enable();
+	return object;
+}
+
+static __always_inline int slab_free_lockless(struct kmem_cache *s,
+					      struct page *page, void **object)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long tid;
+	void **prior;
+
+	if (unlikely(!(s->flags & __CMPXCHG_DOUBLE)))
+		return 0;
+
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+redo:
+	tid = c->tid;
+	barrier();
+	if (unlikely(page != c->page || c->node < 0)) {
+		preempt_enable();
+		return 0;
+	}
+	prior = c->freelist;
+	object[c->offset] = prior;
+	if (unlikely(!cmpxchg_double_local(&c->freelist, &c->tid,
+					   prior, tid,
+					   object, next_tid(tid)))) {
+		stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+		goto redo;
+	}
+	stat(c, FREE_FASTPATH);
+	preempt_enable();
+	return 1;
+}
+#else
+static inline void *slab_alloc_lockless(struct kmem_cache *s, int node)
+{
+	return NULL;
+}
+
+static inline int slab_free_lockless(struct kmem_cache *s,
+				     struct page *page, void **object)
+{
+	return 0;
+}
+#endif
+
 /*
  * Inlined fastpath so that allocation functions (kmalloc, kmem_cache_alloc)
  * have the fastpath folded into their functions. So no function call
@@ -1703,7 +1887,8 @@ debug:
  * The fastpath works by first checking if the lockless freelist can be used.
  * If not then __slab_alloc is called for slow processing.
  *
- * Otherwise we can simply pick the next object from the lockless free list.
+ * Otherwise we can simply pick the next object from the lockless free list,
+ * without disabling interrupts where cmpxchg_double_local() is available.
  */
 static __always_inline void *slab_alloc(struct kmem_cache *s,
 		gfp_t gfpflags, int node, unsigned long addr)
@@ -1711,7 +1896,7 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	void **object;
 	struct kmem_cache_cpu *c;
 	unsigned long flags;
-	unsigned int objsize;
+	unsigned int objsize = s->objsize;
 
 	gfpflags &= gfp_allowed_mask;
 
@@ -1721,24 +1906,27 @@ static __always_inline void *slab_alloc(struct kmem_cache *s,
 	if (should_failslab(s->objsize, gfpflags))
 		return NULL;
 
-	local_irq_save(flags);
-	c = get_cpu_slab(s, smp_processor_id());
-	objsize = c->objsize;
-	if (unlikely(!c->freelist || !node_match(c, node)))
+	object = slab_alloc_lockless(s, node);
+	if (unlikely(!object)) {
+		local_irq_save(flags);
+		c = get_cpu_slab(s, smp_processor_id());
+		if (unlikely(!c->freelist || !node_match(c, node)))
 
-		object = __slab_alloc(s, gfpflags, node, addr, c);
+			object = __slab_alloc(s, gfpflags, node, addr, c);
 
-	else {
-		object = c->freelist;
-		c->freelist = object[c->offset];
-		stat(c, ALLOC_FASTPATH);
+		else {
+			object = c->freelist;
+			c->freelist = object[c->offset];
+			c->tid = next_tid(c->tid);
+			stat(c, ALLOC_FASTPATH);
+		}
+		local_irq_restore(flags);
 	}
-	local_irq_restore(flags);
 
 	if (unlikely((gfpflags & __GFP_ZERO) && object))
 		memset(object, 0, objsize);
 
-	kmemcheck_slab_alloc(s, gfpflags, object, c->objsize);
+	kmemcheck_slab_alloc(s, gfpflags, object, objsize);
 	kmemleak_alloc_recursive(object, objsize, 1, s->flags, gfpflags);
 
 	return object;
@@ -1822,9 +2010,22 @@ checks_ok:
 
 	/*
 	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
+	 * then add it, preferably to this cpu's partial list so that neither
+	 * this free nor the allocation that picks the slab up again has to
+	 * take the node's list_lock.
 	 */
 	if (unlikely(!prior)) {
+		if (likely(s->cpu_partial &&
+			   !(SLABDEBUG && PageSlubDebug(page)))) {
+			__SetPageSlubFrozen(page);
+			slab_unlock(page);
+			if (c->nr_partial >= s->cpu_partial)
+				unfreeze_partials(s, c);
+			list_add(&page->lru, &c->partial);
+			c->nr_partial++;
+			stat(c, CPU_PARTIAL_FREE);
+			return;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(c, FREE_ADD_PARTIAL);
 	}
@@ -1871,15 +2072,20 @@ static __always_inline void slab_free(struct kmem_cache *s,
 	unsigned long flags;
 
 	kmemleak_free_recursive(x, s->flags);
+	kmemcheck_slab_free(s, object, s->objsize);
+	debug_check_no_locks_freed(object, s->objsize);
+	if (!(s->flags & SLAB_DEBUG_OBJECTS))
+		debug_check_no_obj_freed(object, s->objsize);
+
+	if (slab_free_lockless(s, page, object))
+		return;
+
 	local_irq_save(flags);
 	c = get_cpu_slab(s, smp_processor_id());
-	kmemcheck_slab_free(s, object, c->objsize);
-	debug_check_no_locks_freed(object, c->objsize);
-	if (!(s->flags & SLAB_DEBUG_OBJECTS))
-		debug_check_no_obj_freed(object, c->objsize);
 	if (likely(page == c->page && c->node >= 0)) {
 		object[c->offset] = c->freelist;
 		c->freelist = object;
+		c->tid = next_tid(c->tid);
 		stat(c, FREE_FASTPATH);
 	} else
 		__slab_free(s, page, x, addr, c->offset);
@@ -1899,6 +2105,118 @@ void kmem_cache_free(struct kmem_cache *s, void *x)
 }
 EXPORT_SYMBOL(kmem_cache_free);
 
+/**
+ * kmem_cache_free_bulk - free an array of objects
+ * @s: the cache the objects belong to
+ * @size: number of objects in @p
+ * @p: the objects
+ *
+ * Equivalent to calling kmem_cache_free() on every object but interrupts
+ * are disabled and the cpu slab is looked up only once for the whole
+ * array.  Objects belonging to the current cpu slab go straight onto its
+ * lockless freelist; the rest take the usual __slab_free() path.
+ */
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i;
+
+	local_irq_save(flags);
+	c = get_cpu_slab(s, smp_processor_id());
+	for (i = 0; i < size; i++) {
+		void **object = p[i];
+		struct page *page = virt_to_head_page(object);
+
+		kmemleak_free_recursive(object, s->flags);
+		kmemcheck_slab_free(s, object, c->objsize);
+		debug_check_no_locks_freed(object, c->objsize);
+		if (!(s->flags & SLAB_DEBUG_OBJECTS))
+			debug_check_no_obj_freed(object, c->objsize);
+		if (likely(page == c->page && c->node >= 0)) {
+			object[c->offset] = c->freelist;
+			c->freelist = object;
+			c->tid = next_tid(c->tid);
+			stat(c, FREE_FASTPATH);
+		} else
+			__slab_free(s, page, object, _RET_IP_, c->offset);
+
+		trace_kmem_cache_free(_RET_IP_, object);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(kmem_cache_free_bulk);
+
+/**
+ * kmem_cache_alloc_bulk - allocate an array of objects
+ * @s: the cache to allocate from
+ * @gfpflags: allocation flags, as for kmem_cache_alloc()
+ * @size: number of objects wanted
+ * @p: array receiving the objects
+ *
+ * Fills @p by popping objects off the cpu slab's lockless freelist with
+ * interrupts disabled once for the whole array, refilling through
+ * __slab_alloc() whenever the freelist runs dry.
+ *
+ * Returns @size on success.  The allocation is all or nothing: if any
+ * object cannot be allocated the ones already obtained are freed again
+ * and 0 is returned.
+ */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t gfpflags, size_t size,
+			  void **p)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	size_t i, nr;
+
+	gfpflags &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(gfpflags);
+	might_sleep_if(gfpflags & __GFP_WAIT);
+
+	if (should_failslab(s->objsize, gfpflags))
+		return 0;
+
+	local_irq_save(flags);
+	c = get_cpu_slab(s, smp_processor_id());
+	for (i = 0; i < size; i++) {
+		void **object = c->freelist;
+
+		if (unlikely(!object)) {
+			object = __slab_alloc(s, gfpflags, -1, _RET_IP_, c);
+			if (unlikely(!object))
+				break;
+			/* __slab_alloc() may have enabled interrupts */
+			c = get_cpu_slab(s, smp_processor_id());
+		} else {
+			c->freelist = object[c->offset];
+			c->tid = next_tid(c->tid);
+			stat(c, ALLOC_FASTPATH);
+		}
+		p[i] = object;
+	}
+	local_irq_restore(flags);
+
+	nr = i;
+	for (i = 0; i < nr; i++) {
+		if (unlikely(gfpflags & __GFP_ZERO))
+			memset(p[i], 0, s->objsize);
+
+		kmemcheck_slab_alloc(s, gfpflags, p[i], s->objsize);
+		kmemleak_alloc_recursive(p[i], s->objsize, 1, s->flags,
+					 gfpflags);
+		trace_kmem_cache_alloc(_RET_IP_, p[i], s->objsize, s->size,
+				       gfpflags);
+	}
+
+	if (unlikely(nr < size)) {
+		kmem_cache_free_bulk(s, nr, p);
+		return 0;
+	}
+	return size;
+}
+EXPORT_SYMBOL(kmem_cache_alloc_bulk);
+
 /* Figure out on which slab page the object resides */
 static struct page *get_object_page(const void *x)
 {
@@ -2069,14 +2387,35 @@ static unsigned long calculate_alignment(unsigned long flags,
 	return ALIGN(align, sizeof(void *));
 }
 
+/*
+ * cmpxchg_double_local() faults unless c->freelist and c->tid are aligned
+ * to two words.  Structures from kmalloc() do not guarantee that, eg. with
+ * red zoning, so a cache with any such kmem_cache_cpu uses the interrupt
+ * disabling paths only.
+ */
+static void check_cpu_slab_lockless(struct kmem_cache *s,
+				    struct kmem_cache_cpu *c)
+{
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+	if (!system_has_cmpxchg_double() ||
+	    !IS_ALIGNED((unsigned long)&c->freelist, 2 * sizeof(void *)))
+		s->flags &= ~__CMPXCHG_DOUBLE;
+#endif
+}
+
 static void init_kmem_cache_cpu(struct kmem_cache *s,
 			struct kmem_cache_cpu *c)
 {
+	check_cpu_slab_lockless(s, c);
+
 	c->page = NULL;
 	c->freelist = NULL;
+	c->tid = 0;
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	INIT_LIST_HEAD(&c->partial);
+	c->nr_partial = 0;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2108,8 +2447,9 @@ init_kmem_cache_node(struct kmem_cache_node *n, struct kmem_cache *s)
  * likely able to get per cpu structures for all caches from the array defined
  * here. We must be able to cover all kmalloc caches during bootstrap.
  *
- * If the per cpu array is exhausted then fall back to kmalloc
- * of individual cachelines. No sharing is possible then.
+ * If the per cpu array is exhausted then fall back to a cache of
+ * cacheline aligned structures, which also keeps the two word alignment
+ * the lockless fastpaths need. No sharing is possible then.
  */
 #define NR_KMEM_CACHE_CPU 100
 
@@ -2119,6 +2459,9 @@ static DEFINE_PER_CPU(struct kmem_cache_cpu [NR_KMEM_CACHE_CPU],
 static DEFINE_PER_CPU(struct kmem_cache_cpu *, kmem_cache_cpu_free);
 static DECLARE_BITMAP(kmem_cach_cpu_free_init_once, CONFIG_NR_CPUS);
 
+/* Set up by kmem_cache_init(), kmalloc() is used until then */
+static struct kmem_cache *kmem_cache_cpu_cachep;
+
 static struct kmem_cache_cpu *alloc_kmem_cache_cpu(struct kmem_cache *s,
 							int cpu, gfp_t flags)
 {
@@ -2129,9 +2472,13 @@ static struct kmem_cache_cpu *alloc_kmem_cache_cpu(struct kmem_cache *s,
 				(void *)c->freelist;
 	else {
 		/* Table overflow: So allocate ourselves */
-		c = kmalloc_node(
-			ALIGN(sizeof(struct kmem_cache_cpu), cache_line_size()),
-			flags, cpu_to_node(cpu));
+		if (kmem_cache_cpu_cachep)
+			c = kmem_cache_alloc_node(kmem_cache_cpu_cachep,
+						  flags, cpu_to_node(cpu));
+		else
+			c = kmalloc_node(ALIGN(sizeof(struct kmem_cache_cpu),
+					       cache_line_size()),
+					 flags, cpu_to_node(cpu));
 		if (!c)
 			return NULL;
 	}
@@ -2144,6 +2491,7 @@ static void free_kmem_cache_cpu(struct kmem_cache_cpu *c, int cpu)
 {
 	if (c < per_cpu(kmem_cache_cpu, cpu) ||
 			c >= per_cpu(kmem_cache_cpu, cpu) + NR_KMEM_CACHE_CPU) {
+		/* kfree() finds the owning cache of either allocation */
 		kfree(c);
 		return;
 	}
@@ -2337,6 +2685,22 @@ static void set_min_partial(struct kmem_cache *s, unsigned long min)
 	s->min_partial = min;
 }
 
+/*
+ * Default number of partial slabs kept on each cpu.  Fewer for big
+ * objects, where every slab already holds a lot of memory.
+ */
+static void set_cpu_partial(struct kmem_cache *s)
+{
+	if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 4;
+	else if (s->size >= 256)
+		s->cpu_partial = 8;
+	else
+		s->cpu_partial = 16;
+}
+
 /*
  * calculate_sizes() determines the order and the distribution of data within
  * a slab object.
@@ -2472,6 +2836,10 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	s->objsize = size;
 	s->align = align;
 	s->flags = kmem_cache_flags(size, flags, name, ctor);
+#ifdef CONFIG_HAVE_CMPXCHG_DOUBLE
+	/* cleared again by check_cpu_slab_lockless() if not usable */
+	s->flags |= __CMPXCHG_DOUBLE;
+#endif
 
 	if (!calculate_sizes(s, -1))
 		goto error;
@@ -2493,6 +2861,7 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	 * list to avoid pounding the page allocator excessively.
 	 */
 	set_min_partial(s, ilog2(s->size));
+	set_cpu_partial(s);
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -3263,6 +3632,10 @@ void __init kmem_cache_init(void)
 	register_cpu_notifier(&slab_notifier);
 	kmem_size = offsetof(struct kmem_cache, cpu_slab) +
 				nr_cpu_ids * sizeof(struct kmem_cache_cpu *);
+
+	kmem_cache_cpu_cachep = kmem_cache_create("kmem_cache_cpu",
+			sizeof(struct kmem_cache_cpu), 2 * sizeof(void *),
+			SLAB_HWCACHE_ALIGN, NULL);
 #else
 	kmem_size = sizeof(struct kmem_cache);
 #endif
@@ -4088,6 +4461,29 @@ static ssize_t min_partial_store(struct kmem_cache *s, const char *buf,
 }
 SLAB_ATTR(min_partial);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%u\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long slabs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &slabs);
+	if (err)
+		return err;
+	if (slabs > MAX_CPU_PARTIAL)
+		return -EINVAL;
+
+	s->cpu_partial = slabs;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4396,6 +4792,11 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
+STAT_ATTR(CMPXCHG_DOUBLE_CPU_FAIL, cmpxchg_double_cpu_fail);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4404,6 +4805,7 @@ static struct attribute *slab_attrs[] = {
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
 	&min_partial_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4450,6 +4852,11 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_node_attr.attr,
+	&cpu_partial_drain_attr.attr,
+	&cmpxchg_double_cpu_fail_attr.attr,
 #endif
 	NULL
 };
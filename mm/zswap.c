@@ -0,0 +1,424 @@
+/*
+ * mm/zswap.c
+ *
+ * Compressed cache for swap pages.  zswap is a frontswap backend: pages
+ * on their way out to swap are compressed with LZO and kept in RAM, and
+ * are decompressed on swapin without any I/O.  The cache is bounded to
+ * max_pool_percent of RAM; pages that do not fit, or that do not
+ * compress well, are left to be written to the swap device as usual.
+ *
+ * zswap is disabled unless "zswap.enabled=1" is passed on the kernel
+ * command line.  Statistics are in /sys/kernel/debug/zswap/.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/frontswap.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <asm/atomic.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Total bytes used by the compressed pages, including slab overhead */
+static atomic_long_t zswap_pool_total_size = ATOMIC_LONG_INIT(0);
+/* The number of compressed pages currently stored in zswap */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be a 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+static u64 zswap_pool_limit_hit;	/* store failed, pool at max_pool_percent */
+static u64 zswap_reject_compress_poor;	/* compressed page too big to keep */
+static u64 zswap_reject_alloc_fail;	/* no memory for the compressed copy */
+static u64 zswap_reject_compress_fail;	/* lzo reported an error */
+static u64 zswap_duplicate_entry;	/* store replaced an older copy */
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default, fixed at boot for now) */
+static int zswap_enabled;
+module_param_named(enabled, zswap_enabled, bool, 0444);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/*
+ * Pages compressing to more than this are not worth keeping in RAM and
+ * are sent to the swap device instead.
+ */
+#define ZSWAP_MAX_COMPRESSED	(PAGE_SIZE / 4 * 3)
+
+/* lzo may expand incompressible data, so the buffers are two pages */
+#define ZSWAP_DSTMEM_ORDER	1
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * One compressed page.  The data follows the header in the same
+ * allocation, so a stored page costs a single kmalloc.
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	pgoff_t offset;
+	unsigned int length;
+	u8 data[0];
+};
+
+/*
+ * The per swap device tree of entries, indexed by swap offset.  The lock
+ * protects the tree only: an entry cannot be freed while it is being
+ * loaded, because both the load and any store or invalidate of the same
+ * offset happen with the swap cache page locked or the slot referenced.
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_workmem);
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	unsigned long pages;
+
+	pages = DIV_ROUND_UP(atomic_long_read(&zswap_pool_total_size),
+			     PAGE_SIZE);
+	return totalram_pages * zswap_max_pool_percent / 100 < pages;
+}
+
+static void zswap_entry_free(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry), &zswap_pool_total_size);
+	atomic_dec(&zswap_stored_pages);
+	kfree(entry);
+}
+
+static struct zswap_entry *zswap_rb_search(struct rb_root *root,
+					   pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns
+ * -EEXIST.
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			   struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				 struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	size_t dlen;
+	u8 *src, *dst;
+	int ret;
+
+	if (!tree)
+		return -ENODEV;
+
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		return -ENOMEM;
+	}
+
+	/* compress into this cpu's buffer */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_workmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK) {
+		zswap_reject_compress_fail++;
+		ret = -EINVAL;
+		goto put_dstmem;
+	}
+
+	if (dlen > ZSWAP_MAX_COMPRESSED) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto put_dstmem;
+	}
+
+	/* we are in swap writeout with preemption disabled: no sleeping */
+	entry = kmalloc(sizeof(*entry) + dlen, __GFP_NORETRY | __GFP_NOWARN);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto put_dstmem;
+	}
+	memcpy(entry->data, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	entry->offset = offset;
+	entry->length = dlen;
+	atomic_long_add(ksize(entry), &zswap_pool_total_size);
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		rb_erase(&dupentry->rbnode, &tree->rbroot);
+		zswap_entry_free(dupentry);
+	}
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+put_dstmem:
+	put_cpu_var(zswap_dstmem);
+	return ret;
+}
+
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	spin_unlock(&tree->lock);
+	if (!entry)
+		return -1;
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->data, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		rb_erase(&entry->rbnode, &tree->rbroot);
+	spin_unlock(&tree->lock);
+
+	if (entry)
+		zswap_entry_free(entry);
+}
+
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	/* swapoff: nothing else can reach the tree any more */
+	while ((node = rb_first(&tree->rbroot))) {
+		rb_erase(node, &tree->rbroot);
+		zswap_entry_free(rb_entry(node, struct zswap_entry, rbnode));
+	}
+	zswap_trees[type] = NULL;
+	kfree(tree);
+}
+
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("zswap: alloc failed, zswap disabled for swap type %d\n",
+			type);
+		return;
+	}
+
+	tree->rbroot = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.store = zswap_frontswap_store,
+	.load = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* per-cpu buffers
+**********************************/
+static int __init zswap_cpu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		void *dst, *wrk;
+
+		dst = (void *)__get_free_pages(GFP_KERNEL, ZSWAP_DSTMEM_ORDER);
+		wrk = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_workmem, cpu) = wrk;
+		if (!dst || !wrk)
+			goto cleanup;
+	}
+	return 0;
+
+cleanup:
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(zswap_dstmem, cpu))
+			free_pages((unsigned long)per_cpu(zswap_dstmem, cpu),
+				   ZSWAP_DSTMEM_ORDER);
+		kfree(per_cpu(zswap_workmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		per_cpu(zswap_workmem, cpu) = NULL;
+	}
+	return -ENOMEM;
+}
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static int pool_total_size_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_total_size);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(pool_total_size_fops, pool_total_size_get, NULL,
+			"%llu\n");
+
+static int stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(stored_pages_fops, stored_pages_get, NULL, "%llu\n");
+
+static struct dentry *zswap_debugfs_root;
+
+static int __init zswap_debugfs_init(void)
+{
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_compress_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_fail);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("pool_total_size", S_IRUGO,
+			zswap_debugfs_root, NULL, &pool_total_size_fops);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &stored_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init
+**********************************/
+static int __init init_zswap(void)
+{
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+	if (zswap_cpu_init()) {
+		pr_err("zswap: per-cpu buffer allocation failed\n");
+		return -ENOMEM;
+	}
+	frontswap_register_ops(&zswap_frontswap_ops);
+	if (zswap_debugfs_init())
+		pr_warning("zswap: debugfs initialization failed\n");
+	return 0;
+}
+module_init(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
@@ -0,0 +1,612 @@
+/*
+ * net/core/bpf_jit_test.c
+ *
+ * BPF JIT test: runs a corpus of socket filters, written the way tcpdump
+ * compiles them, plus filters exercising every opcode and corner case
+ * (ancillary data, header relative and out of range loads, division by
+ * zero, large shifts, the scratch memory), plus randomly generated
+ * programs, over a set of packets both with the interpreter and with the
+ * native code.  Any difference is reported, followed by the time taken
+ * by each.  Results are printed to the kernel log when the module is
+ * loaded; net.core.bpf_jit_enable must be set first.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/in.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <net/net_namespace.h>
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0444);
+MODULE_PARM_DESC(seed, "seed of the random program generator");
+
+static int random_progs = 1000;
+module_param(random_progs, int, 0444);
+MODULE_PARM_DESC(random_progs, "number of random programs to check");
+
+static int loops = 1000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "times each filter runs for the timing");
+
+#define NR_MEM_INIT	(2 * BPF_MEMWORDS)
+#define MAX_BODY	32
+#define MAX_INSNS	(NR_MEM_INIT + MAX_BODY + 1)
+
+#define INSN(code, k)			{ (code), 0, 0, (k) }
+#define JUMP(code, k, jt, jf)		{ (code), (jt), (jf), (k) }
+
+struct test_filter {
+	const char *name;
+	unsigned int len;
+	struct sock_filter insns[24];
+};
+
+static const struct test_filter corpus[] = {
+	{ "ip", 4, {
+		INSN(BPF_LD|BPF_H|BPF_ABS, 12),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 1),
+		INSN(BPF_RET|BPF_K, 65535),
+		INSN(BPF_RET|BPF_K, 0),
+	} },
+	{ "arp or ip6", 5, {
+		INSN(BPF_LD|BPF_H|BPF_ABS, 12),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_ARP, 1, 0),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IPV6, 0, 1),
+		INSN(BPF_RET|BPF_K, 96),
+		INSN(BPF_RET|BPF_K, 0),
+	} },
+	{ "tcp dst port 80", 11, {
+		INSN(BPF_LD|BPF_H|BPF_ABS, 12),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 8),
+		INSN(BPF_LD|BPF_B|BPF_ABS, 23),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_TCP, 0, 6),
+		INSN(BPF_LD|BPF_H|BPF_ABS, 20),
+		JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 4, 0),
+		INSN(BPF_LDX|BPF_B|BPF_MSH, 14),
+		INSN(BPF_LD|BPF_H|BPF_IND, 16),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, 80, 0, 1),
+		INSN(BPF_RET|BPF_K, 65535),
+		INSN(BPF_RET|BPF_K, 0),
+	} },
+	{ "udp port 53", 13, {
+		INSN(BPF_LD|BPF_H|BPF_ABS, 12),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, ETH_P_IP, 0, 10),
+		INSN(BPF_LD|BPF_B|BPF_ABS, 23),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 8),
+		INSN(BPF_LD|BPF_H|BPF_ABS, 20),
+		JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x1fff, 6, 0),
+		INSN(BPF_LDX|BPF_B|BPF_MSH, 14),
+		INSN(BPF_LD|BPF_H|BPF_IND, 14),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, 53, 2, 0),
+		INSN(BPF_LD|BPF_H|BPF_IND, 16),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, 53, 0, 1),
+		INSN(BPF_RET|BPF_K, 65535),
+		INSN(BPF_RET|BPF_K, 0),
+	} },
+	{ "host 10.0.0.1", 7, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, 26),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x0a000001, 3, 0),
+		INSN(BPF_LD|BPF_W|BPF_ABS, 30),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x0a000001, 1, 0),
+		INSN(BPF_RET|BPF_K, 0),
+		INSN(BPF_LD|BPF_W|BPF_LEN, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "ancillary", 9, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+		INSN(BPF_MISC|BPF_TAX, 0),
+		INSN(BPF_LD|BPF_H|BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+		INSN(BPF_ALU|BPF_LSH|BPF_K, 16),
+		INSN(BPF_ALU|BPF_OR|BPF_X, 0),
+		INSN(BPF_MISC|BPF_TAX, 0),
+		INSN(BPF_LD|BPF_B|BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "unknown ancillary", 2, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_MAX),
+		INSN(BPF_RET|BPF_K, 1),
+	} },
+	{ "network and link header", 6, {
+		INSN(BPF_LD|BPF_B|BPF_ABS, SKF_NET_OFF + 9),
+		INSN(BPF_MISC|BPF_TAX, 0),
+		INSN(BPF_LD|BPF_W|BPF_ABS, SKF_NET_OFF + 12),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_LD|BPF_H|BPF_ABS, SKF_LL_OFF + 12),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "out of range", 5, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, 56),
+		INSN(BPF_LDX|BPF_IMM, 0x7ffffff0),
+		INSN(BPF_LD|BPF_H|BPF_IND, 0x20),
+		INSN(BPF_LD|BPF_B|BPF_ABS, 1000),
+		INSN(BPF_RET|BPF_K, 1),
+	} },
+	{ "negative index", 4, {
+		INSN(BPF_LDX|BPF_IMM, -4),
+		INSN(BPF_LD|BPF_B|BPF_IND, 2),
+		INSN(BPF_LD|BPF_W|BPF_IND, 6),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "alu", 13, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, 14),
+		INSN(BPF_ALU|BPF_ADD|BPF_K, 0x12345678),
+		INSN(BPF_ALU|BPF_SUB|BPF_K, 1),
+		INSN(BPF_ALU|BPF_ADD|BPF_K, -256),
+		INSN(BPF_ALU|BPF_MUL|BPF_K, 3),
+		INSN(BPF_ALU|BPF_DIV|BPF_K, 7),
+		INSN(BPF_ALU|BPF_AND|BPF_K, 0xffff00ff),
+		INSN(BPF_ALU|BPF_OR|BPF_K, 0x80000000),
+		INSN(BPF_ALU|BPF_LSH|BPF_K, 3),
+		INSN(BPF_ALU|BPF_RSH|BPF_K, 5),
+		INSN(BPF_ALU|BPF_DIV|BPF_K, 16),
+		INSN(BPF_ALU|BPF_NEG, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "alu x", 11, {
+		INSN(BPF_LDX|BPF_W|BPF_LEN, 0),
+		INSN(BPF_LD|BPF_W|BPF_ABS, 26),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_ALU|BPF_MUL|BPF_X, 0),
+		INSN(BPF_ALU|BPF_SUB|BPF_X, 0),
+		INSN(BPF_ALU|BPF_DIV|BPF_X, 0),
+		INSN(BPF_ALU|BPF_OR|BPF_X, 0),
+		INSN(BPF_ALU|BPF_AND|BPF_X, 0),
+		INSN(BPF_LDX|BPF_IMM, 7),
+		INSN(BPF_ALU|BPF_LSH|BPF_X, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "division by zero", 4, {
+		INSN(BPF_LD|BPF_IMM, 10),
+		INSN(BPF_ALU|BPF_DIV|BPF_X, 0),
+		INSN(BPF_RET|BPF_K, 1),
+		INSN(BPF_RET|BPF_K, 2),
+	} },
+	{ "large shifts", 8, {
+		INSN(BPF_LD|BPF_IMM, 0x80000001),
+		INSN(BPF_ALU|BPF_LSH|BPF_K, 32),
+		INSN(BPF_MISC|BPF_TAX, 0),
+		INSN(BPF_LD|BPF_W|BPF_ABS, 14),
+		INSN(BPF_ALU|BPF_RSH|BPF_K, 33),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_ALU|BPF_RSH|BPF_K, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "scratch memory", 10, {
+		INSN(BPF_LD|BPF_W|BPF_ABS, 14),
+		INSN(BPF_ST, 0),
+		INSN(BPF_LDX|BPF_IMM, 5),
+		INSN(BPF_STX, 15),
+		INSN(BPF_LD|BPF_MEM, 15),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_LDX|BPF_MEM, 0),
+		INSN(BPF_ALU|BPF_ADD|BPF_X, 0),
+		INSN(BPF_MISC|BPF_TXA, 0),
+		INSN(BPF_RET|BPF_A, 0),
+	} },
+	{ "jumps", 16, {
+		INSN(BPF_JMP|BPF_JA, 1),
+		INSN(BPF_RET|BPF_K, 0),
+		INSN(BPF_LD|BPF_W|BPF_ABS, 26),
+		JUMP(BPF_JMP|BPF_JGT|BPF_K, 0x12345678, 0, 0),
+		JUMP(BPF_JMP|BPF_JGE|BPF_K, 0x0a000001, 1, 0),
+		INSN(BPF_RET|BPF_K, 1),
+		INSN(BPF_LDX|BPF_IMM, 0x0a000001),
+		JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 0, 1),
+		INSN(BPF_RET|BPF_K, 2),
+		JUMP(BPF_JMP|BPF_JGE|BPF_X, 0, 1, 1),
+		INSN(BPF_RET|BPF_K, 3),
+		JUMP(BPF_JMP|BPF_JEQ|BPF_X, 0, 0, 1),
+		INSN(BPF_RET|BPF_K, 4),
+		JUMP(BPF_JMP|BPF_JSET|BPF_X, 0, 1, 0),
+		INSN(BPF_RET|BPF_K, 5),
+		INSN(BPF_RET|BPF_K, 6),
+	} },
+	{ "jset", 6, {
+		INSN(BPF_LD|BPF_B|BPF_ABS, 47),
+		JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x02, 0, 1),
+		INSN(BPF_RET|BPF_K, 1),
+		JUMP(BPF_JMP|BPF_JSET|BPF_K, 0x12345, 1, 0),
+		INSN(BPF_RET|BPF_K, 2),
+		INSN(BPF_RET|BPF_K, 3),
+	} },
+};
+
+/* Ethernet, IPv4, TCP SYN 10.0.0.2:1234 -> 10.0.0.1:80 */
+static const u8 pkt_tcp[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00, 0x45, 0x00,
+	0x00, 0x28, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00,
+	0x00, 0x01, 0x04, 0xd2, 0x00, 0x50, 0x00, 0x00,
+	0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x50, 0x02,
+	0x20, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* Ethernet, IPv4 with options, UDP 10.0.0.1:53 -> 10.0.0.3:1024 */
+static const u8 pkt_udp[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00, 0x46, 0x00,
+	0x00, 0x24, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00,
+	0x00, 0x03, 0x01, 0x01, 0x01, 0x00, 0x00, 0x35,
+	0x04, 0x00, 0x00, 0x0c, 0x00, 0x00, 0xde, 0xad,
+	0xbe, 0xef,
+};
+
+/* Ethernet, IPv4 fragment of a TCP datagram */
+static const u8 pkt_frag[] = {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x00, 0x45, 0x00,
+	0x00, 0x24, 0x12, 0x35, 0x00, 0xb9, 0x40, 0x06,
+	0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00,
+	0x00, 0x01, 0x00, 0x50, 0x00, 0x50, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+/* Ethernet, ARP request */
+static const u8 pkt_arp[] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x08, 0x06, 0x00, 0x01,
+	0x08, 0x00, 0x06, 0x04, 0x00, 0x01, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x0a, 0x00, 0x00, 0x02,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x00,
+	0x00, 0x01,
+};
+
+/* Ethernet, IPv6, start of an ICMPv6 echo request */
+static const u8 pkt_ip6[] = {
+	0x33, 0x33, 0x00, 0x00, 0x00, 0x01, 0x00, 0x66,
+	0x77, 0x88, 0x99, 0xaa, 0x86, 0xdd, 0x60, 0x00,
+	0x00, 0x00, 0x00, 0x08, 0x3a, 0xff, 0xfe, 0x80,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x66,
+	0x77, 0xff, 0xfe, 0x88, 0x99, 0xaa, 0xff, 0x02,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x80, 0x00,
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x01,
+};
+
+struct test_packet {
+	const char *name;
+	const u8 *data;
+	unsigned int len;
+	unsigned int linear;	/* bytes in the linear part */
+	__be16 protocol;
+	u8 pkt_type;
+};
+
+static const struct test_packet packets[] = {
+	{ "tcp", pkt_tcp, sizeof(pkt_tcp), sizeof(pkt_tcp),
+	  htons(ETH_P_IP), PACKET_HOST },
+	{ "udp", pkt_udp, sizeof(pkt_udp), sizeof(pkt_udp),
+	  htons(ETH_P_IP), PACKET_OTHERHOST },
+	{ "frag", pkt_frag, sizeof(pkt_frag), sizeof(pkt_frag),
+	  htons(ETH_P_IP), PACKET_HOST },
+	{ "arp", pkt_arp, sizeof(pkt_arp), sizeof(pkt_arp),
+	  htons(ETH_P_ARP), PACKET_BROADCAST },
+	{ "ip6", pkt_ip6, sizeof(pkt_ip6), sizeof(pkt_ip6),
+	  htons(ETH_P_IPV6), PACKET_MULTICAST },
+	{ "runt", pkt_tcp, 13, 13, htons(ETH_P_IP), PACKET_HOST },
+	{ "tcp paged", pkt_tcp, sizeof(pkt_tcp), 20,
+	  htons(ETH_P_IP), PACKET_HOST },
+	{ "udp paged", pkt_udp, sizeof(pkt_udp), 35,
+	  htons(ETH_P_IP), PACKET_HOST },
+};
+
+#define NR_PACKETS	ARRAY_SIZE(packets)
+
+static struct sk_buff *skbs[NR_PACKETS];
+static unsigned int failures;
+
+static struct sk_buff *build_skb(const struct test_packet *tp)
+{
+	unsigned int paged = tp->len - tp->linear;
+	struct sk_buff *skb;
+	struct page *page;
+
+	skb = alloc_skb(tp->linear, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	memcpy(skb_put(skb, tp->linear), tp->data, tp->linear);
+
+	if (paged) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), tp->data + tp->linear, paged);
+		skb_fill_page_desc(skb, 0, page, 0, paged);
+		skb->len += paged;
+		skb->data_len += paged;
+		skb->truesize += paged;
+	}
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = tp->protocol;
+	skb->pkt_type = tp->pkt_type;
+	skb->dev = init_net.loopback_dev;
+	return skb;
+}
+
+static struct sk_filter *build_filter(const struct sock_filter *insns,
+				      unsigned int len)
+{
+	struct sk_filter *fp;
+
+	fp = kmalloc(sizeof(*fp) + len * sizeof(*insns), GFP_KERNEL);
+	if (!fp)
+		return NULL;
+	memcpy(fp->insns, insns, len * sizeof(*insns));
+	atomic_set(&fp->refcnt, 1);
+	fp->len = len;
+	fp->bpf_func = NULL;
+
+	if (sk_chk_filter(fp->insns, fp->len)) {
+		kfree(fp);
+		return NULL;
+	}
+	bpf_jit_compile(fp);
+	return fp;
+}
+
+static void release_filter(struct sk_filter *fp)
+{
+	bpf_jit_free(fp);
+	kfree(fp);
+}
+
+/* Returns the number of packets on which the two disagree */
+static int check_filter(const char *name, struct sk_filter *fp)
+{
+	unsigned int interp, jit;
+	int i, bad = 0;
+
+	for (i = 0; i < NR_PACKETS; i++) {
+		interp = sk_run_filter(skbs[i], fp->insns, fp->len);
+		jit = fp->bpf_func(skbs[i], fp->insns);
+		if (interp != jit) {
+			printk(KERN_ERR "bpf_jit_test: %s on %s: interpreter "
+			       "returned %u, jit %u\n", name,
+			       packets[i].name, interp, jit);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+static void time_filter(const struct test_filter *tf, struct sk_filter *fp)
+{
+	s64 interp_ns, jit_ns;
+	ktime_t start;
+	int i, n;
+
+	start = ktime_get();
+	for (n = 0; n < loops; n++)
+		for (i = 0; i < NR_PACKETS; i++)
+			sk_run_filter(skbs[i], fp->insns, fp->len);
+	interp_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (n = 0; n < loops; n++)
+		for (i = 0; i < NR_PACKETS; i++)
+			fp->bpf_func(skbs[i], fp->insns);
+	jit_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	printk(KERN_INFO "bpf_jit_test: %-24s interpreter %8lld ns, "
+	       "jit %8lld ns\n", tf->name, interp_ns, jit_ns);
+}
+
+static u32 rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed;
+}
+
+/* A load offset, biased towards the interesting places */
+static u32 rnd_offset(void)
+{
+	static const int ad[] = {
+		SKF_AD_PROTOCOL, SKF_AD_PKTTYPE, SKF_AD_IFINDEX,
+	};
+
+	switch (rnd() % 8) {
+	case 0:
+		return SKF_AD_OFF + ad[rnd() % ARRAY_SIZE(ad)];
+	case 1:
+		return SKF_NET_OFF + rnd() % 48;
+	case 2:
+		return SKF_LL_OFF + rnd() % 64;
+	case 3:
+		return rnd();
+	default:
+		return rnd() % 80;
+	}
+}
+
+static const u16 random_codes[] = {
+	BPF_ALU|BPF_ADD|BPF_K, BPF_ALU|BPF_ADD|BPF_X,
+	BPF_ALU|BPF_SUB|BPF_K, BPF_ALU|BPF_SUB|BPF_X,
+	BPF_ALU|BPF_MUL|BPF_K, BPF_ALU|BPF_MUL|BPF_X,
+	BPF_ALU|BPF_DIV|BPF_K, BPF_ALU|BPF_DIV|BPF_X,
+	BPF_ALU|BPF_AND|BPF_K, BPF_ALU|BPF_AND|BPF_X,
+	BPF_ALU|BPF_OR|BPF_K, BPF_ALU|BPF_OR|BPF_X,
+	BPF_ALU|BPF_LSH|BPF_K, BPF_ALU|BPF_LSH|BPF_X,
+	BPF_ALU|BPF_RSH|BPF_K, BPF_ALU|BPF_RSH|BPF_X,
+	BPF_ALU|BPF_NEG,
+	BPF_JMP|BPF_JA,
+	BPF_JMP|BPF_JGT|BPF_K, BPF_JMP|BPF_JGE|BPF_K,
+	BPF_JMP|BPF_JEQ|BPF_K, BPF_JMP|BPF_JSET|BPF_K,
+	BPF_JMP|BPF_JGT|BPF_X, BPF_JMP|BPF_JGE|BPF_X,
+	BPF_JMP|BPF_JEQ|BPF_X, BPF_JMP|BPF_JSET|BPF_X,
+	BPF_LD|BPF_W|BPF_ABS, BPF_LD|BPF_H|BPF_ABS, BPF_LD|BPF_B|BPF_ABS,
+	BPF_LD|BPF_W|BPF_IND, BPF_LD|BPF_H|BPF_IND, BPF_LD|BPF_B|BPF_IND,
+	BPF_LD|BPF_W|BPF_LEN, BPF_LDX|BPF_W|BPF_LEN, BPF_LDX|BPF_B|BPF_MSH,
+	BPF_LD|BPF_IMM, BPF_LDX|BPF_IMM,
+	BPF_LD|BPF_MEM, BPF_LDX|BPF_MEM, BPF_ST, BPF_STX,
+	BPF_MISC|BPF_TAX, BPF_MISC|BPF_TXA,
+	BPF_RET|BPF_K, BPF_RET|BPF_A,
+};
+
+/*
+ * Random program: every scratch memory word is initialised first, as the
+ * interpreter would otherwise read whatever is on its stack.
+ */
+static unsigned int random_filter(struct sock_filter *insns)
+{
+	unsigned int body = 1 + rnd() % MAX_BODY;
+	unsigned int len = NR_MEM_INIT + body + 1;
+	struct sock_filter *f;
+	unsigned int i, left;
+
+	for (i = 0; i < BPF_MEMWORDS; i++) {
+		insns[2 * i] = (struct sock_filter)INSN(BPF_LD|BPF_IMM, rnd());
+		insns[2 * i + 1] = (struct sock_filter)INSN(BPF_ST, i);
+	}
+
+	for (i = NR_MEM_INIT; i < len - 1; i++) {
+		f = &insns[i];
+		left = len - i - 1;	/* insns after this one */
+		f->code = random_codes[rnd() % ARRAY_SIZE(random_codes)];
+		f->jt = f->jf = 0;
+		f->k = rnd();
+
+		switch (f->code) {
+		case BPF_ALU|BPF_DIV|BPF_K:
+			f->k = f->k % 64 ? : 1;
+			break;
+		case BPF_ALU|BPF_LSH|BPF_K:
+		case BPF_ALU|BPF_RSH|BPF_K:
+			f->k %= 40;
+			break;
+		case BPF_JMP|BPF_JA:
+			f->k %= left;
+			break;
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_K:
+			if (rnd() & 1)
+				f->k %= 256;
+			/* fall through */
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			f->jt = rnd() % left;
+			f->jf = rnd() % left;
+			break;
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LDX|BPF_B|BPF_MSH:
+			f->k = rnd_offset();
+			break;
+		case BPF_LD|BPF_W|BPF_IND:
+		case BPF_LD|BPF_H|BPF_IND:
+		case BPF_LD|BPF_B|BPF_IND:
+			f->k = rnd() % 64;
+			break;
+		case BPF_LDX|BPF_IMM:
+			if (rnd() & 1)
+				f->k %= 80;
+			break;
+		case BPF_LD|BPF_MEM:
+		case BPF_LDX|BPF_MEM:
+		case BPF_ST:
+		case BPF_STX:
+			f->k %= BPF_MEMWORDS;
+			break;
+		}
+	}
+	insns[len - 1] = (struct sock_filter)INSN(BPF_RET|BPF_A, 0);
+
+	return len;
+}
+
+static int __init bpf_jit_test_init(void)
+{
+	struct sock_filter insns[MAX_INSNS];
+	struct sk_filter *fp;
+	unsigned int not_compiled = 0;
+	char name[32];
+	int i, err = -ENOMEM;
+
+	if (!bpf_jit_enable) {
+		printk(KERN_ERR "bpf_jit_test: net.core.bpf_jit_enable is "
+		       "not set\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < NR_PACKETS; i++) {
+		skbs[i] = build_skb(&packets[i]);
+		if (!skbs[i])
+			goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(corpus); i++) {
+		fp = build_filter(corpus[i].insns, corpus[i].len);
+		if (!fp) {
+			printk(KERN_ERR "bpf_jit_test: %s: rejected\n",
+			       corpus[i].name);
+			failures++;
+			continue;
+		}
+		if (!fp->bpf_func) {
+			printk(KERN_ERR "bpf_jit_test: %s: not compiled\n",
+			       corpus[i].name);
+			failures++;
+		} else {
+			failures += check_filter(corpus[i].name, fp);
+			if (loops > 0)
+				time_filter(&corpus[i], fp);
+		}
+		release_filter(fp);
+	}
+
+	for (i = 0; i < random_progs; i++) {
+		fp = build_filter(insns, random_filter(insns));
+		if (!fp)
+			continue;
+		if (!fp->bpf_func) {
+			not_compiled++;
+		} else {
+			snprintf(name, sizeof(name), "random program %d", i);
+			failures += check_filter(name, fp);
+		}
+		release_filter(fp);
+	}
+
+	printk(KERN_INFO "bpf_jit_test: %zu filters, %d random programs "
+	       "(%u not compiled), %u failures\n", ARRAY_SIZE(corpus),
+	       random_progs, not_compiled, failures);
+	err = failures ? -EINVAL : 0;
+out:
+	for (i = 0; i < NR_PACKETS; i++)
+		if (skbs[i])
+			kfree_skb(skbs[i]);
+	return err;
+}
+module_init(bpf_jit_test_init);
+
+static void __exit bpf_jit_test_exit(void)
+{
+}
+module_exit(bpf_jit_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BPF JIT against interpreter test");
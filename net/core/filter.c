@@ -64,6 +64,83 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/**
+ *	bpf_load_pointer - find the bytes a filter load refers to
+ *	@skb: buffer the filter runs on
+ *	@k: offset, may be relative to the link or network header
+ *	@size: number of bytes to load
+ *	@buffer: room for @size bytes if they are not linear
+ *
+ * Out of line version of the lookup done by the interpreter, for use
+ * by native code generated from a filter.  Returns NULL if the bytes
+ * are not in the packet or @k refers to ancillary data.
+ */
+void *bpf_load_pointer(struct sk_buff *skb, int k, unsigned int size,
+		       void *buffer)
+{
+	return load_pointer(skb, k, size, buffer);
+}
+
+/**
+ *	bpf_load_ancillary - load ancillary data into the accumulator
+ *	@skb: buffer the filter runs on
+ *	@k: offset of the failed load
+ *	@A: accumulator
+ *	@X: index register
+ *	@res: new value of the accumulator
+ *
+ * Handle ancillary data, which are impossible (or very difficult) to get
+ * parsing packet contents.  Returns 0 on success, or -EINVAL if the
+ * filter has to return 0.
+ */
+int bpf_load_ancillary(struct sk_buff *skb, int k, u32 A, u32 X, u32 *res)
+{
+	struct nlattr *nla;
+
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*res = ntohs(skb->protocol);
+		return 0;
+	case SKF_AD_PKTTYPE:
+		*res = skb->pkt_type;
+		return 0;
+	case SKF_AD_IFINDEX:
+		*res = skb->dev->ifindex;
+		return 0;
+	case SKF_AD_NLATTR:
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = nla_find((struct nlattr *)&skb->data[A],
+			       skb->len - A, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	case SKF_AD_NLATTR_NEST:
+		if (skb_is_nonlinear(skb))
+			return -EINVAL;
+		if (A > skb->len - sizeof(struct nlattr))
+			return -EINVAL;
+
+		nla = (struct nlattr *)&skb->data[A];
+		if (nla->nla_len > A - skb->len)
+			return -EINVAL;
+
+		nla = nla_find_nested(nla, X);
+		if (nla)
+			*res = (void *)nla - (void *)skb->data;
+		else
+			*res = 0;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +165,7 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -289,58 +365,9 @@ load_b:
 			return 0;
 		}
 
-		/*
-		 * Handle ancillary data, which are impossible
-		 * (or very difficult) to get parsing packet contents.
-		 */
-		switch (k-SKF_AD_OFF) {
-		case SKF_AD_PROTOCOL:
-			A = ntohs(skb->protocol);
-			continue;
-		case SKF_AD_PKTTYPE:
-			A = skb->pkt_type;
-			continue;
-		case SKF_AD_IFINDEX:
-			A = skb->dev->ifindex;
-			continue;
-		case SKF_AD_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		case SKF_AD_NLATTR_NEST: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > A - skb->len)
-				return 0;
-
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		default:
+		/* Ancillary data */
+		if (bpf_load_ancillary(skb, k, A, X, &A))
 			return 0;
-		}
 	}
 
 	return 0;
@@ -507,6 +534,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = NULL;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -514,6 +542,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
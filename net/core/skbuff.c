@@ -73,6 +73,61 @@
 static struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * Per-cpu stash of sk_buff heads for softirq context, where most skbs
+ * are both allocated (RX refill) and freed (TX completion).  It is
+ * refilled and drained with the slab bulk API so the slab fastpath is
+ * entered once per SKB_HEAD_CACHE_BULK heads instead of once per skb.
+ * Nothing outside softirq context touches it, so it needs no locking;
+ * heads left behind by an offlined cpu are reused when it comes back.
+ */
+#define SKB_HEAD_CACHE_SIZE	64
+#define SKB_HEAD_CACHE_BULK	16
+
+struct skb_head_cache {
+	unsigned int	count;
+	void		*heads[SKB_HEAD_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct skb_head_cache, skb_head_cache);
+
+static inline int skb_head_cache_usable(void)
+{
+	return in_softirq() && !in_irq();
+}
+
+static struct sk_buff *skb_head_cache_alloc(gfp_t gfp_mask)
+{
+	struct skb_head_cache *hc = &__get_cpu_var(skb_head_cache);
+
+	if (unlikely(!hc->count)) {
+		hc->count = kmem_cache_alloc_bulk(skbuff_head_cache, gfp_mask,
+						  SKB_HEAD_CACHE_BULK,
+						  hc->heads);
+		if (unlikely(!hc->count))
+			return NULL;
+	}
+	return hc->heads[--hc->count];
+}
+
+static void skb_head_free(struct sk_buff *skb)
+{
+	struct skb_head_cache *hc;
+
+	if (!skb_head_cache_usable()) {
+		kmem_cache_free(skbuff_head_cache, skb);
+		return;
+	}
+
+	hc = &__get_cpu_var(skb_head_cache);
+	if (unlikely(hc->count == SKB_HEAD_CACHE_SIZE)) {
+		hc->count -= SKB_HEAD_CACHE_BULK;
+		kmem_cache_free_bulk(skbuff_head_cache, SKB_HEAD_CACHE_BULK,
+				     hc->heads + hc->count);
+	}
+	hc->heads[hc->count++] = skb;
+}
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -180,7 +235,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 	cache = fclone ? skbuff_fclone_cache : skbuff_head_cache;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	if (!fclone && node == -1 && skb_head_cache_usable())
+		skb = skb_head_cache_alloc(gfp_mask & ~__GFP_DMA);
+	else
+		skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
 	if (!skb)
 		goto out;
 
@@ -234,7 +292,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 out:
 	return skb;
 nodata:
-	kmem_cache_free(cache, skb);
+	if (fclone)
+		kmem_cache_free(cache, skb);
+	else
+		skb_head_free(skb);
 	skb = NULL;
 	goto out;
 }
@@ -364,7 +425,7 @@ static void kfree_skbmem(struct sk_buff *skb)
 
 	switch (skb->fclone) {
 	case SKB_FCLONE_UNAVAILABLE:
-		kmem_cache_free(skbuff_head_cache, skb);
+		skb_head_free(skb);
 		break;
 
 	case SKB_FCLONE_ORIG:
@@ -546,6 +607,7 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
+	new->rxhash		= old->rxhash;
 	new->iif		= old->iif;
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
@@ -132,12 +132,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net)			&&
 		    sk2 != sk					&&
 		    (bitmap || sk2->sk_hash == num)		&&
 		    (!sk2->sk_reuse || !sk->sk_reuse)		&&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2))			&&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if
 			|| sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -285,7 +288,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash = udp_hashfn(net, hnum);
 	struct udp_hslot *hslot = &udptable->hash[hash];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 phash = 0;
 
 	rcu_read_lock();
 begin:
@@ -297,6 +301,21 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				phash = inet_ehashfn(net, daddr, hnum,
+						     saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			/*
+			 * Spread datagrams over equally good SO_REUSEPORT
+			 * sockets, keeping each 4-tuple on one socket.
+			 */
+			matches++;
+			if (((u64)phash * matches) >> 32 == 0)
+				result = sk;
+			phash = next_pseudo_random32(phash);
 		}
 	}
 	/*
@@ -510,6 +529,44 @@ static void udp4_hwcsum_outgoing(struct sock *sk, struct sk_buff *skb,
 	}
 }
 
+/*
+ * 	udp_gso_setup  -  mark a UDP_SEGMENT datagram for segmentation
+ * 	@sk: 	socket we are sending on
+ * 	@skb: 	the single sk_buff holding the datagram
+ *
+ * 	The datagram was built in one piece by ip_append_data(); it is cut
+ * 	into cork.gso_size sized datagrams by udp4_gso_segment(), either in
+ * 	dev_gso_segment() or by the device.
+ */
+static int udp_gso_setup(struct sock *sk, struct sk_buff *skb)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	unsigned int mss = inet->cork.gso_size;
+	unsigned int datalen = udp_sk(sk)->len - sizeof(struct udphdr);
+	unsigned int hlen = skb_network_header_len(skb) + sizeof(struct udphdr);
+
+	/* Every datagram on the wire must still fit the path mtu. */
+	if (hlen + min(datalen, mss) > inet->cork.fragsize)
+		return -EINVAL;
+
+	if (datalen <= mss)
+		return 0;
+
+	if (datalen > mss * UDP_MAX_SEGMENTS ||
+	    sk->sk_no_check == UDP_CSUM_NOXMIT || IS_UDPLITE(sk))
+		return -EINVAL;
+
+	/* IPsec headers or a fragmented queue defeat the offload. */
+	if (skb->ip_summed != CHECKSUM_PARTIAL ||
+	    skb_queue_len(&sk->sk_write_queue) != 1)
+		return -EIO;
+
+	skb_shinfo(skb)->gso_size = mss;
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(datalen, mss);
+	return 0;
+}
+
 /*
  * Push out all pending data as one UDP datagram. Socket is locked.
  */
@@ -537,6 +594,14 @@ static int udp_push_pending_frames(struct sock *sk)
 	uh->len = htons(up->len);
 	uh->check = 0;
 
+	if (inet->cork.gso_size) {
+		err = udp_gso_setup(sk, skb);
+		if (err) {
+			ip_flush_pending_frames(sk);
+			goto out;
+		}
+	}
+
 	if (is_udplite)  				 /*     UDP-Lite      */
 		csum  = udplite_csum_outgoing(sk, skb);
 
@@ -748,6 +813,7 @@ back_from_confirm:
 	inet->cork.fl.fl_ip_dport = dport;
 	inet->cork.fl.fl4_src = saddr;
 	inet->cork.fl.fl_ip_sport = inet->sport;
+	inet->cork.gso_size = up->gso_size;
 	up->pending = AF_INET;
 
 do_append_data:
@@ -1030,6 +1096,9 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	int is_udplite = IS_UDPLITE(sk);
 	int rc;
 
+	if (inet_sk(sk)->daddr)
+		sock_rps_save_rxhash(sk, skb->rxhash);
+
 	if ((rc = sock_queue_rcv_skb(sk, skb)) < 0) {
 		/* Note that an ENOMEM error is charged twice */
 		if (rc == -ENOMEM) {
@@ -1401,6 +1470,14 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	case UDP_SEGMENT:
+		if (is_udplite)		/* partial coverage breaks GSO */
+			return -ENOPROTOOPT;
+		if (val < 0 || val > 0xFFFF)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1483,6 +1560,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_SEGMENT:
+		val = up->gso_size;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -1853,6 +1934,68 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ * Cut a UDP_SEGMENT datagram into gso_size sized UDP datagrams. The
+ * checksum is fixed up per segment as in tcp_tso_segment(): only the
+ * length in the pseudo header and in the UDP header changes.
+ */
+static struct sk_buff *udp4_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct udphdr *uh;
+	unsigned int oldlen;
+	unsigned int mss;
+	unsigned int len;
+	__be32 delta;
+
+	if (!pskb_may_pull(skb, sizeof(*uh)))
+		goto out;
+
+	oldlen = (u16)~skb->len;
+	__skb_pull(skb, sizeof(*uh));
+
+	mss = skb_shinfo(skb)->gso_size;
+	if (unlikely(skb->len <= mss))
+		goto out;
+
+	if (skb_gso_ok(skb, features | NETIF_F_GSO_ROBUST)) {
+		/* Packet is from an untrusted source, reset gso_segs. */
+		int type = skb_shinfo(skb)->gso_type;
+
+		if (unlikely(type & ~(SKB_GSO_UDP_L4 | SKB_GSO_DODGY) ||
+			     !(type & SKB_GSO_UDP_L4)))
+			goto out;
+
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len, mss);
+
+		segs = NULL;
+		goto out;
+	}
+
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		uh = udp_hdr(skb);
+		len = skb->len - skb_transport_offset(skb);
+		uh->len = htons(len);
+
+		delta = htonl(oldlen + len);
+		uh->check = ~csum_fold((__force __wsum)((__force u32)uh->check +
+				       (__force u32)delta));
+		if (skb->ip_summed != CHECKSUM_PARTIAL) {
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   skb->csum));
+			if (uh->check == 0)
+				uh->check = CSUM_MANGLED_0;
+		}
+	}
+
+out:
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -1860,6 +2003,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, int features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return udp4_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -0,0 +1,193 @@
+/*
+ * net/ipv4/udp_gso_test.c
+ *
+ * UDP_SEGMENT test: sends large buffers from a kernel UDP socket to a
+ * second one over the loopback device, once with one sendmsg() per
+ * datagram and once with one sendmsg() per buffer and UDP_SEGMENT set.
+ * The receiver checks that it sees the same datagrams either way, and
+ * the time taken by each is printed to the kernel log when the module
+ * is loaded.  lo does not offload UDP segmentation, so the second run
+ * measures the software GSO path in dev_gso_segment().
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/net.h>
+#include <linux/in.h>
+#include <linux/udp.h>
+#include <linux/ip.h>
+#include <linux/socket.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <net/sock.h>
+
+static int gso_size = 1400;
+module_param(gso_size, int, 0444);
+MODULE_PARM_DESC(gso_size, "payload of each datagram on the wire");
+
+static int size = 61600;
+module_param(size, int, 0444);
+MODULE_PARM_DESC(size, "bytes passed to each UDP_SEGMENT sendmsg()");
+
+static int loops = 10000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "number of buffers sent in each run");
+
+#define MAX_PAYLOAD	(0xFFFF - sizeof(struct iphdr) - sizeof(struct udphdr))
+
+static u8 *txbuf;
+static u8 *rxbuf;
+
+static int send_buf(struct socket *sock, int off, int len)
+{
+	struct msghdr msg = { .msg_flags = 0 };
+	struct kvec vec = { .iov_base = txbuf + off, .iov_len = len };
+	int ret;
+
+	ret = kernel_sendmsg(sock, &msg, &vec, 1, len);
+	if (ret >= 0 && ret != len)
+		ret = -EIO;
+	return ret < 0 ? ret : 0;
+}
+
+/* Receive the datagrams of one buffer and compare them with what was sent */
+static int recv_buf(struct socket *sock)
+{
+	struct msghdr msg = { .msg_flags = 0 };
+	struct kvec vec;
+	int off, len, ret;
+
+	for (off = 0; off < size; off += len) {
+		len = min(gso_size, size - off);
+		vec.iov_base = rxbuf;
+		vec.iov_len = MAX_PAYLOAD;
+		ret = kernel_recvmsg(sock, &msg, &vec, 1, MAX_PAYLOAD, 0);
+		if (ret < 0) {
+			printk(KERN_ERR "udp_gso_test: datagram at offset %d: "
+			       "error %d\n", off, ret);
+			return ret;
+		}
+		if (ret != len || memcmp(rxbuf, txbuf + off, len)) {
+			printk(KERN_ERR "udp_gso_test: datagram at offset %d: "
+			       "got %d bytes, expected %d\n", off, ret, len);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int run(struct socket *tx, struct socket *rx, int segment, s64 *us)
+{
+	int val = segment ? gso_size : 0;
+	ktime_t start;
+	int i, off, err;
+
+	err = kernel_setsockopt(tx, SOL_UDP, UDP_SEGMENT,
+				(char *)&val, sizeof(val));
+	if (err)
+		return err;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		if (segment) {
+			err = send_buf(tx, 0, size);
+		} else {
+			for (off = 0, err = 0; off < size && !err;
+			     off += gso_size)
+				err = send_buf(tx, off,
+					       min(gso_size, size - off));
+		}
+		if (!err)
+			err = recv_buf(rx);
+		if (err)
+			return err;
+	}
+	*us = ktime_us_delta(ktime_get(), start);
+	return 0;
+}
+
+static int __init udp_gso_test_init(void)
+{
+	struct socket *tx = NULL, *rx = NULL;
+	struct sockaddr_in addr;
+	struct timeval tv = { .tv_sec = 1 };
+	int rcvbuf = 4 << 20;
+	int addrlen = sizeof(addr);
+	s64 plain_us, gso_us;
+	int i, err;
+
+	if (gso_size <= 0 || gso_size > MAX_PAYLOAD || size <= 0 ||
+	    size > MAX_PAYLOAD || size > gso_size * UDP_MAX_SEGMENTS ||
+	    loops <= 0)
+		return -EINVAL;
+
+	err = -ENOMEM;
+	txbuf = vmalloc(MAX_PAYLOAD);
+	rxbuf = vmalloc(MAX_PAYLOAD);
+	if (!txbuf || !rxbuf)
+		goto out;
+	for (i = 0; i < MAX_PAYLOAD; i++)
+		txbuf[i] = i % 251;
+
+	err = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, &rx);
+	if (err)
+		goto out;
+	err = sock_create_kern(PF_INET, SOCK_DGRAM, IPPROTO_UDP, &tx);
+	if (err)
+		goto out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	err = kernel_bind(rx, (struct sockaddr *)&addr, sizeof(addr));
+	if (!err)
+		err = kernel_getsockname(rx, (struct sockaddr *)&addr,
+					 &addrlen);
+	if (!err)
+		err = kernel_setsockopt(rx, SOL_SOCKET, SO_RCVBUFFORCE,
+					(char *)&rcvbuf, sizeof(rcvbuf));
+	if (!err)
+		err = kernel_setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO,
+					(char *)&tv, sizeof(tv));
+	if (!err)
+		err = kernel_connect(tx, (struct sockaddr *)&addr,
+				     sizeof(addr), 0);
+	if (err)
+		goto out;
+
+	err = run(tx, rx, 0, &plain_us);
+	if (err)
+		goto out;
+	err = run(tx, rx, 1, &gso_us);
+	if (err)
+		goto out;
+
+	printk(KERN_INFO "udp_gso_test: %d x %d bytes in %d byte datagrams: "
+	       "%lld us without UDP_SEGMENT, %lld us with\n",
+	       loops, size, gso_size, plain_us, gso_us);
+out:
+	if (err)
+		printk(KERN_ERR "udp_gso_test: failed, error %d\n", err);
+	if (tx)
+		sock_release(tx);
+	if (rx)
+		sock_release(rx);
+	vfree(rxbuf);
+	vfree(txbuf);
+	return err;
+}
+module_init(udp_gso_test_init);
+
+static void __exit udp_gso_test_exit(void)
+{
+}
+module_exit(udp_gso_test_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("UDP_SEGMENT over loopback test");
@@ -156,9 +156,33 @@ struct packet_mreq_max {
 };
 
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+/*
+ * TPACKET_V3 receive ring: packets are packed one after the other into
+ * the block being filled, which is handed to user space when it is full
+ * or when the retire timer finds it has been open for a whole period.
+ * If user space still owns the next block the ring is frozen, and
+ * packets are dropped until that block is given back.
+ */
+struct packet_blk_ring {
+	unsigned int		blk_size;
+	unsigned int		hdrlen;		/* offset of the first packet */
+	unsigned int		feature_req_word;
+	unsigned int		active;		/* block being filled */
+	unsigned int		timer_blk;	/* active block at last timer run */
+	char			*nxt_offset;	/* room for the next packet */
+	char			*prev;		/* last packet of the block */
+	char			*blk_end;
+	u64			seq_num;
+	atomic_t		fill_in_prog;	/* packets being copied */
+	unsigned int		frozen:1,
+				shutdown:1;
+	unsigned long		tov;		/* retire timeout, in jiffies */
+	struct timer_list	retire_timer;
+};
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -171,6 +195,8 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_len;
 
 	atomic_t		pending;
+
+	struct packet_blk_ring	blk;
 };
 
 struct packet_sock;
@@ -182,7 +208,7 @@ static void packet_flush_mclist(struct sock *sk);
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	union tpacket_stats_u	stats;
 #ifdef CONFIG_PACKET_MMAP
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
@@ -196,6 +222,7 @@ struct packet_sock {
 				origdev:1;
 	int			ifindex;	/* bound device		*/
 	__be16			num;
+	struct packet_fanout	*fanout;
 	struct packet_mclist	*mclist;
 #ifdef CONFIG_PACKET_MMAP
 	atomic_t		mapped;
@@ -206,6 +233,32 @@ struct packet_sock {
 #endif
 };
 
+/*
+ * A fanout group is shared by all sockets that joined it with the same id.
+ * The group owns one protocol hook for the (protocol, device) pair its
+ * members are bound to; the members' own hooks are not registered while
+ * they belong to the group, and each frame is handed to exactly one of
+ * them.  arr[] holds the currently running members, so a member that is
+ * taken down (device down, ring resize) drops out of the rotation until it
+ * runs again.
+ */
+#define PACKET_FANOUT_MAX	256
+
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_skb_cb {
 	unsigned int origlen;
 	union {
@@ -312,6 +365,214 @@ static inline void packet_increment_head(struct packet_ring_buffer *buff)
 	buff->head = buff->head != buff->frame_max ? buff->head+1 : 0;
 }
 
+#define V3_ALIGNMENT		8
+#define PRB_DEF_RETIRE_TOV	8	/* msecs */
+
+static inline struct tpacket_block_desc *prb_block(struct packet_ring_buffer *rb,
+						   unsigned int n)
+{
+	return (struct tpacket_block_desc *)rb->pg_vec[n];
+}
+
+static int prb_block_status(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	return pbd->hdr.bh1.block_status;
+}
+
+static void prb_open_block(struct packet_ring_buffer *rb)
+{
+	struct packet_blk_ring *blk = &rb->blk;
+	struct tpacket_block_desc *pbd = prb_block(rb, blk->active);
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = ALIGN(sizeof(*pbd), V3_ALIGNMENT);
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = blk->hdrlen;
+	h1->blk_len = blk->hdrlen;
+	h1->seq_num = blk->seq_num++;
+	h1->ts_first_pkt.ts_sec = h1->ts_last_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+
+	blk->nxt_offset = (char *)pbd + blk->hdrlen;
+	blk->blk_end = (char *)pbd + blk->blk_size;
+	blk->prev = NULL;
+	blk->frozen = 0;
+}
+
+/* Hand the active block over to user space */
+static void prb_close_block(struct packet_ring_buffer *rb, int status)
+{
+	struct packet_blk_ring *blk = &rb->blk;
+	struct tpacket_block_desc *pbd = prb_block(rb, blk->active);
+	struct page *p_start, *p_end;
+
+	/* packets already reserved in the block may still be copied in */
+	while (atomic_read(&blk->fill_in_prog))
+		cpu_relax();
+
+	p_start = virt_to_page(pbd);
+	p_end = virt_to_page(blk->nxt_offset - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+
+	smp_wmb();
+	pbd->hdr.bh1.block_status = TP_STATUS_USER | status;
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	smp_wmb();
+
+	blk->active = blk->active != rb->pg_vec_len - 1 ? blk->active + 1 : 0;
+}
+
+/* Open the next block if user space gave it back, freeze the ring if not */
+static void prb_open_next_block(struct packet_sock *po,
+				struct packet_ring_buffer *rb)
+{
+	struct packet_blk_ring *blk = &rb->blk;
+
+	if (prb_block_status(prb_block(rb, blk->active)) == TP_STATUS_KERNEL) {
+		prb_open_block(rb);
+	} else if (!blk->frozen) {
+		blk->frozen = 1;
+		po->stats.stats3.tp_freeze_q_cnt++;
+	}
+}
+
+/*
+ * Reserve room for a packet of @len bytes in the active block, retiring
+ * it first if it is full.  Called with the receive queue lock held; the
+ * caller copies the packet in without the lock and then calls
+ * prb_fill_done().  Sets @retired if a block was handed over.
+ */
+static void *prb_reserve(struct packet_sock *po, struct sk_buff *skb,
+			 unsigned int len, int *retired)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct packet_blk_ring *blk = &rb->blk;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *h3;
+	struct timespec ts;
+
+	if (blk->frozen) {
+		prb_open_next_block(po, rb);
+		if (blk->frozen)
+			return NULL;
+	}
+
+	len = ALIGN(len, V3_ALIGNMENT);
+	if (blk->nxt_offset + len > blk->blk_end) {
+		prb_close_block(rb, 0);
+		*retired = 1;
+		prb_open_next_block(po, rb);
+		if (blk->frozen)
+			return NULL;
+	}
+
+	if (skb->tstamp.tv64)
+		ts = ktime_to_timespec(skb->tstamp);
+	else
+		getnstimeofday(&ts);
+
+	pbd = prb_block(rb, blk->active);
+	h3 = (struct tpacket3_hdr *)blk->nxt_offset;
+	h3->tp_next_offset = 0;
+	h3->tp_sec = ts.tv_sec;
+	h3->tp_nsec = ts.tv_nsec;
+	if (blk->prev) {
+		((struct tpacket3_hdr *)blk->prev)->tp_next_offset =
+			blk->nxt_offset - blk->prev;
+	} else {
+		pbd->hdr.bh1.ts_first_pkt.ts_sec = ts.tv_sec;
+		pbd->hdr.bh1.ts_first_pkt.ts_nsec = ts.tv_nsec;
+	}
+	pbd->hdr.bh1.ts_last_pkt.ts_sec = ts.tv_sec;
+	pbd->hdr.bh1.ts_last_pkt.ts_nsec = ts.tv_nsec;
+	pbd->hdr.bh1.num_pkts++;
+	pbd->hdr.bh1.blk_len += len;
+
+	blk->prev = blk->nxt_offset;
+	blk->nxt_offset += len;
+	atomic_inc(&blk->fill_in_prog);
+
+	return h3;
+}
+
+static inline void prb_fill_done(struct packet_ring_buffer *rb)
+{
+	smp_mb__before_atomic_dec();
+	atomic_dec(&rb->blk.fill_in_prog);
+}
+
+/* True if the block before the active one is waiting for user space */
+static int prb_previous_block_ready(struct packet_ring_buffer *rb)
+{
+	unsigned int prev = rb->blk.active ? rb->blk.active - 1 :
+					     rb->pg_vec_len - 1;
+
+	return prb_block_status(prb_block(rb, prev)) != TP_STATUS_KERNEL;
+}
+
+/*
+ * Retire the active block if it has packets and was already active at
+ * the previous run, so that a slow trickle of packets still reaches user
+ * space within two timeouts.  A frozen ring is restarted here as well if
+ * user space gave a block back.
+ */
+static void prb_retire_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct sock *sk = &po->sk;
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct packet_blk_ring *blk = &rb->blk;
+	int retired = 0;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (blk->shutdown)
+		goto out;
+
+	if (blk->frozen) {
+		prb_open_next_block(po, rb);
+	} else if (blk->timer_blk == blk->active &&
+		   prb_block(rb, blk->active)->hdr.bh1.num_pkts) {
+		prb_close_block(rb, TP_STATUS_BLK_TMO);
+		retired = 1;
+		prb_open_next_block(po, rb);
+	}
+	blk->timer_blk = blk->active;
+	mod_timer(&blk->retire_timer, jiffies + blk->tov);
+out:
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	if (retired)
+		sk->sk_data_ready(sk, 0);
+}
+
+static void prb_init(struct packet_sock *po, struct packet_ring_buffer *rb,
+		     struct tpacket_req3 *req3)
+{
+	struct packet_blk_ring *blk = &rb->blk;
+
+	memset(blk, 0, sizeof(*blk));
+	blk->blk_size = req3->tp_block_size;
+	blk->hdrlen = ALIGN(sizeof(struct tpacket_block_desc), V3_ALIGNMENT) +
+		      ALIGN(req3->tp_sizeof_priv, V3_ALIGNMENT);
+	blk->feature_req_word = req3->tp_feature_req_word;
+	blk->seq_num = 1;
+	blk->tov = msecs_to_jiffies(req3->tp_retire_blk_tov ? :
+				    PRB_DEF_RETIRE_TOV);
+	if (!blk->tov)
+		blk->tov = 1;
+	setup_timer(&blk->retire_timer, prb_retire_blk_timer_expired,
+		    (unsigned long)po);
+}
+
 #endif
 
 static inline struct packet_sock *pkt_sk(struct sock *sk)
@@ -319,6 +580,257 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+static void __fanout_link(struct sock *sk, struct packet_sock *po);
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po);
+
+/* register_prot_hook must be invoked with the po->bind_lock held,
+ * or from a context in which asynchronous accesses to the packet
+ * socket is not possible (packet_create()).
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+/* {,__}unregister_prot_hook() must be invoked with the po->bind_lock
+ * held.  If the sync parameter is true, we will temporarily drop
+ * the po->bind_lock and do a synchronize_net to make sure no
+ * asynchronous packet processing paths still refer to the elements
+ * of po->prot_hook.  If the sync parameter is false, it is the
+ * callers responsibility to take care of this.
+ */
+static void __unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	po->running = 0;
+	if (po->fanout)
+		__fanout_unlink(sk, po);
+	else
+		__dev_remove_pack(&po->prot_hook);
+	__sock_put(sk);
+
+	if (sync) {
+		spin_unlock(&po->bind_lock);
+		synchronize_net();
+		spin_lock(&po->bind_lock);
+	}
+}
+
+static void unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (po->running)
+		__unregister_prot_hook(sk, sync);
+}
+
+/*
+ *	Fanout groups.
+ */
+
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb, unsigned int num)
+{
+	u32 idx, hash = skb_get_rxhash(skb);
+
+	idx = ((u64)hash * num) >> 32;
+
+	return f->arr[idx];
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb, unsigned int num)
+{
+	int cur, old;
+
+	cur = atomic_read(&f->rr_cur);
+	while ((old = atomic_cmpxchg(&f->rr_cur, cur,
+				     (cur + 1 >= num ? 0 : cur + 1))) != cur)
+		cur = old;
+	/* num may have shrunk since rr_cur was last stored */
+	if (cur >= num)
+		cur = 0;
+	return f->arr[cur];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb, unsigned int num)
+{
+	unsigned int cpu = smp_processor_id();
+
+	return f->arr[cpu % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt,
+			     struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = ACCESS_ONCE(f->num_members);
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (!net_eq(dev_net(dev), read_pnet(&f->net)) || !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+static int fanout_add(struct sock *sk, u16 id, u8 type)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!po->running)
+		return -EINVAL;
+
+	if (po->fanout)
+		return -EALREADY;
+
+	mutex_lock(&fanout_mutex);
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	err = -ENOMEM;
+	if (!match) {
+		match = kzalloc(sizeof(*match), GFP_KERNEL);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+	err = -EINVAL;
+	if (match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			spin_lock(&po->bind_lock);
+			if (po->running) {
+				__dev_remove_pack(&po->prot_hook);
+				po->fanout = match;
+				atomic_inc(&match->sk_ref);
+				__fanout_link(sk, po);
+				err = 0;
+			} else {
+				err = -EINVAL;
+			}
+			spin_unlock(&po->bind_lock);
+		}
+	}
+	if (err && !atomic_read(&match->sk_ref)) {
+		list_del(&match->list);
+		dev_remove_pack(&match->prot_hook);
+		kfree(match);
+	}
+out:
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	f = po->fanout;
+	if (!f)
+		return;
+
+	po->fanout = NULL;
+
+	mutex_lock(&fanout_mutex);
+	if (atomic_dec_and_test(&f->sk_ref)) {
+		list_del(&f->list);
+		dev_remove_pack(&f->prot_hook);
+		kfree(f);
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -517,7 +1029,7 @@ static inline unsigned int run_filter(struct sk_buff *skb, struct sock *sk,
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter != NULL)
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = SK_RUN_FILTER(filter, skb);
 	rcu_read_unlock_bh();
 
 	return res;
@@ -625,7 +1137,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 	nf_reset(skb);
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	po->stats.tp_packets++;
+	po->stats.stats1.tp_packets++;
 	__skb_queue_tail(&sk->sk_receive_queue, skb);
 	spin_unlock(&sk->sk_receive_queue.lock);
 	sk->sk_data_ready(sk, skb->len);
@@ -633,7 +1145,7 @@ static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 
 drop_n_acct:
 	spin_lock(&sk->sk_receive_queue.lock);
-	po->stats.tp_drops++;
+	po->stats.stats1.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
 drop_n_restore:
@@ -656,6 +1168,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -666,6 +1179,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	struct sk_buff *copy_skb = NULL;
 	struct timeval tv;
 	struct timespec ts;
+	int retired = 0;
 
 	if (skb->pkt_type == PACKET_LOOPBACK)
 		goto drop;
@@ -726,16 +1240,23 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
-	if (!h.raw)
-		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
-	po->stats.tp_packets++;
+	if (po->tp_version == TPACKET_V3) {
+		h.raw = prb_reserve(po, skb, macoff + snaplen, &retired);
+		if (!h.raw)
+			goto ring_is_full;
+	} else {
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
+		if (!h.raw)
+			goto ring_is_full;
+		packet_increment_head(&po->rx_ring);
+	}
+	po->stats.stats1.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
 		__skb_queue_tail(&sk->sk_receive_queue, copy_skb);
 	}
-	if (!po->stats.tp_drops)
+	if (!po->stats.stats1.tp_drops)
 		status &= ~TP_STATUS_LOSING;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
@@ -769,6 +1290,21 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = skb->vlan_tci;
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* the block, not the packet, carries TP_STATUS_USER */
+		h.h3->tp_status = status & ~TP_STATUS_USER;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		/* tp_sec and tp_nsec were set by prb_reserve() */
+		if (po->rx_ring.blk.feature_req_word & TP_FT_REQ_FILL_RXHASH)
+			h.h3->hv1.tp_rxhash = skb->rxhash;
+		else
+			h.h3->hv1.tp_rxhash = 0;
+		h.h3->hv1.tp_vlan_tci = skb->vlan_tci;
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -784,7 +1320,8 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version <= TPACKET_V2)
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 	{
 		struct page *p_start, *p_end;
@@ -798,7 +1335,14 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		}
 	}
 
-	sk->sk_data_ready(sk, 0);
+	if (po->tp_version <= TPACKET_V2) {
+		sk->sk_data_ready(sk, 0);
+	} else {
+		/* user space is woken when the block is retired */
+		prb_fill_done(&po->rx_ring);
+		if (retired)
+			sk->sk_data_ready(sk, 0);
+	}
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -810,7 +1354,7 @@ drop:
 	return 0;
 
 ring_is_full:
-	po->stats.tp_drops++;
+	po->stats.stats1.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
 	sk->sk_data_ready(sk, 0);
@@ -1171,7 +1715,7 @@ static int packet_release(struct socket *sock)
 	struct packet_sock *po;
 	struct net *net;
 #ifdef CONFIG_PACKET_MMAP
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 #endif
 
 	if (!sk)
@@ -1189,28 +1733,26 @@ static int packet_release(struct socket *sock)
 	 *	Unhook packet receive handler.
 	 */
 
-	if (po->running) {
-		/*
-		 *	Remove the protocol hook
-		 */
-		dev_remove_pack(&po->prot_hook);
-		po->running = 0;
-		po->num = 0;
-		__sock_put(sk);
-	}
+	spin_lock(&po->bind_lock);
+	unregister_prot_hook(sk, false);
+	po->num = 0;
+	spin_unlock(&po->bind_lock);
 
 	packet_flush_mclist(sk);
 
 #ifdef CONFIG_PACKET_MMAP
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 #endif
 
+	fanout_release(sk);
+
+	synchronize_net();
 	/*
 	 *	Now the socket is dead. No more input will appear.
 	 */
@@ -1234,6 +1776,11 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+
+	/* A fanout member is tied to the group's device and protocol */
+	if (po->fanout)
+		return -EINVAL;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1241,14 +1788,8 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 	lock_sock(sk);
 
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
-		po->num = 0;
-		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
-		spin_lock(&po->bind_lock);
-	}
+	po->num = 0;
+	unregister_prot_hook(sk, true);
 
 	po->num = protocol;
 	po->prot_hook.type = protocol;
@@ -1260,9 +1801,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1392,9 +1931,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol)
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	write_lock_bh(&net->packet.sklist_lock);
@@ -1736,13 +2273,26 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		memset(&req_u, 0, sizeof(req_u));
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1769,6 +2319,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -1826,6 +2377,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->origdev = !!val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1839,7 +2401,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	union tpacket_stats_u st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1852,13 +2414,18 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else {
+			if (len > sizeof(struct tpacket_stats))
+				len = sizeof(struct tpacket_stats);
+		}
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
 		memset(&po->stats, 0, sizeof(st));
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
-		st.tp_packets += st.tp_drops;
+		st.stats1.tp_packets += st.stats1.tp_drops;
 
 		data = &st;
 		break;
@@ -1874,6 +2441,16 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 			len = sizeof(int);
 		val = po->origdev;
 
+		data = &val;
+		break;
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16)) :
+		       0);
+
 		data = &val;
 		break;
 #ifdef CONFIG_PACKET_MMAP
@@ -1895,6 +2472,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -1946,9 +2526,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					__unregister_prot_hook(sk, false);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -1963,11 +2541,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 		case NETDEV_UP:
 			spin_lock(&po->bind_lock);
 			if (dev->ifindex == po->ifindex && po->num &&
-			    !po->running) {
-				dev_add_pack(&po->prot_hook);
-				sock_hold(sk);
-				po->running = 1;
-			}
+			    !po->running)
+				register_prot_hook(sk);
 			spin_unlock(&po->bind_lock);
 			break;
 		}
@@ -2046,7 +2621,11 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (po->tp_version == TPACKET_V3) {
+			if (prb_previous_block_ready(&po->rx_ring))
+				mask |= POLLIN | POLLRDNORM;
+		} else if (!packet_previous_frame(po, &po->rx_ring,
+						  TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2132,7 +2711,7 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	char **pg_vec = NULL;
@@ -2140,6 +2719,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
+	struct tpacket_req *req = &req_u->req;
+	int blk_ring = 0;
 	__be16 num;
 	int err;
 
@@ -2167,6 +2748,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2187,6 +2771,24 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 					req->tp_frame_nr))
 			goto out;
 
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* block mode is for receiving only */
+			if (unlikely(tx_ring))
+				goto out;
+			/* a packet of tp_frame_size must fit in a block */
+			if (unlikely(req3->tp_sizeof_priv >= req->tp_block_size ||
+				     ALIGN(sizeof(struct tpacket_block_desc), 8) +
+				     ALIGN(req3->tp_sizeof_priv, 8) +
+				     req->tp_frame_size > req->tp_block_size))
+				goto out;
+			if (unlikely(req3->tp_feature_req_word &
+				     ~TP_FT_REQ_FILL_RXHASH))
+				goto out;
+			blk_ring = 1;
+		}
+
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
 		pg_vec = alloc_pg_vec(req, order);
@@ -2207,10 +2809,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
+		__unregister_prot_hook(sk, false);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2219,19 +2819,36 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	err = -EBUSY;
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
+		int stop_timer = 0;
+
 		err = 0;
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3) {
+			/* the timer must not touch the blocks any more */
+			rb->blk.shutdown = 1;
+			stop_timer = 1;
+		}
 		pg_vec = XC(rb->pg_vec, pg_vec);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (blk_ring) {
+			prb_init(po, rb, &req_u->req3);
+			prb_open_block(rb);
+		}
 		spin_unlock_bh(&rb_queue->lock);
 
+		if (stop_timer)
+			del_timer_sync(&rb->blk.retire_timer);
+
 		order = XC(rb->pg_vec_order, order);
 		req->tp_block_nr = XC(rb->pg_vec_len, req->tp_block_nr);
 
 		rb->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+		if (blk_ring)
+			mod_timer(&rb->blk.retire_timer,
+				  jiffies + rb->blk.tov);
 		po->prot_hook.func = (po->rx_ring.pg_vec) ?
 						tpacket_rcv : packet_rcv;
 		skb_queue_purge(rb_queue);
@@ -2243,11 +2860,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_unlock(&po->pg_vec_lock);
 
 	spin_lock(&po->bind_lock);
-	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
+	if (was_running) {
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 